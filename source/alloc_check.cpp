@@ -0,0 +1,118 @@
+// Runs the CPU side of a frame (transform updates, BVH refit and culling,
+// and the front-to-back sort from the frame arena) for many frames under
+// the counting operator new, and fails if a steady-state frame allocates.
+// Standalone: needs neither Vulkan nor a window. Built with
+// COUNT_HEAP_ALLOCATIONS by the makefile.
+//
+//	make alloc-check
+
+#include "alloc_counter.hpp"
+#include "bvh.hpp"
+#include "frame_arena.hpp"
+#include "scene.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const uint32_t slot_count = 3;			// frame arenas, as with a triple-buffered swapchain
+const uint32_t warmup_frames = 4 * slot_count;
+const uint32_t checked_frames = 240;
+
+const uint32_t object_count = 20000;
+
+}
+
+int main() {
+	if (!IsCountingHeapAllocations()) {
+		cerr << "Built without COUNT_HEAP_ALLOCATIONS; nothing to check" << endl;
+		return 1;
+	}
+
+	// One spinning root with everything else spread below it, so every
+	// frame moves the whole scene like the app's animation does
+	Aabb quad_bounds = { glm::vec3(-0.5f, -0.5f, 0.0f), glm::vec3(0.5f, 0.5f, 0.0f) };
+	MeshRef quad;
+	quad.index_count = 6;
+
+	Scene scene;
+	uint32_t root = scene.Create(glm::mat4(), quad, quad_bounds);
+	for (uint32_t i = 1; i < object_count; i++) {
+		glm::vec3 offset(
+			(float) (i % 100) - 50.0f,
+			(float) ((i / 100) % 100) - 50.0f,
+			(float) (i / 10000) * 2.0f
+		);
+		scene.Create(glm::translate(glm::mat4(), offset), quad, quad_bounds, 0, root);
+	}
+	scene.UpdateTransforms();
+
+	Bvh bvh;
+	bvh.Build(scene.GetWorldBounds());
+
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 200.0f);
+	glm::mat4 view = glm::lookAt(
+		glm::vec3(60.0f, 60.0f, 40.0f),
+		glm::vec3(0.0f, 0.0f, 0.0f),
+		glm::vec3(0.0f, 0.0f, 1.0f)
+	);
+	Frustum frustum = Frustum::FromMatrix(proj * view);
+
+	vector<FrameArena> arenas(slot_count);
+	vector<uint32_t> visible;
+
+	uint64_t allocations = 0;
+	uint32_t allocating_frames = 0;
+	size_t visible_count = 0;
+
+	for (uint32_t frame = 0; frame < warmup_frames + checked_frames; frame++) {
+		uint64_t before = HeapAllocationCount();
+
+		// Reset once the slot's fence would have signaled
+		FrameArena& arena = arenas[frame % slot_count];
+		arena.Reset();
+
+		scene.SetLocalTransform(root, glm::rotate(
+			glm::mat4(), frame * 0.01f, glm::vec3(0.0f, 0.0f, 1.0f)
+		));
+
+		for (uint32_t object : scene.UpdateTransforms()) {
+			bvh.Update(object, scene.GetWorldBounds(object));
+		}
+		bvh.Refit();
+		bvh.Cull(frustum, visible);
+
+		using SortKey = pair<float, uint32_t>;
+		ArenaAllocator<SortKey> scratch(arena);
+		ArenaVector<SortKey> keys(scratch);
+		keys.reserve(visible.size());
+
+		for (uint32_t object : visible) {
+			glm::vec4 center = view * glm::vec4(scene.GetWorldBounds(object).Center(), 1.0f);
+			keys.emplace_back(-center.z, object);
+		}
+		sort(keys.begin(), keys.end(),
+			[](const SortKey& a, const SortKey& b) { return a.first < b.first; });
+
+		// The first frames size the containers and arenas
+		if (frame < warmup_frames) continue;
+
+		uint64_t made = HeapAllocationCount() - before;
+		allocations += made;
+		if (made) allocating_frames++;
+		visible_count = visible.size();
+	}
+
+	cout << checked_frames << " frames of " << object_count << " objects ("
+		<< visible_count << " visible): " << allocations << " heap allocations in "
+		<< allocating_frames << " frames" << endl;
+
+	return allocations ? 1 : 0;
+}
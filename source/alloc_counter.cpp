@@ -0,0 +1,48 @@
+#include "alloc_counter.hpp"
+
+#ifdef COUNT_HEAP_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<uint64_t> allocation_count { 0 };
+
+void* CountedAllocate(size_t size) {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+	void* memory = std::malloc(size ? size : 1);
+	if (!memory) throw std::bad_alloc();
+	return memory;
+}
+
+}
+
+void* operator new(size_t size) { return CountedAllocate(size); }
+void* operator new[](size_t size) { return CountedAllocate(size); }
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t) noexcept { std::free(memory); }
+
+uint64_t HeapAllocationCount() {
+	return allocation_count.load(std::memory_order_relaxed);
+}
+
+bool IsCountingHeapAllocations() {
+	return true;
+}
+
+#else
+
+uint64_t HeapAllocationCount() {
+	return 0;
+}
+
+bool IsCountingHeapAllocations() {
+	return false;
+}
+
+#endif
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdint>
+
+// Number of global operator new calls so far. Only counts when the build
+// defines COUNT_HEAP_ALLOCATIONS (see the makefile); otherwise always zero.
+// Used to check that steady-state frames do not allocate.
+uint64_t HeapAllocationCount();
+
+bool IsCountingHeapAllocations();
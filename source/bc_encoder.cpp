@@ -0,0 +1,383 @@
+#include "bc_encoder.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+uint16_t To565(float r, float g, float b) {
+	uint32_t r5 = (uint32_t) (r * 31.0f / 255.0f + 0.5f);
+	uint32_t g6 = (uint32_t) (g * 63.0f / 255.0f + 0.5f);
+	uint32_t b5 = (uint32_t) (b * 31.0f / 255.0f + 0.5f);
+	return (uint16_t) ((r5 << 11) | (g6 << 5) | b5);
+}
+
+void From565(uint16_t c, float& r, float& g, float& b) {
+	uint32_t r5 = (c >> 11) & 31, g6 = (c >> 5) & 63, b5 = c & 31;
+	r = (float) ((r5 << 3) | (r5 >> 2));
+	g = (float) ((g6 << 2) | (g6 >> 4));
+	b = (float) ((b5 << 3) | (b5 >> 2));
+}
+
+#ifdef __SSE2__
+float HorizontalMin(__m128 v) {
+	v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtss_f32(v);
+}
+
+float HorizontalMax(__m128 v) {
+	v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtss_f32(v);
+}
+
+float HorizontalSum(__m128 v) {
+	v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtss_f32(v);
+}
+#endif
+
+// Fits the color part of a BC1/BC3 block. The endpoints are the corners of
+// the (slightly inset) RGB bounding box, on the diagonal that follows the
+// sign of the color covariance; each texel then takes the nearest of the
+// four palette entries.
+void EncodeColorBlock(const uint8_t* block, uint8_t* out) {
+	alignas(16) float r[16], g[16], b[16];
+	for (int i = 0; i < 16; i++) {
+		r[i] = block[i * 4 + 0];
+		g[i] = block[i * 4 + 1];
+		b[i] = block[i * 4 + 2];
+	}
+
+	float min_r, min_g, min_b, max_r, max_g, max_b;
+	float cov_rb = 0.0f, cov_gb = 0.0f;
+
+#ifdef __SSE2__
+	__m128 vmin_r = _mm_load_ps(r), vmax_r = vmin_r;
+	__m128 vmin_g = _mm_load_ps(g), vmax_g = vmin_g;
+	__m128 vmin_b = _mm_load_ps(b), vmax_b = vmin_b;
+	for (int i = 4; i < 16; i += 4) {
+		__m128 vr = _mm_load_ps(r + i), vg = _mm_load_ps(g + i), vb = _mm_load_ps(b + i);
+		vmin_r = _mm_min_ps(vmin_r, vr); vmax_r = _mm_max_ps(vmax_r, vr);
+		vmin_g = _mm_min_ps(vmin_g, vg); vmax_g = _mm_max_ps(vmax_g, vg);
+		vmin_b = _mm_min_ps(vmin_b, vb); vmax_b = _mm_max_ps(vmax_b, vb);
+	}
+	min_r = HorizontalMin(vmin_r); max_r = HorizontalMax(vmax_r);
+	min_g = HorizontalMin(vmin_g); max_g = HorizontalMax(vmax_g);
+	min_b = HorizontalMin(vmin_b); max_b = HorizontalMax(vmax_b);
+
+	__m128 center_r = _mm_set1_ps((min_r + max_r) * 0.5f);
+	__m128 center_g = _mm_set1_ps((min_g + max_g) * 0.5f);
+	__m128 center_b = _mm_set1_ps((min_b + max_b) * 0.5f);
+	__m128 vcov_rb = _mm_setzero_ps(), vcov_gb = _mm_setzero_ps();
+	for (int i = 0; i < 16; i += 4) {
+		__m128 dr = _mm_sub_ps(_mm_load_ps(r + i), center_r);
+		__m128 dg = _mm_sub_ps(_mm_load_ps(g + i), center_g);
+		__m128 db = _mm_sub_ps(_mm_load_ps(b + i), center_b);
+		vcov_rb = _mm_add_ps(vcov_rb, _mm_mul_ps(dr, db));
+		vcov_gb = _mm_add_ps(vcov_gb, _mm_mul_ps(dg, db));
+	}
+	cov_rb = HorizontalSum(vcov_rb);
+	cov_gb = HorizontalSum(vcov_gb);
+#else
+	min_r = max_r = r[0];
+	min_g = max_g = g[0];
+	min_b = max_b = b[0];
+	for (int i = 1; i < 16; i++) {
+		min_r = std::min(min_r, r[i]); max_r = std::max(max_r, r[i]);
+		min_g = std::min(min_g, g[i]); max_g = std::max(max_g, g[i]);
+		min_b = std::min(min_b, b[i]); max_b = std::max(max_b, b[i]);
+	}
+
+	float center_r = (min_r + max_r) * 0.5f;
+	float center_g = (min_g + max_g) * 0.5f;
+	float center_b = (min_b + max_b) * 0.5f;
+	for (int i = 0; i < 16; i++) {
+		cov_rb += (r[i] - center_r) * (b[i] - center_b);
+		cov_gb += (g[i] - center_g) * (b[i] - center_b);
+	}
+#endif
+
+	// Pull the endpoints in by 1/16 of the range; the extremes are rarely
+	// worth an exact match at the cost of the texels in between
+	float inset_r = (max_r - min_r) / 16.0f;
+	float inset_g = (max_g - min_g) / 16.0f;
+	float inset_b = (max_b - min_b) / 16.0f;
+	min_r += inset_r; max_r -= inset_r;
+	min_g += inset_g; max_g -= inset_g;
+	min_b += inset_b; max_b -= inset_b;
+
+	if (cov_rb < 0.0f) std::swap(min_r, max_r);
+	if (cov_gb < 0.0f) std::swap(min_g, max_g);
+
+	uint16_t c0 = To565(max_r, max_g, max_b);
+	uint16_t c1 = To565(min_r, min_g, min_b);
+
+	// c0 > c1 selects the four color mode
+	if (c0 < c1) std::swap(c0, c1);
+
+	out[0] = c0 & 0xFF; out[1] = c0 >> 8;
+	out[2] = c1 & 0xFF; out[3] = c1 >> 8;
+
+	if (c0 == c1) {
+		out[4] = out[5] = out[6] = out[7] = 0;
+		return;
+	}
+
+	float pr[4], pg[4], pb[4];
+	From565(c0, pr[0], pg[0], pb[0]);
+	From565(c1, pr[1], pg[1], pb[1]);
+	pr[2] = (2.0f * pr[0] + pr[1]) / 3.0f;
+	pg[2] = (2.0f * pg[0] + pg[1]) / 3.0f;
+	pb[2] = (2.0f * pb[0] + pb[1]) / 3.0f;
+	pr[3] = (pr[0] + 2.0f * pr[1]) / 3.0f;
+	pg[3] = (pg[0] + 2.0f * pg[1]) / 3.0f;
+	pb[3] = (pb[0] + 2.0f * pb[1]) / 3.0f;
+
+	alignas(16) int32_t indices[16];
+
+#ifdef __SSE2__
+	for (int i = 0; i < 16; i += 4) {
+		__m128 vr = _mm_load_ps(r + i), vg = _mm_load_ps(g + i), vb = _mm_load_ps(b + i);
+
+		__m128 best_distance = _mm_set1_ps(1e30f);
+		__m128i best_index = _mm_setzero_si128();
+
+		for (int k = 0; k < 4; k++) {
+			__m128 dr = _mm_sub_ps(vr, _mm_set1_ps(pr[k]));
+			__m128 dg = _mm_sub_ps(vg, _mm_set1_ps(pg[k]));
+			__m128 db = _mm_sub_ps(vb, _mm_set1_ps(pb[k]));
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)),
+				_mm_mul_ps(db, db));
+
+			__m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best_distance));
+			best_distance = _mm_min_ps(distance, best_distance);
+			best_index = _mm_or_si128(
+				_mm_and_si128(closer, _mm_set1_epi32(k)),
+				_mm_andnot_si128(closer, best_index));
+		}
+
+		_mm_store_si128((__m128i*) (indices + i), best_index);
+	}
+#else
+	for (int i = 0; i < 16; i++) {
+		float best_distance = 1e30f;
+		for (int k = 0; k < 4; k++) {
+			float dr = r[i] - pr[k], dg = g[i] - pg[k], db = b[i] - pb[k];
+			float distance = dr * dr + dg * dg + db * db;
+			if (distance < best_distance) {
+				best_distance = distance;
+				indices[i] = k;
+			}
+		}
+	}
+#endif
+
+	uint32_t bits = 0;
+	for (int i = 0; i < 16; i++) bits |= (uint32_t) indices[i] << (i * 2);
+
+	out[4] = bits & 0xFF;
+	out[5] = (bits >> 8) & 0xFF;
+	out[6] = (bits >> 16) & 0xFF;
+	out[7] = bits >> 24;
+}
+
+// Encodes one channel (every `stride` bytes) as a BC4 block in the eight
+// value mode: the endpoints are the channel's extremes and each texel gets
+// the nearest of the eight evenly spaced values between them.
+void EncodeChannelBlock(const uint8_t* values, int stride, uint8_t* out) {
+	alignas(16) float v[16];
+	for (int i = 0; i < 16; i++) v[i] = values[i * stride];
+
+	float lo = v[0], hi = v[0];
+	for (int i = 1; i < 16; i++) {
+		lo = std::min(lo, v[i]);
+		hi = std::max(hi, v[i]);
+	}
+
+	out[0] = (uint8_t) hi;
+	out[1] = (uint8_t) lo;
+
+	if (hi == lo) {
+		memset(out + 2, 0, 6);
+		return;
+	}
+
+	// Position between hi (0) and lo (7); palette order is
+	// hi, lo, then the six interpolated values from hi towards lo
+	alignas(16) int32_t steps[16];
+	float scale = 7.0f / (hi - lo);
+
+#ifdef __SSE2__
+	__m128 vhi = _mm_set1_ps(hi), vscale = _mm_set1_ps(scale);
+	for (int i = 0; i < 16; i += 4) {
+		__m128 t = _mm_mul_ps(_mm_sub_ps(vhi, _mm_load_ps(v + i)), vscale);
+		_mm_store_si128((__m128i*) (steps + i), _mm_cvtps_epi32(t));
+	}
+#else
+	for (int i = 0; i < 16; i++) {
+		steps[i] = (int32_t) ((hi - v[i]) * scale + 0.5f);
+	}
+#endif
+
+	uint64_t bits = 0;
+	for (int i = 0; i < 16; i++) {
+		int32_t step = steps[i];
+		uint64_t index = step == 0 ? 0 : (step == 7 ? 1 : (uint64_t) step + 1);
+		bits |= index << (i * 3);
+	}
+
+	for (int i = 0; i < 6; i++) out[2 + i] = (uint8_t) (bits >> (i * 8));
+}
+
+void FetchBlock(
+	const uint8_t* rgba, uint32_t width, uint32_t height,
+	uint32_t block_x, uint32_t block_y, uint8_t* block
+) {
+	// Edge blocks repeat the last row/column
+	for (uint32_t y = 0; y < 4; y++) {
+		uint32_t sy = std::min(block_y * 4 + y, height - 1);
+		for (uint32_t x = 0; x < 4; x++) {
+			uint32_t sx = std::min(block_x * 4 + x, width - 1);
+			memcpy(block + (y * 4 + x) * 4, rgba + ((size_t) sy * width + sx) * 4, 4);
+		}
+	}
+}
+
+} // namespace
+
+void EncodeBC1Block(const uint8_t* block, uint8_t* out) {
+	EncodeColorBlock(block, out);
+}
+
+void EncodeBC3Block(const uint8_t* block, uint8_t* out) {
+	EncodeChannelBlock(block + 3, 4, out);
+	EncodeColorBlock(block, out + 8);
+}
+
+void EncodeBC5Block(const uint8_t* block, uint8_t* out) {
+	EncodeChannelBlock(block + 0, 4, out);
+	EncodeChannelBlock(block + 1, 4, out + 8);
+}
+
+void EncodeImage(
+	const uint8_t* rgba, uint32_t width, uint32_t height,
+	BlockFormat format, uint8_t* out, JobSystem* jobs
+) {
+	void (*encode)(const uint8_t*, uint8_t*);
+	switch (format) {
+	case BlockFormat::BC1: encode = EncodeBC1Block; break;
+	case BlockFormat::BC3: encode = EncodeBC3Block; break;
+	case BlockFormat::BC5: encode = EncodeBC5Block; break;
+	default:
+		throw std::runtime_error("No CPU encoder for the requested format");
+	}
+
+	uint32_t blocks_x = (width + 3) / 4;
+	uint32_t blocks_y = (height + 3) / 4;
+	size_t block_bytes = BlockBytes(format);
+
+	auto encode_rows = [&](uint32_t first_row, uint32_t end_row) {
+		uint8_t block[64];
+		for (uint32_t y = first_row; y < end_row; y++) {
+			uint8_t* row = out + (size_t) y * blocks_x * block_bytes;
+			for (uint32_t x = 0; x < blocks_x; x++) {
+				FetchBlock(rgba, width, height, x, y, block);
+				encode(block, row + x * block_bytes);
+			}
+		}
+	};
+
+	if (!jobs) {
+		encode_rows(0, blocks_y);
+		return;
+	}
+
+	// Chunks of roughly 256 blocks, enough to amortize scheduling
+	uint32_t grain = std::max(256u / std::max(blocks_x, 1u), 1u);
+	jobs->ParallelFor(blocks_y, grain, encode_rows);
+}
+
+void GenerateMipChain(ImageData& image) {
+	if (image.format != BlockFormat::RGBA8 || image.levels.size() != 1) {
+		throw std::runtime_error("Mip chains are only generated for single-level RGBA8 images");
+	}
+
+	uint32_t width = image.width;
+	uint32_t height = image.height;
+
+	while (width > 1 || height > 1) {
+		uint32_t next_width = std::max(width / 2, 1u);
+		uint32_t next_height = std::max(height / 2, 1u);
+
+		// AddLevel may reallocate, so look the source up afterwards
+		uint8_t* dst = image.AddLevel(
+			next_width, next_height, LevelBytes(BlockFormat::RGBA8, next_width, next_height));
+		const uint8_t* src = image.pixels.data() + image.levels[image.levels.size() - 2].offset;
+
+		for (uint32_t y = 0; y < next_height; y++) {
+			uint32_t y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+			for (uint32_t x = 0; x < next_width; x++) {
+				uint32_t x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+				for (uint32_t c = 0; c < 4; c++) {
+					uint32_t sum =
+						src[((size_t) y0 * width + x0) * 4 + c] +
+						src[((size_t) y0 * width + x1) * 4 + c] +
+						src[((size_t) y1 * width + x0) * 4 + c] +
+						src[((size_t) y1 * width + x1) * 4 + c];
+					dst[((size_t) y * next_width + x) * 4 + c] = (uint8_t) ((sum + 2) / 4);
+				}
+			}
+		}
+
+		width = next_width;
+		height = next_height;
+	}
+}
+
+ImageData CompressImage(const ImageData& rgba, BlockFormat format, JobSystem* jobs) {
+	if (rgba.format != BlockFormat::RGBA8) {
+		throw std::runtime_error("Only RGBA8 images can be compressed");
+	}
+
+	const ImageData* source = &rgba;
+	ImageData with_mips;
+	if (rgba.levels.size() == 1) {
+		with_mips = rgba;
+		GenerateMipChain(with_mips);
+		source = &with_mips;
+	}
+
+	ImageData compressed;
+	compressed.format = format;
+
+	for (const auto& level : source->levels) {
+		uint8_t* out = compressed.AddLevel(
+			level.width, level.height, LevelBytes(format, level.width, level.height));
+		EncodeImage(
+			source->pixels.data() + level.offset, level.width, level.height,
+			format, out, jobs);
+	}
+
+	return compressed;
+}
+
+bool HasAlpha(const ImageData& rgba) {
+	const ImageLevel& level = rgba.levels[0];
+	const uint8_t* pixels = rgba.pixels.data() + level.offset;
+
+	for (size_t i = 3; i < level.size; i += 4) {
+		if (pixels[i] != 255) return true;
+	}
+
+	return false;
+}
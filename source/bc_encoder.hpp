@@ -0,0 +1,33 @@
+#pragma once
+
+#include "image_data.hpp"
+#include "job_system.hpp"
+
+#include <cstdint>
+
+// CPU block compression for RGBA8 images. The per-block encoders are
+// bounding-box fits vectorized with SSE2 (with a scalar fallback); whole
+// images are split by block rows across a job system.
+//
+// Blocks are passed as 16 texels in row-major order, 4 bytes (RGBA) each.
+
+void EncodeBC1Block(const uint8_t* block, uint8_t* out);
+void EncodeBC3Block(const uint8_t* block, uint8_t* out);
+void EncodeBC5Block(const uint8_t* block, uint8_t* out);
+
+// Encodes one RGBA8 level into `out`, which must hold
+// LevelBytes(format, width, height) bytes. Only BC1, BC3 and BC5 can be
+// produced. Without a job system everything runs on the calling thread.
+void EncodeImage(
+	const uint8_t* rgba, uint32_t width, uint32_t height,
+	BlockFormat format, uint8_t* out, JobSystem* jobs = nullptr
+);
+
+// Fills in the mip chain of a single-level RGBA8 image with a box filter
+void GenerateMipChain(ImageData& image);
+
+// Compressed copy of an RGBA8 image, mip chain included
+ImageData CompressImage(const ImageData& rgba, BlockFormat format, JobSystem* jobs = nullptr);
+
+// Whether any texel of the first level is not fully opaque
+bool HasAlpha(const ImageData& rgba);
@@ -0,0 +1,337 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const uint32_t Bvh::leaf_size;
+const int32_t Bvh::empty_child;
+
+Aabb Aabb::Empty() {
+	const float big = std::numeric_limits<float>::max();
+	return { glm::vec3(big), glm::vec3(-big) };
+}
+
+void Aabb::Expand(const Aabb& other) {
+	min = glm::min(min, other.min);
+	max = glm::max(max, other.max);
+}
+
+Aabb Aabb::Transformed(const glm::mat4& m) const {
+	// Transform the center, and grow the extent by the absolute value of
+	// each axis of the matrix
+	glm::vec3 center = Center();
+	glm::vec3 extent = (max - min) * 0.5f;
+
+	glm::vec3 new_center = glm::vec3(m * glm::vec4(center, 1.0f));
+	glm::vec3 new_extent(0.0f);
+	for (int column = 0; column < 3; column++) {
+		for (int row = 0; row < 3; row++) {
+			new_extent[row] += std::abs(m[column][row]) * extent[column];
+		}
+	}
+
+	return { new_center - new_extent, new_center + new_extent };
+}
+
+Frustum Frustum::FromMatrix(const glm::mat4& m) {
+	// glm matrices are column-major, so row i is (m[0][i] .. m[3][i])
+	auto row = [&m](int i) { return glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]); };
+
+	Frustum frustum;
+	frustum.planes[0] = row(3) + row(0);	// left
+	frustum.planes[1] = row(3) - row(0);	// right
+	frustum.planes[2] = row(3) + row(1);	// bottom
+	frustum.planes[3] = row(3) - row(1);	// top
+	frustum.planes[4] = row(3) + row(2);	// near, for glm's -1..1 depth range
+	frustum.planes[5] = row(3) - row(2);	// far
+
+	for (glm::vec4& plane : frustum.planes) {
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	return frustum;
+}
+
+bool Frustum::Intersects(const Aabb& box) const {
+	for (const glm::vec4& plane : planes) {
+		// Corner furthest along the plane normal
+		glm::vec3 p(
+			plane.x >= 0.0f ? box.max.x : box.min.x,
+			plane.y >= 0.0f ? box.max.y : box.min.y,
+			plane.z >= 0.0f ? box.max.z : box.min.z
+		);
+		if (glm::dot(glm::vec3(plane), p) + plane.w < 0.0f) return false;
+	}
+
+	return true;
+}
+
+void Bvh::Build(const std::vector<Aabb>& object_bounds) {
+	Clear();
+
+	bounds = object_bounds;
+	if (bounds.empty()) return;
+
+	order.resize(bounds.size());
+	object_leaf.resize(bounds.size());
+	for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+
+	// The root is always an inner node so traversal never starts at a leaf
+	nodes.reserve(bounds.size() / 2 + 1);
+	int32_t root = BuildChild(0, (uint32_t) order.size(), -1);
+	if (root < 0) {
+		Node node;
+		for (int c = 0; c < 4; c++) node.child[c] = empty_child;
+		node.child[0] = root;
+		node.first = 0;
+		node.count = (uint32_t) order.size();
+
+		nodes.push_back(node);
+		parents.push_back(-1);
+		leaves[~root].node = 0;
+		RefitNode(0);
+	}
+
+	dirty.assign(nodes.size(), 0);
+}
+
+void Bvh::Clear() {
+	nodes.clear();
+	parents.clear();
+	leaves.clear();
+	bounds.clear();
+	order.clear();
+	object_leaf.clear();
+	dirty.clear();
+	dirty_nodes.clear();
+}
+
+int32_t Bvh::BuildChild(uint32_t first, uint32_t count, int32_t parent) {
+	if (count <= leaf_size) {
+		int32_t leaf = (int32_t) leaves.size();
+		leaves.push_back({ first, count, parent });
+		for (uint32_t i = first; i < first + count; i++) object_leaf[order[i]] = leaf;
+		return ~leaf;
+	}
+
+	// Parents are always created before their children, which lets Refit()
+	// walk the nodes backwards
+	int32_t index = (int32_t) nodes.size();
+	nodes.emplace_back();
+	parents.push_back(parent);
+
+	// Split in half, then split each half again
+	uint32_t end = first + count;
+	uint32_t mid = SplitRange(first, count);
+	uint32_t ranges[5] = {
+		first, SplitRange(first, mid - first), mid, SplitRange(mid, end - mid), end
+	};
+
+	for (int c = 0; c < 4; c++) {
+		uint32_t size = ranges[c + 1] - ranges[c];
+		int32_t child = size ? BuildChild(ranges[c], size, index) : empty_child;
+		nodes[index].child[c] = child;
+	}
+
+	nodes[index].first = first;
+	nodes[index].count = count;
+	RefitNode(index);
+
+	return index;
+}
+
+uint32_t Bvh::SplitRange(uint32_t first, uint32_t count) {
+	if (count < 2) return first + count;
+
+	Aabb centroids = Aabb::Empty();
+	for (uint32_t i = first; i < first + count; i++) {
+		glm::vec3 c = bounds[order[i]].Center();
+		centroids.Expand({ c, c });
+	}
+
+	glm::vec3 extent = centroids.max - centroids.min;
+	int axis = 0;
+	if (extent.y > extent[axis]) axis = 1;
+	if (extent.z > extent[axis]) axis = 2;
+
+	uint32_t mid = first + count / 2;
+	std::nth_element(
+		order.begin() + first, order.begin() + mid, order.begin() + first + count,
+		[this, axis](uint32_t a, uint32_t b) {
+			return bounds[a].min[axis] + bounds[a].max[axis]
+				< bounds[b].min[axis] + bounds[b].max[axis];
+		}
+	);
+
+	return mid;
+}
+
+Aabb Bvh::NodeBounds(int32_t index) const {
+	const Node& node = nodes[index];
+
+	Aabb result = Aabb::Empty();
+	for (int c = 0; c < 4; c++) {
+		result.Expand({
+			glm::vec3(node.min_x[c], node.min_y[c], node.min_z[c]),
+			glm::vec3(node.max_x[c], node.max_y[c], node.max_z[c])
+		});
+	}
+
+	return result;
+}
+
+Aabb Bvh::ChildBounds(int32_t child) const {
+	if (child == empty_child) return Aabb::Empty();
+	if (child >= 0) return NodeBounds(child);
+
+	const Leaf& leaf = leaves[~child];
+	Aabb result = Aabb::Empty();
+	for (uint32_t i = leaf.first; i < leaf.first + leaf.count; i++) {
+		result.Expand(bounds[order[i]]);
+	}
+
+	return result;
+}
+
+void Bvh::RefitNode(int32_t index) {
+	for (int c = 0; c < 4; c++) {
+		Aabb box = ChildBounds(nodes[index].child[c]);
+
+		Node& node = nodes[index];
+		node.min_x[c] = box.min.x;
+		node.min_y[c] = box.min.y;
+		node.min_z[c] = box.min.z;
+		node.max_x[c] = box.max.x;
+		node.max_y[c] = box.max.y;
+		node.max_z[c] = box.max.z;
+	}
+}
+
+void Bvh::MarkDirty(int32_t index) {
+	// Stop at the first node already marked; everything above it is too
+	while (index >= 0 && !dirty[index]) {
+		dirty[index] = 1;
+		dirty_nodes.push_back(index);
+		index = parents[index];
+	}
+}
+
+void Bvh::Update(uint32_t object, const Aabb& box) {
+	bounds[object] = box;
+	MarkDirty(leaves[object_leaf[object]].node);
+}
+
+void Bvh::Refit() {
+	if (dirty_nodes.empty()) return;
+
+	// Children have higher indices than their parents
+	std::sort(dirty_nodes.begin(), dirty_nodes.end(), std::greater<int32_t>());
+
+	for (int32_t index : dirty_nodes) {
+		RefitNode(index);
+		dirty[index] = 0;
+	}
+	dirty_nodes.clear();
+}
+
+void Bvh::AppendRange(uint32_t first, uint32_t count, std::vector<uint32_t>& visible) const {
+	visible.insert(visible.end(), order.begin() + first, order.begin() + first + count);
+}
+
+void Bvh::AppendLeaf(const Leaf& leaf, const Frustum& frustum, std::vector<uint32_t>& visible) const {
+	for (uint32_t i = leaf.first; i < leaf.first + leaf.count; i++) {
+		if (frustum.Intersects(bounds[order[i]])) visible.push_back(order[i]);
+	}
+}
+
+void Bvh::Cull(const Frustum& frustum, std::vector<uint32_t>& visible) {
+	visible.clear();
+	if (nodes.empty()) return;
+
+	stack.clear();
+	stack.push_back(0);
+
+	while (!stack.empty()) {
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+
+		// Per child: bit set if the box is entirely outside one plane, or
+		// if it straddles at least one plane
+		int outside = 0, straddling = 0;
+
+#ifdef __SSE2__
+		__m128 outside_mask = _mm_setzero_ps();
+		__m128 straddling_mask = _mm_setzero_ps();
+		const __m128 zero = _mm_setzero_ps();
+
+		for (const glm::vec4& plane : frustum.planes) {
+			// The corner furthest along the normal decides whether the box
+			// is outside, the nearest one whether it is entirely inside
+			__m128 far_x = _mm_load_ps(plane.x >= 0.0f ? node.max_x : node.min_x);
+			__m128 far_y = _mm_load_ps(plane.y >= 0.0f ? node.max_y : node.min_y);
+			__m128 far_z = _mm_load_ps(plane.z >= 0.0f ? node.max_z : node.min_z);
+			__m128 near_x = _mm_load_ps(plane.x >= 0.0f ? node.min_x : node.max_x);
+			__m128 near_y = _mm_load_ps(plane.y >= 0.0f ? node.min_y : node.max_y);
+			__m128 near_z = _mm_load_ps(plane.z >= 0.0f ? node.min_z : node.max_z);
+
+			__m128 a = _mm_set1_ps(plane.x);
+			__m128 b = _mm_set1_ps(plane.y);
+			__m128 c = _mm_set1_ps(plane.z);
+			__m128 d = _mm_set1_ps(plane.w);
+
+			__m128 far_distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(a, far_x), _mm_mul_ps(b, far_y)),
+				_mm_add_ps(_mm_mul_ps(c, far_z), d)
+			);
+			__m128 near_distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(a, near_x), _mm_mul_ps(b, near_y)),
+				_mm_add_ps(_mm_mul_ps(c, near_z), d)
+			);
+
+			outside_mask = _mm_or_ps(outside_mask, _mm_cmplt_ps(far_distance, zero));
+			straddling_mask = _mm_or_ps(straddling_mask, _mm_cmplt_ps(near_distance, zero));
+		}
+
+		outside = _mm_movemask_ps(outside_mask);
+		straddling = _mm_movemask_ps(straddling_mask);
+#else
+		for (int lane = 0; lane < 4; lane++) {
+			for (const glm::vec4& plane : frustum.planes) {
+				float far_distance = plane.w
+					+ plane.x * (plane.x >= 0.0f ? node.max_x[lane] : node.min_x[lane])
+					+ plane.y * (plane.y >= 0.0f ? node.max_y[lane] : node.min_y[lane])
+					+ plane.z * (plane.z >= 0.0f ? node.max_z[lane] : node.min_z[lane]);
+				float near_distance = plane.w
+					+ plane.x * (plane.x >= 0.0f ? node.min_x[lane] : node.max_x[lane])
+					+ plane.y * (plane.y >= 0.0f ? node.min_y[lane] : node.max_y[lane])
+					+ plane.z * (plane.z >= 0.0f ? node.min_z[lane] : node.max_z[lane]);
+
+				if (far_distance < 0.0f) outside |= 1 << lane;
+				if (near_distance < 0.0f) straddling |= 1 << lane;
+			}
+		}
+#endif
+
+		for (int c = 0; c < 4; c++) {
+			int32_t child = node.child[c];
+			if (child == empty_child || (outside & (1 << c))) continue;
+
+			bool inside = !(straddling & (1 << c));
+
+			if (child >= 0) {
+				if (inside) AppendRange(nodes[child].first, nodes[child].count, visible);
+				else stack.push_back(child);
+			} else {
+				const Leaf& leaf = leaves[~child];
+				if (inside) AppendRange(leaf.first, leaf.count, visible);
+				else AppendLeaf(leaf, frustum, visible);
+			}
+		}
+	}
+}
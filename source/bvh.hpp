@@ -0,0 +1,106 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+struct Aabb {
+	glm::vec3 min;
+	glm::vec3 max;
+
+	// Inverted box that any Expand() replaces
+	static Aabb Empty();
+
+	void Expand(const Aabb&);
+	glm::vec3 Center() const { return (min + max) * 0.5f; }
+
+	// Bounds of the box after an affine transform
+	Aabb Transformed(const glm::mat4&) const;
+};
+
+// Six planes (a, b, c, d) with normals pointing inwards; a point p is inside
+// when dot(abc, p) + d >= 0 for every plane
+struct Frustum {
+	glm::vec4 planes[6];
+
+	// Extracts the planes of the clip volume of `clip_from_object`, so the
+	// frustum lives in whatever space that matrix takes points from
+	static Frustum FromMatrix(const glm::mat4& clip_from_object);
+
+	bool Intersects(const Aabb&) const;
+};
+
+// Four-wide bounding volume hierarchy over object bounds. Each node stores
+// the boxes of its four children in SoA form so a single SSE pass tests all
+// of them against a frustum plane. Objects are kept in leaves of up to
+// `leaf_size`, and every subtree covers a contiguous run of objects, so a
+// subtree that is entirely inside the frustum is accepted without visiting it.
+class Bvh {
+public:
+	static const uint32_t leaf_size = 4;
+
+	// Top-down build, splitting at the median centroid along the longest
+	// axis. Object i keeps index i in the results of Cull().
+	void Build(const std::vector<Aabb>& bounds);
+	void Clear();
+
+	// Moves an object. Only the nodes above it are marked; call Refit()
+	// once after a batch of updates.
+	void Update(uint32_t object, const Aabb& bounds);
+	void Refit();
+
+	// Replaces `visible` with the indices of the objects whose bounds
+	// intersect the frustum, in no particular order
+	void Cull(const Frustum&, std::vector<uint32_t>& visible);
+
+	size_t ObjectCount() const { return bounds.size(); }
+	size_t NodeCount() const { return nodes.size(); }
+
+protected:
+	// Children >= 0 are node indices, < 0 are leaves (~child), and empty
+	// slots have an inverted box so they are always rejected
+	struct alignas(16) Node {
+		float min_x[4], min_y[4], min_z[4];
+		float max_x[4], max_y[4], max_z[4];
+		int32_t child[4];
+
+		// Objects covered by the whole subtree, as a range of `order`
+		uint32_t first;
+		uint32_t count;
+	};
+
+	struct Leaf {
+		uint32_t first;
+		uint32_t count;
+		int32_t node;
+	};
+
+	static const int32_t empty_child = INT32_MIN;
+
+	std::vector<Node> nodes;
+	std::vector<int32_t> parents;
+	std::vector<Leaf> leaves;
+
+	std::vector<Aabb> bounds;
+	std::vector<uint32_t> order;
+	std::vector<int32_t> object_leaf;
+
+	std::vector<uint8_t> dirty;
+	std::vector<int32_t> dirty_nodes;
+
+	// Reused by Cull() so traversal does not allocate
+	std::vector<int32_t> stack;
+
+	int32_t BuildChild(uint32_t first, uint32_t count, int32_t parent);
+	uint32_t SplitRange(uint32_t first, uint32_t count);
+
+	Aabb NodeBounds(int32_t node) const;
+	Aabb ChildBounds(int32_t child) const;
+	void RefitNode(int32_t node);
+	void MarkDirty(int32_t node);
+
+	void AppendRange(uint32_t first, uint32_t count, std::vector<uint32_t>& visible) const;
+	void AppendLeaf(const Leaf&, const Frustum&, std::vector<uint32_t>& visible) const;
+};
@@ -0,0 +1,147 @@
+// Checks Bvh::Cull against testing every box, before and after moving some
+// of them, and times build, cull and refit. Standalone: needs neither
+// Vulkan nor a window. Exits non-zero if the results differ.
+//
+//	make bvh-benchmark
+//	./bvh_benchmark [objects] [moved percent]
+
+#include "bvh.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const int repeats = 5;
+
+using Clock = chrono::steady_clock;
+
+double Milliseconds(Clock::time_point start) {
+	return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+Aabb RandomBox(mt19937& random) {
+	uniform_real_distribution<float> position(-100.0f, 100.0f);
+	uniform_real_distribution<float> size(0.1f, 1.0f);
+
+	glm::vec3 min(position(random), position(random), position(random));
+	return { min, min + glm::vec3(size(random), size(random), size(random)) };
+}
+
+void BruteForce(const Frustum& frustum, const vector<Aabb>& bounds, vector<uint32_t>& visible) {
+	visible.clear();
+	for (uint32_t i = 0; i < bounds.size(); i++) {
+		if (frustum.Intersects(bounds[i])) visible.push_back(i);
+	}
+}
+
+// Cull() leaves its results in no particular order
+bool SameObjects(vector<uint32_t> a, vector<uint32_t> b) {
+	sort(a.begin(), a.end());
+	sort(b.begin(), b.end());
+	return a == b;
+}
+
+// Best of a few runs of both culls, checking that they agree
+bool CompareCull(Bvh& bvh, const Frustum& frustum, const vector<Aabb>& bounds, const char* label) {
+	vector<uint32_t> visible, expected;
+	double bvh_ms = 1e30, brute_ms = 1e30;
+
+	for (int r = 0; r < repeats; r++) {
+		auto start = Clock::now();
+		bvh.Cull(frustum, visible);
+		bvh_ms = min(bvh_ms, Milliseconds(start));
+
+		start = Clock::now();
+		BruteForce(frustum, bounds, expected);
+		brute_ms = min(brute_ms, Milliseconds(start));
+	}
+
+	bool same = SameObjects(visible, expected);
+
+	cout << label << ": " << visible.size() << " visible, bvh "
+		<< fixed << setprecision(2) << bvh_ms << " ms, brute force " << brute_ms << " ms ("
+		<< setprecision(1) << brute_ms / bvh_ms << "x)"
+		<< (same ? "" : "  MISMATCH") << endl;
+
+	if (!same) {
+		cerr << "  bvh found " << visible.size() << ", brute force " << expected.size() << endl;
+	}
+	return same;
+}
+
+}
+
+int main(int argc, char** argv) {
+	uint32_t count = argc > 1 ? (uint32_t) strtoul(argv[1], nullptr, 10) : 1000000;
+	double moved_percent = argc > 2 ? strtod(argv[2], nullptr) : 1.0;
+	if (count == 0 || moved_percent < 0.0 || moved_percent > 100.0) {
+		cerr << "Usage: " << argv[0] << " [objects] [moved percent]" << endl;
+		return 1;
+	}
+
+	mt19937 random(1234);
+
+	vector<Aabb> bounds(count);
+	for (Aabb& box : bounds) box = RandomBox(random);
+
+	// Standing inside the cloud, looking along +x: roughly a sixth of it
+	// is in view, with plenty of boxes across every plane
+	glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 150.0f);
+	glm::mat4 view = glm::lookAt(
+		glm::vec3(0.0f, 0.0f, 0.0f),
+		glm::vec3(1.0f, 0.0f, 0.0f),
+		glm::vec3(0.0f, 0.0f, 1.0f)
+	);
+	Frustum frustum = Frustum::FromMatrix(proj * view);
+
+	cout << count << " objects, best of " << repeats << " runs" << endl;
+
+	Bvh bvh;
+	auto start = Clock::now();
+	bvh.Build(bounds);
+	cout << "build: " << bvh.NodeCount() << " nodes, "
+		<< fixed << setprecision(2) << Milliseconds(start) << " ms" << endl;
+
+	bool ok = CompareCull(bvh, frustum, bounds, "cull");
+
+	// Move a share of the objects to new random places, far enough that
+	// many of them cross in or out of view
+	uint32_t moved = (uint32_t) (count * moved_percent / 100.0);
+	uniform_int_distribution<uint32_t> pick(0, count - 1);
+
+	vector<uint32_t> objects(moved);
+	for (uint32_t& object : objects) object = pick(random);
+	for (uint32_t object : objects) bounds[object] = RandomBox(random);
+
+	start = Clock::now();
+	for (uint32_t object : objects) bvh.Update(object, bounds[object]);
+	bvh.Refit();
+	double refit_ms = Milliseconds(start);
+
+	start = Clock::now();
+	Bvh rebuilt;
+	rebuilt.Build(bounds);
+	double rebuild_ms = Milliseconds(start);
+
+	cout << "moved " << moved << ": update and refit " << fixed << setprecision(2) << refit_ms
+		<< " ms, full rebuild " << rebuild_ms << " ms" << endl;
+
+	ok = CompareCull(bvh, frustum, bounds, "cull after refit") && ok;
+
+	if (!ok) {
+		cerr << "Bvh::Cull does not match the brute-force results" << endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,106 @@
+#include "capture_writer.hpp"
+
+#include <cstdio>
+#include <iostream>
+
+CaptureWriter::~CaptureWriter() {
+	Stop();
+}
+
+void CaptureWriter::Start(const std::string& dir) {
+	Stop();
+
+	directory = dir;
+	stopping = false;
+	worker = std::thread(&CaptureWriter::WorkerLoop, this);
+}
+
+void CaptureWriter::Stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+
+	if (worker.joinable()) worker.join();
+}
+
+void CaptureWriter::Submit(const CaptureFrame& frame) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		frames.push_back(frame);
+	}
+	condition.notify_one();
+}
+
+void CaptureWriter::Flush() {
+	std::unique_lock<std::mutex> lock(mutex);
+	idle_condition.wait(lock, [this] { return frames.empty() && !writing; });
+}
+
+uint64_t CaptureWriter::GetWrittenCount() const {
+	return written.load(std::memory_order_relaxed);
+}
+
+void CaptureWriter::WorkerLoop() {
+	// One converted row, reused for every frame
+	std::vector<uint8_t> row;
+
+	while (true) {
+		CaptureFrame frame;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			writing = false;
+			idle_condition.notify_all();
+
+			condition.wait(lock, [this] { return stopping || !frames.empty(); });
+
+			// Unlike the other workers, queued frames are still written
+			// on stop; they are already captured and cost nothing to keep
+			if (frames.empty()) return;
+
+			frame = frames.front();
+			frames.pop_front();
+			writing = true;
+		}
+
+		Write(frame, row);
+
+		if (frame.busy) frame.busy->store(false, std::memory_order_release);
+		written.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void CaptureWriter::Write(const CaptureFrame& frame, std::vector<uint8_t>& row) {
+	char name[32];
+	snprintf(name, sizeof(name), "frame_%06llu.ppm", (unsigned long long) frame.index);
+	std::string path = directory + "/" + name;
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file) {
+		std::cout << "Failed to write capture " << path << std::endl;
+		return;
+	}
+
+	fprintf(file, "P6\n%u %u\n255\n", frame.width, frame.height);
+
+	// PPM wants tightly packed RGB, so alpha is dropped and BGR swapped
+	row.resize(frame.width * 3);
+	int red = frame.bgra ? 2 : 0;
+	int blue = frame.bgra ? 0 : 2;
+
+	for (uint32_t y = 0; y < frame.height; y++) {
+		const uint8_t* source = frame.pixels + (size_t) y * frame.row_pitch;
+
+		for (uint32_t x = 0; x < frame.width; x++) {
+			row[x * 3 + 0] = source[x * 4 + red];
+			row[x * 3 + 1] = source[x * 4 + 1];
+			row[x * 3 + 2] = source[x * 4 + blue];
+		}
+
+		fwrite(row.data(), 1, row.size(), file);
+	}
+
+	fclose(file);
+}
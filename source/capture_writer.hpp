@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One captured frame sitting in a mapped readback buffer. The buffer
+// belongs to the render thread; `busy` is set while the writer still reads
+// from it and cleared once the file is written, so nothing may be copied
+// into the buffer before then.
+struct CaptureFrame {
+	const uint8_t* pixels = nullptr;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t row_pitch = 0;		// in bytes
+	bool bgra = false;			// channel order of the pixels, 8 bits each
+
+	uint64_t index = 0;			// numbers the output file
+	std::atomic<bool>* busy = nullptr;
+};
+
+// Writes captured frames to disk as a numbered PPM sequence on a worker
+// thread (frame_000000.ppm, ...), so the render loop only ever hands over
+// a pointer. Any encoder that reads PPM, ffmpeg for instance, turns the
+// sequence into a video.
+class CaptureWriter {
+public:
+	CaptureWriter() = default;
+	~CaptureWriter();
+
+	CaptureWriter(const CaptureWriter&) = delete;
+	CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+	void Start(const std::string& directory);
+
+	// Writes whatever is still queued, then joins the worker
+	void Stop();
+
+	void Submit(const CaptureFrame&);
+
+	// Blocks until every submitted frame has been written
+	void Flush();
+
+	uint64_t GetWrittenCount() const;
+
+protected:
+	std::string directory;
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::condition_variable idle_condition;
+	std::deque<CaptureFrame> frames;
+	bool writing = false;
+	bool stopping = false;
+
+	std::atomic<uint64_t> written { 0 };
+
+	void WorkerLoop();
+	void Write(const CaptureFrame&, std::vector<uint8_t>& row);
+};
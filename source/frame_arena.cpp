@@ -0,0 +1,40 @@
+#include "frame_arena.hpp"
+
+#include <algorithm>
+
+FrameArena::FrameArena(size_t size)
+	: block(new uint8_t[size]), capacity(size) {
+}
+
+void* FrameArena::Allocate(size_t size, size_t alignment) {
+	uintptr_t base = (uintptr_t) block.get();
+	uintptr_t start = (base + used + alignment - 1) & ~(uintptr_t) (alignment - 1);
+
+	if (start + size <= base + capacity) {
+		used = start + size - base;
+		high_water = std::max(high_water, GetUsed());
+		return (void*) start;
+	}
+
+	// Does not fit; hand out a dedicated block for the rest of the frame
+	overflow.emplace_back(new uint8_t[size + alignment]);
+	overflow_used += size + alignment;
+	high_water = std::max(high_water, GetUsed());
+
+	uintptr_t spill = (uintptr_t) overflow.back().get();
+	return (void*) ((spill + alignment - 1) & ~(uintptr_t) (alignment - 1));
+}
+
+void FrameArena::Reset() {
+	if (!overflow.empty()) {
+		overflow.clear();
+		overflow_used = 0;
+
+		// Grow with room to spare, so the same frame fits next time and
+		// one that needs a little more does not overflow again
+		capacity = std::max(capacity, high_water) * 2;
+		block.reset(new uint8_t[capacity]);
+	}
+
+	used = 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Bump allocator for data that only lives until the end of a frame. There
+// is one per swapchain image, reset once that image's fence has signaled,
+// so nothing allocated from it is ever freed individually.
+//
+// Running out of space falls back to extra heap blocks for the rest of the
+// frame; the next Reset() folds them into one block twice the high-water
+// mark, so a steady-state frame never touches the heap.
+class FrameArena {
+public:
+	explicit FrameArena(size_t capacity = 64 * 1024);
+
+	void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+	void Reset();
+
+	size_t GetUsed() const { return used + overflow_used; }
+	size_t GetCapacity() const { return capacity; }
+	size_t GetHighWater() const { return high_water; }
+
+protected:
+	std::unique_ptr<uint8_t[]> block;
+	size_t capacity = 0;
+	size_t used = 0;
+
+	std::vector<std::unique_ptr<uint8_t[]>> overflow;
+	size_t overflow_used = 0;
+	size_t high_water = 0;
+};
+
+// Lets standard containers allocate from a FrameArena. Deallocation is a
+// no-op; the memory comes back when the arena is reset, so containers must
+// not outlive the frame.
+template <typename T>
+class ArenaAllocator {
+public:
+	using value_type = T;
+
+	explicit ArenaAllocator(FrameArena& arena) : arena(&arena) {}
+
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t count) {
+		return static_cast<T*>(arena->Allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T*, size_t) {}
+
+	template <typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+
+	template <typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+
+private:
+	template <typename U> friend class ArenaAllocator;
+
+	FrameArena* arena;
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
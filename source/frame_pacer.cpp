@@ -0,0 +1,157 @@
+#include "frame_pacer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+using Milliseconds = std::chrono::duration<double, std::milli>;
+
+const size_t FramePacer::history_size;
+constexpr double FramePacer::spin_threshold;
+constexpr double FramePacer::safety_margin;
+
+FramePacer::FramePacer(double target_rate) {
+	work_history.fill(0.0);
+	gpu_history.fill(0.0);
+	SetTargetRate(target_rate);
+}
+
+void FramePacer::SetTargetRate(double rate) {
+	SetTargetInterval(rate > 0.0 ? 1000.0 / rate : 0.0);
+}
+
+void FramePacer::SetTargetInterval(double milliseconds) {
+	target_interval = std::max(milliseconds, 0.0);
+	started = false;
+}
+
+double FramePacer::GetTargetInterval() const {
+	return target_interval;
+}
+
+void FramePacer::Reset() {
+	started = false;
+}
+
+void FramePacer::BeginFrame() {
+	auto now = Clock::now();
+
+	if (!started) {
+		started = true;
+		last_frame_end = now;
+		next_deadline = now + std::chrono::duration_cast<Clock::duration>(
+			Milliseconds(target_interval));
+	}
+
+	if (target_interval > 0.0) {
+		auto start_by = next_deadline - std::chrono::duration_cast<Clock::duration>(
+			Milliseconds(predicted_work + safety_margin));
+
+		if (now < start_by) {
+			SleepUntil(start_by);
+			now = Clock::now();
+		}
+	}
+
+	frame_start = now;
+	frame_wait = Clock::duration(0);
+}
+
+void FramePacer::EndFrame() {
+	auto now = Clock::now();
+
+	double work = Milliseconds(now - frame_start - frame_wait).count();
+	work_history[history_index] = std::max(work, 0.0);
+	history_index = (history_index + 1) % history_size;
+	history_count = std::min(history_count + 1, history_size);
+	Predict();
+
+	double interval = Milliseconds(now - last_frame_end).count();
+	last_frame_end = now;
+
+	if (target_interval <= 0.0) {
+		pacing_error = 0.0;
+		return;
+	}
+
+	pacing_error = interval - target_interval;
+	mean_pacing_error += (std::fabs(pacing_error) - mean_pacing_error) * 0.05;
+
+	auto interval_duration = std::chrono::duration_cast<Clock::duration>(
+		Milliseconds(target_interval));
+
+	// Missed the deadline: re-anchor on this frame instead of trying to
+	// catch up with a burst of short frames
+	next_deadline += interval_duration;
+	if (next_deadline < now) {
+		next_deadline = now + interval_duration;
+	}
+}
+
+void FramePacer::AddWaitTime(Clock::duration waited) {
+	frame_wait += waited;
+}
+
+void FramePacer::AddGpuTime(double milliseconds) {
+	gpu_history[gpu_history_index] = milliseconds;
+	gpu_history_index = (gpu_history_index + 1) % history_size;
+	gpu_history_count = std::min(gpu_history_count + 1, history_size);
+	Predict();
+}
+
+double FramePacer::GetPredictedWork() const {
+	return predicted_work;
+}
+
+double FramePacer::GetPredictedGpuWork() const {
+	return predicted_gpu_work;
+}
+
+double FramePacer::GetPacingError() const {
+	return pacing_error;
+}
+
+double FramePacer::GetMeanPacingError() const {
+	return mean_pacing_error;
+}
+
+void FramePacer::Predict() {
+	// The frame's GPU work only starts once the CPU has submitted it, so
+	// both have to fit between the frame's start and its deadline
+	predicted_gpu_work = Estimate(gpu_history, gpu_history_count);
+	double cpu_work = Estimate(work_history, history_count);
+
+	predicted_work = std::min(cpu_work + predicted_gpu_work, target_interval);
+}
+
+double FramePacer::Estimate(const std::array<double, history_size>& history, size_t count) {
+	if (count == 0) return 0.0;
+
+	double mean = 0.0;
+	for (size_t i = 0; i < count; i++) mean += history[i];
+	mean /= count;
+
+	double variance = 0.0;
+	for (size_t i = 0; i < count; i++) {
+		double d = history[i] - mean;
+		variance += d * d;
+	}
+	variance /= count;
+
+	// Two standard deviations covers most spikes without starting every
+	// frame as early as the worst one seen
+	return mean + 2.0 * std::sqrt(variance);
+}
+
+void FramePacer::SleepUntil(Clock::time_point wake) {
+	auto spin = std::chrono::duration_cast<Clock::duration>(Milliseconds(spin_threshold));
+
+	auto now = Clock::now();
+	if (wake - now > spin) {
+		std::this_thread::sleep_until(wake - spin);
+	}
+
+	while (Clock::now() < wake) {
+		std::this_thread::yield();
+	}
+}
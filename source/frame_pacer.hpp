@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+
+// Paces the main loop to a target frame interval. Each frame is started as
+// late as possible: the pacer predicts how long the frame's CPU work plus
+// submission and the GPU work it submits will take from recent history,
+// and sleeps until just before the point where it has to start to meet
+// the next deadline.
+class FramePacer {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	FramePacer(double target_rate = 60.0);
+
+	// Frames per second to aim for; zero or less disables pacing
+	void SetTargetRate(double rate);
+	void SetTargetInterval(double milliseconds);
+	double GetTargetInterval() const;
+
+	// Forgets the current deadline, e.g. after the loop was idle
+	void Reset();
+
+	// Sleeps until the predicted start time of the next frame
+	void BeginFrame();
+	// Marks the frame's work as submitted
+	void EndFrame();
+	// Reports time within the current frame spent blocked on the GPU or the
+	// display (fence waits, image acquisition). It is left out of the CPU
+	// work sample, since the GPU share is predicted on its own.
+	void AddWaitTime(Clock::duration);
+	// Reports a finished frame's measured GPU time, in milliseconds. It
+	// arrives frames late, once the GPU is done, so it is kept apart from
+	// the CPU history.
+	void AddGpuTime(double milliseconds);
+
+	// Predicted duration of a frame's CPU and GPU work, in milliseconds
+	double GetPredictedWork() const;
+	// The GPU share of that prediction
+	double GetPredictedGpuWork() const;
+	// Measured frame interval minus the target, in milliseconds
+	double GetPacingError() const;
+	// Running average of the absolute pacing error, in milliseconds
+	double GetMeanPacingError() const;
+
+protected:
+	static const size_t history_size = 32;
+
+	// Sleeps shorter than this are spun out instead, since the OS timer
+	// can overshoot by about this much
+	static constexpr double spin_threshold = 1.5;
+	// Slack left between the predicted end of work and the deadline
+	static constexpr double safety_margin = 0.5;
+
+	double target_interval;
+
+	std::array<double, history_size> work_history;
+	size_t history_count = 0;
+	size_t history_index = 0;
+
+	std::array<double, history_size> gpu_history;
+	size_t gpu_history_count = 0;
+	size_t gpu_history_index = 0;
+
+	double predicted_work = 0.0;
+	double predicted_gpu_work = 0.0;
+
+	double pacing_error = 0.0;
+	double mean_pacing_error = 0.0;
+
+	bool started = false;
+	Clock::time_point frame_start;
+	Clock::duration frame_wait { 0 };
+	Clock::time_point last_frame_end;
+	Clock::time_point next_deadline;
+
+	void Predict();
+	static double Estimate(const std::array<double, history_size>&, size_t count);
+	static void SleepUntil(Clock::time_point);
+};
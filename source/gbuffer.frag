@@ -0,0 +1,24 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Geometry subpass of the deferred path: the same surface as fragment.frag,
+// written out unlit for lighting.frag
+
+layout(binding = 1) uniform sampler2D tex_sampler;
+
+layout(location = 0) in vec3 frag_color;
+layout(location = 1) in vec2 frag_tex_coord;
+layout(location = 2) in vec3 frag_world_position;
+
+layout(location = 0) out vec4 out_albedo;
+layout(location = 1) out vec4 out_normal;
+
+void main() {
+	out_albedo = vec4(frag_color, 1.0) * texture(tex_sampler, frag_tex_coord);
+
+	// The vertices carry no normals; the face normal from the position
+	// derivatives is exact for flat geometry. Its sign depends on the
+	// winding on screen, so lighting turns it towards the camera.
+	vec3 normal = normalize(cross(dFdx(frag_world_position), dFdy(frag_world_position)));
+	out_normal = vec4(normal * 0.5 + 0.5, 0.0);
+}
@@ -0,0 +1,232 @@
+#include "host_allocator.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+
+const size_t HostAllocator::scope_count;
+const size_t HostAllocator::class_count;
+const size_t HostAllocator::smallest_class;
+const size_t HostAllocator::chunk_size;
+const uint8_t HostAllocator::large_class;
+
+HostAllocator::HostAllocator() {
+	for (size_t i = 0; i < class_count; i++) {
+		classes[i].block_size = smallest_class << i;
+	}
+
+	callbacks
+	.setPUserData(this)
+	.setPfnAllocation(OnAllocation)
+	.setPfnReallocation(OnReallocation)
+	.setPfnFree(OnFree)
+	.setPfnInternalAllocation(OnInternalAllocation)
+	.setPfnInternalFree(OnInternalFree);
+}
+
+HostAllocator::~HostAllocator() {
+	// Anything still live belongs to objects that were never destroyed;
+	// the chunks go away with it either way
+	for (SizeClass& size_class : classes) {
+		for (void* chunk : size_class.chunks) std::free(chunk);
+	}
+}
+
+const vk::AllocationCallbacks* HostAllocator::GetCallbacks() const {
+	return IsEnabled() ? &callbacks : nullptr;
+}
+
+bool HostAllocator::IsEnabled() {
+#ifdef TRACK_HOST_ALLOCATIONS
+	return true;
+#else
+	return false;
+#endif
+}
+
+HostAllocationStats HostAllocator::GetStats(vk::SystemAllocationScope scope) const {
+	const ScopeCounters& counters = scopes[(size_t) scope];
+
+	HostAllocationStats stats;
+	stats.live_bytes = counters.live_bytes;
+	stats.peak_bytes = counters.peak_bytes;
+	stats.live_allocations = counters.live_allocations;
+	stats.total_allocations = counters.total_allocations;
+	stats.internal_bytes = counters.internal_bytes;
+	return stats;
+}
+
+void HostAllocator::PrintReport(std::ostream& out) const {
+	const char* names[scope_count] = { "command", "object", "cache", "device", "instance" };
+
+	out << "Driver host memory (bytes)" << std::endl;
+	out << std::setw(10) << "scope"
+		<< std::setw(12) << "live"
+		<< std::setw(12) << "peak"
+		<< std::setw(12) << "allocs"
+		<< std::setw(12) << "internal" << std::endl;
+
+	for (size_t i = 0; i < scope_count; i++) {
+		HostAllocationStats stats = GetStats((vk::SystemAllocationScope) i);
+		out << std::setw(10) << names[i]
+			<< std::setw(12) << stats.live_bytes
+			<< std::setw(12) << stats.peak_bytes
+			<< std::setw(12) << stats.total_allocations
+			<< std::setw(12) << stats.internal_bytes << std::endl;
+	}
+}
+
+void* HostAllocator::Allocate(size_t size, size_t alignment, VkSystemAllocationScope scope) {
+	if (size == 0) return nullptr;
+
+	// The header sits right before the returned pointer. Blocks start
+	// 16-byte aligned, so size + alignment always leaves room for both
+	// the header and the alignment padding.
+	alignment = std::max(alignment, sizeof(Header));
+	size_t total = size + alignment;
+
+	uint8_t size_class = large_class;
+	for (size_t i = 0; i < class_count; i++) {
+		if (total <= classes[i].block_size) {
+			size_class = (uint8_t) i;
+			break;
+		}
+	}
+
+	uint8_t* block = (uint8_t*) AllocateBlock(size_class, total);
+	if (!block) return nullptr;
+
+	uintptr_t user = ((uintptr_t) block + sizeof(Header) + alignment - 1) & ~(uintptr_t) (alignment - 1);
+
+	Header* header = (Header*) user - 1;
+	header->size = (uint32_t) size;
+	header->offset = (uint32_t) (user - (uintptr_t) block);
+	header->size_class = size_class;
+	header->scope = (uint8_t) scope;
+
+	CountAllocation(header->scope, size);
+	return (void*) user;
+}
+
+void* HostAllocator::Reallocate(
+	void* original, size_t size, size_t alignment, VkSystemAllocationScope scope
+) {
+	if (!original) return Allocate(size, alignment, scope);
+	if (size == 0) {
+		Free(original);
+		return nullptr;
+	}
+
+	Header* header = (Header*) original - 1;
+
+	// Grow or shrink in place while the block still has room
+	if (header->size_class != large_class
+		&& header->offset + size <= classes[header->size_class].block_size
+		&& (uintptr_t) original % alignment == 0
+	) {
+		CountFree(header->scope, header->size);
+		header->size = (uint32_t) size;
+		header->scope = (uint8_t) scope;
+		CountAllocation(header->scope, size);
+		return original;
+	}
+
+	void* memory = Allocate(size, alignment, scope);
+	if (!memory) return nullptr;
+
+	std::memcpy(memory, original, std::min(size, (size_t) header->size));
+	Free(original);
+	return memory;
+}
+
+void HostAllocator::Free(void* memory) {
+	if (!memory) return;
+
+	Header* header = (Header*) memory - 1;
+	CountFree(header->scope, header->size);
+
+	FreeBlock(header->size_class, (uint8_t*) memory - header->offset);
+}
+
+void* HostAllocator::AllocateBlock(uint8_t index, size_t size) {
+	if (index == large_class) return std::malloc(size);
+
+	SizeClass& size_class = classes[index];
+	std::lock_guard<std::mutex> lock(size_class.mutex);
+
+	if (!size_class.free_list) {
+		uint8_t* chunk = (uint8_t*) std::malloc(chunk_size);
+		if (!chunk) return nullptr;
+		size_class.chunks.push_back(chunk);
+
+		// Thread the new blocks onto the free list
+		for (size_t offset = 0; offset + size_class.block_size <= chunk_size; offset += size_class.block_size) {
+			void* block = chunk + offset;
+			*(void**) block = size_class.free_list;
+			size_class.free_list = block;
+		}
+	}
+
+	void* block = size_class.free_list;
+	size_class.free_list = *(void**) block;
+	return block;
+}
+
+void HostAllocator::FreeBlock(uint8_t index, void* block) {
+	if (index == large_class) {
+		std::free(block);
+		return;
+	}
+
+	SizeClass& size_class = classes[index];
+	std::lock_guard<std::mutex> lock(size_class.mutex);
+
+	*(void**) block = size_class.free_list;
+	size_class.free_list = block;
+}
+
+void HostAllocator::CountAllocation(uint8_t scope, size_t size) {
+	ScopeCounters& counters = scopes[scope];
+
+	size_t live = counters.live_bytes += size;
+	counters.live_allocations++;
+	counters.total_allocations++;
+
+	size_t peak = counters.peak_bytes;
+	while (live > peak && !counters.peak_bytes.compare_exchange_weak(peak, live)) {}
+}
+
+void HostAllocator::CountFree(uint8_t scope, size_t size) {
+	ScopeCounters& counters = scopes[scope];
+	counters.live_bytes -= size;
+	counters.live_allocations--;
+}
+
+VKAPI_ATTR void* VKAPI_CALL HostAllocator::OnAllocation(
+	void* user_data, size_t size, size_t alignment, VkSystemAllocationScope scope
+) {
+	return ((HostAllocator*) user_data)->Allocate(size, alignment, scope);
+}
+
+VKAPI_ATTR void* VKAPI_CALL HostAllocator::OnReallocation(
+	void* user_data, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope
+) {
+	return ((HostAllocator*) user_data)->Reallocate(original, size, alignment, scope);
+}
+
+VKAPI_ATTR void VKAPI_CALL HostAllocator::OnFree(void* user_data, void* memory) {
+	((HostAllocator*) user_data)->Free(memory);
+}
+
+VKAPI_ATTR void VKAPI_CALL HostAllocator::OnInternalAllocation(
+	void* user_data, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope
+) {
+	((HostAllocator*) user_data)->scopes[scope].internal_bytes += size;
+}
+
+VKAPI_ATTR void VKAPI_CALL HostAllocator::OnInternalFree(
+	void* user_data, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope
+) {
+	((HostAllocator*) user_data)->scopes[scope].internal_bytes -= size;
+}
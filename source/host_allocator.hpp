@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Host memory accounting for one VkSystemAllocationScope
+struct HostAllocationStats {
+	size_t live_bytes = 0;
+	size_t peak_bytes = 0;
+	size_t live_allocations = 0;
+	size_t total_allocations = 0;
+
+	// Memory the driver allocated itself and only reported to us
+	size_t internal_bytes = 0;
+};
+
+// Implements vk::AllocationCallbacks so driver host allocations go through
+// our own size-classed pools and can be measured per allocation scope.
+//
+// Small requests come from per-class free lists carved out of larger
+// chunks, so the many short-lived command-scope allocations never reach
+// malloc; anything above the largest class goes straight to malloc.
+// Every block carries a small header in front of the returned pointer,
+// since vkFree does not pass the size back.
+//
+// Tracking is compiled in with TRACK_HOST_ALLOCATIONS (see the makefile).
+// Without it GetCallbacks() returns null and the driver uses its own
+// allocator as before.
+class HostAllocator {
+public:
+	// Command, object, cache, device and instance
+	static const size_t scope_count = 5;
+
+	HostAllocator();
+	~HostAllocator();
+
+	HostAllocator(const HostAllocator&) = delete;
+	HostAllocator& operator=(const HostAllocator&) = delete;
+
+	// What to pass as the allocator of every create and destroy call
+	const vk::AllocationCallbacks* GetCallbacks() const;
+
+	static bool IsEnabled();
+
+	HostAllocationStats GetStats(vk::SystemAllocationScope) const;
+	void PrintReport(std::ostream&) const;
+
+protected:
+	struct alignas(16) Header {
+		uint32_t size;		// as requested
+		uint32_t offset;	// from the start of the block to the returned pointer
+		uint8_t size_class;
+		uint8_t scope;
+	};
+
+	struct SizeClass {
+		size_t block_size;
+		std::mutex mutex;
+		void* free_list = nullptr;
+		std::vector<void*> chunks;
+	};
+
+	static const size_t class_count = 9;		// 32 bytes .. 8 KiB
+	static const size_t smallest_class = 32;
+	static const size_t chunk_size = 64 * 1024;
+	static const uint8_t large_class = 0xFF;
+
+	struct ScopeCounters {
+		std::atomic<size_t> live_bytes { 0 };
+		std::atomic<size_t> peak_bytes { 0 };
+		std::atomic<size_t> live_allocations { 0 };
+		std::atomic<size_t> total_allocations { 0 };
+		std::atomic<size_t> internal_bytes { 0 };
+	};
+
+	vk::AllocationCallbacks callbacks;
+	SizeClass classes[class_count];
+	ScopeCounters scopes[scope_count];
+
+	void* Allocate(size_t size, size_t alignment, VkSystemAllocationScope);
+	void* Reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope);
+	void Free(void* memory);
+
+	void* AllocateBlock(uint8_t size_class, size_t size);
+	void FreeBlock(uint8_t size_class, void* block);
+
+	void CountAllocation(uint8_t scope, size_t size);
+	void CountFree(uint8_t scope, size_t size);
+
+	static VKAPI_ATTR void* VKAPI_CALL OnAllocation(
+		void* user_data, size_t size, size_t alignment, VkSystemAllocationScope);
+	static VKAPI_ATTR void* VKAPI_CALL OnReallocation(
+		void* user_data, void* original, size_t size, size_t alignment, VkSystemAllocationScope);
+	static VKAPI_ATTR void VKAPI_CALL OnFree(void* user_data, void* memory);
+	static VKAPI_ATTR void VKAPI_CALL OnInternalAllocation(
+		void* user_data, size_t size, VkInternalAllocationType, VkSystemAllocationScope);
+	static VKAPI_ATTR void VKAPI_CALL OnInternalFree(
+		void* user_data, size_t size, VkInternalAllocationType, VkSystemAllocationScope);
+};
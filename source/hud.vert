@@ -0,0 +1,25 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Overlay quads are given in pixels from the top left of the window
+
+layout(push_constant) uniform PushConstants {
+	vec2 pixel_to_ndc;	// 2 / window size
+} push;
+
+layout(location = 0) in vec2 in_position;
+layout(location = 1) in vec2 in_tex_coord;
+layout(location = 2) in vec4 in_color;
+
+layout(location = 0) out vec4 frag_color;
+layout(location = 1) out vec2 frag_tex_coord;
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+void main() {
+	gl_Position = vec4(in_position * push.pixel_to_ndc - 1.0, 0.0, 1.0);
+	frag_color = in_color;
+	frag_tex_coord = in_tex_coord;
+}
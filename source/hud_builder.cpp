@@ -0,0 +1,166 @@
+#include "hud_builder.hpp"
+
+namespace {
+
+// Rows from top to bottom, bit 4 is the leftmost column
+const uint8_t font[HudBuilder::glyph_count][HudBuilder::glyph_height] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	// ' '
+	{ 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04 },	// '!'
+	{ 0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00 },	// '"'
+	{ 0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A },	// '#'
+	{ 0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04 },	// '$'
+	{ 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 },	// '%'
+	{ 0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D },	// '&'
+	{ 0x0C, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00 },	// '''
+	{ 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 },	// '('
+	{ 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 },	// ')'
+	{ 0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00 },	// '*'
+	{ 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 },	// '+'
+	{ 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08 },	// ','
+	{ 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 },	// '-'
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C },	// '.'
+	{ 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 },	// '/'
+	{ 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E },	// '0'
+	{ 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },	// '1'
+	{ 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F },	// '2'
+	{ 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },	// '3'
+	{ 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 },	// '4'
+	{ 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },	// '5'
+	{ 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E },	// '6'
+	{ 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },	// '7'
+	{ 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E },	// '8'
+	{ 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C },	// '9'
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 },	// ':'
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08 },	// ';'
+	{ 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02 },	// '<'
+	{ 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00 },	// '='
+	{ 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08 },	// '>'
+	{ 0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 },	// '?'
+	{ 0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E },	// '@'
+	{ 0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11 },	// 'A'
+	{ 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E },	// 'B'
+	{ 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E },	// 'C'
+	{ 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C },	// 'D'
+	{ 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F },	// 'E'
+	{ 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 },	// 'F'
+	{ 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F },	// 'G'
+	{ 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },	// 'H'
+	{ 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E },	// 'I'
+	{ 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C },	// 'J'
+	{ 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 },	// 'K'
+	{ 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F },	// 'L'
+	{ 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 },	// 'M'
+	{ 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },	// 'N'
+	{ 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },	// 'O'
+	{ 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 },	// 'P'
+	{ 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D },	// 'Q'
+	{ 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 },	// 'R'
+	{ 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E },	// 'S'
+	{ 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },	// 'T'
+	{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },	// 'U'
+	{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 },	// 'V'
+	{ 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A },	// 'W'
+	{ 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 },	// 'X'
+	{ 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 },	// 'Y'
+	{ 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F },	// 'Z'
+	{ 0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E },	// '['
+	{ 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00 },	// '\'
+	{ 0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E },	// ']'
+	{ 0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00 },	// '^'
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F }	// '_'
+};
+
+// Cells in the atlas: every glyph, then the solid one
+const uint32_t cell_count = HudBuilder::glyph_count + 1;
+const uint32_t atlas_width = cell_count * HudBuilder::cell_width;
+const uint32_t atlas_height = HudBuilder::cell_height;
+
+}
+
+std::vector<uint8_t> HudBuilder::BuildFontAtlas(uint32_t& width, uint32_t& height) {
+	width = atlas_width;
+	height = atlas_height;
+
+	std::vector<uint8_t> pixels(width * height * 4, 0);
+
+	auto set = [&](uint32_t x, uint32_t y) {
+		uint8_t* texel = &pixels[(y * width + x) * 4];
+		texel[0] = texel[1] = texel[2] = texel[3] = 255;
+	};
+
+	for (uint32_t glyph = 0; glyph < glyph_count; glyph++) {
+		for (uint32_t y = 0; y < glyph_height; y++) {
+			for (uint32_t x = 0; x < glyph_width; x++) {
+				if (font[glyph][y] & (0x10 >> x)) set(glyph * cell_width + x, y);
+			}
+		}
+	}
+
+	for (uint32_t y = 0; y < cell_height; y++) {
+		for (uint32_t x = 0; x < cell_width; x++) {
+			set(glyph_count * cell_width + x, y);
+		}
+	}
+
+	return pixels;
+}
+
+HudBuilder::HudBuilder(HudVertex* v, uint32_t c, float s)
+	: vertices(v), capacity(c), scale(s) {
+}
+
+void HudBuilder::Rect(float x, float y, float width, float height, uint32_t color) {
+	// Middle of the solid cell, so filtering never reaches a glyph
+	float u = (glyph_count * cell_width + cell_width * 0.5f) / atlas_width;
+	float v = (cell_height * 0.5f) / atlas_height;
+
+	Quad(x, y, x + width, y + height, u, v, u, v, color);
+}
+
+float HudBuilder::Text(float x, float y, const char* text, uint32_t color) {
+	float advance = cell_width * scale;
+
+	for (const char* c = text; *c; c++) {
+		char character = *c;
+		if (character >= 'a' && character <= 'z') character -= 'a' - 'A';
+		if (character < ' ' || character > '_') character = '?';
+
+		if (character != ' ') {
+			uint32_t glyph = (uint32_t) (character - ' ');
+			float u0 = (float) (glyph * cell_width) / atlas_width;
+			float u1 = (float) (glyph * cell_width + glyph_width) / atlas_width;
+			float v1 = (float) glyph_height / atlas_height;
+
+			Quad(x, y, x + glyph_width * scale, y + glyph_height * scale, u0, 0.0f, u1, v1, color);
+		}
+
+		x += advance;
+	}
+
+	return x;
+}
+
+float HudBuilder::GetLineHeight() const {
+	return (cell_height + 1) * scale;
+}
+
+uint32_t HudBuilder::GetCount() const {
+	return count;
+}
+
+void HudBuilder::Quad(
+	float x0, float y0, float x1, float y1,
+	float u0, float v0, float u1, float v1, uint32_t color
+) {
+	if (count + 6 > capacity) return;
+
+	HudVertex* q = vertices + count;
+	q[0] = { { x0, y0 }, { u0, v0 }, color };
+	q[1] = { { x1, y0 }, { u1, v0 }, color };
+	q[2] = { { x1, y1 }, { u1, v1 }, color };
+	q[3] = { { x1, y1 }, { u1, v1 }, color };
+	q[4] = { { x0, y1 }, { u0, v1 }, color };
+	q[5] = { { x0, y0 }, { u0, v0 }, color };
+
+	count += 6;
+}
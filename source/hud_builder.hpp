@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// One corner of an overlay quad
+struct HudVertex {
+	float pos[2];		// pixels from the top left of the window
+	float tex_coord[2];	// into the font atlas
+	uint32_t color;		// RGBA8, red in the lowest byte
+};
+
+inline uint32_t HudColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255) {
+	return (uint32_t) r | ((uint32_t) g << 8) | ((uint32_t) b << 16) | ((uint32_t) a << 24);
+}
+
+// Turns text and solid rectangles into quads for the performance overlay,
+// written straight into a mapped vertex buffer. Text uses a built-in 5x7
+// bitmap font covering ' ' to '_' (lowercase is drawn as uppercase); solid
+// quads sample an all-white cell of the same atlas, so everything goes out
+// in one draw. Nothing is allocated, and quads past the capacity are
+// dropped.
+class HudBuilder {
+public:
+	static const uint32_t glyph_width = 5;
+	static const uint32_t glyph_height = 7;
+	static const uint32_t cell_width = 6;		// glyph plus one texel of padding
+	static const uint32_t cell_height = 8;
+	static const uint32_t glyph_count = 64;		// ' ' .. '_'
+
+	// RGBA8 atlas with every glyph side by side, followed by the solid
+	// cell; white with coverage in alpha
+	static std::vector<uint8_t> BuildFontAtlas(uint32_t& width, uint32_t& height);
+
+	// `scale` is the size of one font texel in pixels
+	HudBuilder(HudVertex* vertices, uint32_t capacity, float scale = 2.0f);
+
+	void Rect(float x, float y, float width, float height, uint32_t color);
+
+	// Returns the x position just past the last character
+	float Text(float x, float y, const char* text, uint32_t color);
+
+	float GetLineHeight() const;
+	uint32_t GetCount() const;
+
+protected:
+	HudVertex* vertices;
+	uint32_t capacity;
+	uint32_t count = 0;
+	float scale;
+
+	void Quad(
+		float x0, float y0, float x1, float y1,
+		float u0, float v0, float u1, float v1, uint32_t color);
+};
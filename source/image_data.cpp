@@ -0,0 +1,43 @@
+#include "image_data.hpp"
+
+bool IsBlockCompressed(BlockFormat format) {
+	return format != BlockFormat::RGBA8;
+}
+
+size_t BlockBytes(BlockFormat format) {
+	switch (format) {
+	case BlockFormat::RGBA8:		return 4;
+	case BlockFormat::BC1:			return 8;
+	case BlockFormat::ETC2_RGB8:	return 8;
+	case BlockFormat::BC3:			return 16;
+	case BlockFormat::BC5:			return 16;
+	case BlockFormat::BC7:			return 16;
+	case BlockFormat::ETC2_RGBA8:	return 16;
+	}
+
+	return 0;
+}
+
+size_t LevelBytes(BlockFormat format, uint32_t width, uint32_t height) {
+	if (!IsBlockCompressed(format)) {
+		return (size_t) width * height * BlockBytes(format);
+	}
+
+	size_t blocks_x = (width + 3) / 4;
+	size_t blocks_y = (height + 3) / 4;
+	return blocks_x * blocks_y * BlockBytes(format);
+}
+
+uint8_t* ImageData::AddLevel(uint32_t w, uint32_t h, size_t size) {
+	// Keep every level aligned for buffer-to-image copies of any format
+	size_t offset = (pixels.size() + 15) & ~(size_t) 15;
+	pixels.resize(offset + size);
+
+	if (levels.empty()) {
+		width = w;
+		height = h;
+	}
+	levels.push_back({ w, h, offset, size });
+
+	return pixels.data() + offset;
+}
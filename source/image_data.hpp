@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Pixel layouts an image can arrive in. The block formats store 4x4 texel
+// blocks; RGBA8 is plain tightly packed 8-bit RGBA.
+enum class BlockFormat {
+	RGBA8,
+	BC1,		// RGB, 8 bytes per block
+	BC3,		// RGBA, 16 bytes per block
+	BC5,		// two channels (normal maps), 16 bytes per block
+	BC7,		// high quality RGBA, 16 bytes per block
+	ETC2_RGB8,	// 8 bytes per block
+	ETC2_RGBA8	// 16 bytes per block
+};
+
+bool IsBlockCompressed(BlockFormat);
+
+// Bytes per 4x4 block, or per texel for uncompressed formats
+size_t BlockBytes(BlockFormat);
+
+// Bytes needed for one level of the given size
+size_t LevelBytes(BlockFormat, uint32_t width, uint32_t height);
+
+struct ImageLevel {
+	uint32_t width;
+	uint32_t height;
+	size_t offset;	// into ImageData::pixels, always 16-byte aligned
+	size_t size;
+};
+
+// Decoded image, possibly with a mip chain. `levels` always has at least
+// one entry; level 0 is the full resolution image.
+struct ImageData {
+	BlockFormat format = BlockFormat::RGBA8;
+	uint32_t width = 0;
+	uint32_t height = 0;
+
+	std::vector<ImageLevel> levels;
+	std::vector<uint8_t> pixels;
+
+	// Appends a level of `size` bytes and returns a pointer to its storage
+	uint8_t* AddLevel(uint32_t width, uint32_t height, size_t size);
+};
@@ -0,0 +1,86 @@
+// Measures how JobSystem::ParallelFor scales with the number of cores.
+// Standalone: needs neither Vulkan nor a window.
+//
+//	make benchmark
+//	./job_benchmark [elements] [grain]
+
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const int repeats = 5;
+
+// Enough arithmetic per element that the work, not the scheduling, is
+// what gets measured
+float Work(uint32_t i) {
+	float x = (float) i;
+	for (int k = 0; k < 64; k++) {
+		x = sqrtf(x * 1.0001f + 1.0f) + sinf(x);
+	}
+	return x;
+}
+
+// Best of a few runs, in milliseconds
+double Run(JobSystem& jobs, vector<float>& out, uint32_t grain) {
+	double best = 1e30;
+
+	for (int r = 0; r < repeats; r++) {
+		auto start = chrono::steady_clock::now();
+
+		jobs.ParallelFor((uint32_t) out.size(), grain, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t i = begin; i < end; i++) out[i] = Work(i);
+		});
+
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		best = min(best, ms);
+	}
+
+	return best;
+}
+
+}
+
+int main(int argc, char** argv) {
+	uint32_t count = argc > 1 ? (uint32_t) strtoul(argv[1], nullptr, 10) : 1u << 18;
+	uint32_t grain = argc > 2 ? (uint32_t) strtoul(argv[2], nullptr, 10) : 1024;
+	if (count == 0 || grain == 0) {
+		cerr << "Usage: " << argv[0] << " [elements] [grain]" << endl;
+		return 1;
+	}
+
+	unsigned hardware = max(thread::hardware_concurrency(), 1u);
+	vector<float> out(count);
+
+	cout << count << " elements, grain " << grain << ", best of " << repeats << " runs" << endl;
+	cout << " cores        ms   speedup" << endl;
+
+	double single = 0.0;
+	// 1, 2, 4, ... and then every hardware thread
+	for (unsigned cores = 1; ; cores = min(cores * 2, hardware)) {
+		// The calling thread runs chunks too, so it counts as a core. A
+		// pool that is never started runs everything on the caller.
+		JobSystem jobs;
+		if (cores > 1) jobs.Start(cores - 1);
+
+		double ms = Run(jobs, out, grain);
+		if (cores == 1) single = ms;
+
+		cout << setw(6) << cores
+			<< setw(10) << fixed << setprecision(2) << ms
+			<< setw(9) << setprecision(2) << single / ms << "x" << endl;
+
+		if (cores == hardware) break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,204 @@
+#include "job_system.hpp"
+
+#include <algorithm>
+
+namespace {
+
+// Which pool, if any, the current thread is a worker of
+thread_local const JobSystem* current_system = nullptr;
+thread_local unsigned current_index = 0;
+
+}
+
+JobSystem::JobSystem() {
+	queues.emplace_back(new Queue());
+}
+
+JobSystem::~JobSystem() {
+	Stop();
+}
+
+void JobSystem::Start(unsigned threads) {
+	Stop();
+
+	if (threads == 0) {
+		threads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+	}
+
+	// One deque per worker plus the shared one for outside threads
+	queues.clear();
+	for (unsigned i = 0; i < threads + 1; i++) {
+		queues.emplace_back(new Queue());
+	}
+
+	stopping = false;
+	for (unsigned i = 0; i < threads; i++) {
+		workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+	}
+}
+
+void JobSystem::Stop() {
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stopping = true;
+	}
+	sleep_condition.notify_all();
+
+	for (auto& worker : workers) worker.join();
+	workers.clear();
+}
+
+JobSystem::Handle JobSystem::Submit(Job job, const std::vector<Handle>& dependencies) {
+	auto task = std::make_shared<Task>();
+	task->job = std::move(job);
+	task->pending = (uint32_t) dependencies.size() + 1;
+
+	for (const Handle& dependency : dependencies) {
+		{
+			std::lock_guard<std::mutex> lock(dependency->mutex);
+			if (!dependency->done) {
+				dependency->continuations.push_back(task);
+				continue;
+			}
+		}
+		task->pending--;
+	}
+
+	if (--task->pending == 0) Enqueue(task);
+
+	return task;
+}
+
+void JobSystem::Wait(const Handle& task) {
+	unsigned queue = CurrentQueue();
+
+	while (!task->done.load(std::memory_order_acquire)) {
+		if (!RunOne(queue)) std::this_thread::yield();
+	}
+
+	if (task->error) std::rethrow_exception(task->error);
+}
+
+void JobSystem::ParallelFor(
+	uint32_t count, uint32_t grain,
+	const std::function<void(uint32_t, uint32_t)>& body
+) {
+	grain = std::max(grain, 1u);
+
+	std::vector<Handle> chunks;
+	chunks.reserve((count + grain - 1) / grain);
+	for (uint32_t begin = 0; begin < count; begin += grain) {
+		uint32_t end = std::min(begin + grain, count);
+		chunks.push_back(Submit([&body, begin, end]() { body(begin, end); }));
+	}
+
+	// Every chunk references `body`, so all of them have to finish before
+	// an error can be passed on
+	std::exception_ptr error;
+	for (const Handle& chunk : chunks) {
+		try {
+			Wait(chunk);
+		} catch (...) {
+			if (!error) error = std::current_exception();
+		}
+	}
+
+	if (error) std::rethrow_exception(error);
+}
+
+unsigned JobSystem::CurrentQueue() const {
+	if (current_system == this) return current_index;
+	return (unsigned) queues.size() - 1;
+}
+
+void JobSystem::Enqueue(Handle task) {
+	// Counted before it becomes visible so the count never goes negative
+	queued++;
+
+	Queue& queue = *queues[CurrentQueue()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+
+	// Taking the lock orders this against a worker that just found
+	// nothing and is about to sleep
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+	}
+	sleep_condition.notify_one();
+}
+
+JobSystem::Handle JobSystem::Pop(unsigned index) {
+	Queue& queue = *queues[index];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+
+	if (queue.tasks.empty()) return nullptr;
+
+	Handle task = std::move(queue.tasks.back());
+	queue.tasks.pop_back();
+	return task;
+}
+
+JobSystem::Handle JobSystem::Steal(unsigned thief) {
+	unsigned count = (unsigned) queues.size();
+
+	for (unsigned i = 1; i < count; i++) {
+		Queue& queue = *queues[(thief + i) % count];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		if (queue.tasks.empty()) continue;
+
+		// Oldest first; those tend to be the biggest pieces of work
+		Handle task = std::move(queue.tasks.front());
+		queue.tasks.pop_front();
+		return task;
+	}
+
+	return nullptr;
+}
+
+bool JobSystem::RunOne(unsigned index) {
+	Handle task = Pop(index);
+	if (!task) task = Steal(index);
+	if (!task) return false;
+
+	queued--;
+
+	try {
+		task->job();
+	} catch (...) {
+		task->error = std::current_exception();
+	}
+	task->job = nullptr;
+
+	Finish(task);
+	return true;
+}
+
+void JobSystem::Finish(const Handle& task) {
+	std::vector<Handle> continuations;
+	{
+		std::lock_guard<std::mutex> lock(task->mutex);
+		task->done.store(true, std::memory_order_release);
+		continuations.swap(task->continuations);
+	}
+
+	for (Handle& next : continuations) {
+		if (--next->pending == 0) Enqueue(std::move(next));
+	}
+}
+
+void JobSystem::WorkerLoop(unsigned index) {
+	current_system = this;
+	current_index = index;
+
+	while (true) {
+		if (RunOne(index)) continue;
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		sleep_condition.wait(lock, [this] { return stopping || queued > 0; });
+
+		if (stopping && queued == 0) return;
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing task scheduler. Each worker owns a deque: it pushes and
+// pops its own tasks at the back (most recent first, while its data is
+// still in cache) and steals from the front of the others when it runs
+// dry. Threads outside the pool submit into one extra shared deque.
+//
+// Tasks can depend on other tasks; a task is only queued once all of its
+// dependencies have finished. Waiting on a task runs other tasks in the
+// meantime instead of blocking, so nested waits inside tasks are fine.
+class JobSystem {
+public:
+	using Job = std::function<void()>;
+
+	struct Task {
+		Job job;
+		std::atomic<bool> done { false };
+		std::exception_ptr error;
+
+		// Unfinished dependencies, plus one held by Submit() itself
+		std::atomic<uint32_t> pending { 1 };
+
+		std::mutex mutex;
+		std::vector<std::shared_ptr<Task>> continuations;
+	};
+	using Handle = std::shared_ptr<Task>;
+
+	JobSystem();
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// Zero threads uses one worker per hardware thread, minus the caller's.
+	// Must not be called while tasks are outstanding. A pool that is never
+	// started still works; waiting threads run everything themselves.
+	void Start(unsigned threads = 0);
+
+	// Runs whatever is still queued, then joins the workers
+	void Stop();
+
+	unsigned WorkerCount() const { return (unsigned) workers.size(); }
+
+	Handle Submit(Job, const std::vector<Handle>& dependencies = {});
+
+	// Helps run tasks until `task` is done. Rethrows anything it threw.
+	void Wait(const Handle& task);
+
+	// Calls `body(begin, end)` over [0, count) in chunks of `grain` and
+	// returns once all chunks are done. The caller runs chunks too.
+	void ParallelFor(
+		uint32_t count, uint32_t grain,
+		const std::function<void(uint32_t begin, uint32_t end)>& body
+	);
+
+protected:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Handle> tasks;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+
+	std::atomic<uint32_t> queued { 0 };
+	std::mutex sleep_mutex;
+	std::condition_variable sleep_condition;
+	bool stopping = false;
+
+	unsigned CurrentQueue() const;
+	void Enqueue(Handle);
+	Handle Pop(unsigned queue);
+	Handle Steal(unsigned thief);
+	bool RunOne(unsigned queue);
+	void Finish(const Handle&);
+
+	void WorkerLoop(unsigned index);
+};
@@ -0,0 +1,127 @@
+#include "ktx.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+const uint8_t ktx_identifier[12] = {
+	0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+
+const uint32_t ktx_endianness = 0x04030201;
+
+struct KtxHeader {
+	uint8_t  identifier[12];
+	uint32_t endianness;
+	uint32_t gl_type;
+	uint32_t gl_type_size;
+	uint32_t gl_format;
+	uint32_t gl_internal_format;
+	uint32_t gl_base_internal_format;
+	uint32_t pixel_width;
+	uint32_t pixel_height;
+	uint32_t pixel_depth;
+	uint32_t array_elements;
+	uint32_t faces;
+	uint32_t mip_levels;
+	uint32_t key_value_bytes;
+};
+
+// glInternalFormat values of the formats we understand
+enum : uint32_t {
+	GL_RGBA8								= 0x8058,
+	GL_COMPRESSED_RGB_S3TC_DXT1_EXT			= 0x83F0,
+	GL_COMPRESSED_RGBA_S3TC_DXT1_EXT		= 0x83F1,
+	GL_COMPRESSED_RGBA_S3TC_DXT5_EXT		= 0x83F3,
+	GL_COMPRESSED_RG_RGTC2					= 0x8DBD,
+	GL_COMPRESSED_RGBA_BPTC_UNORM			= 0x8E8C,
+	GL_COMPRESSED_RGB8_ETC2					= 0x9274,
+	GL_COMPRESSED_RGBA8_ETC2_EAC			= 0x9278
+};
+
+BlockFormat FormatFromGl(uint32_t internal_format) {
+	switch (internal_format) {
+	case GL_RGBA8:								return BlockFormat::RGBA8;
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:		return BlockFormat::BC1;
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:		return BlockFormat::BC1;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:		return BlockFormat::BC3;
+	case GL_COMPRESSED_RG_RGTC2:				return BlockFormat::BC5;
+	case GL_COMPRESSED_RGBA_BPTC_UNORM:			return BlockFormat::BC7;
+	case GL_COMPRESSED_RGB8_ETC2:				return BlockFormat::ETC2_RGB8;
+	case GL_COMPRESSED_RGBA8_ETC2_EAC:			return BlockFormat::ETC2_RGBA8;
+	}
+
+	throw std::runtime_error("Unsupported KTX internal format");
+}
+
+uint32_t Swap32(uint32_t v) {
+	return (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24);
+}
+
+} // namespace
+
+ImageData LoadKtx(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to open file " + path);
+	}
+
+	KtxHeader header;
+	if (!file.read((char*) &header, sizeof(header))) {
+		throw std::runtime_error(path + ": truncated KTX header");
+	}
+
+	if (memcmp(header.identifier, ktx_identifier, sizeof(ktx_identifier)) != 0) {
+		throw std::runtime_error(path + ": not a KTX 1.1 file");
+	}
+
+	bool swap = header.endianness != ktx_endianness;
+	if (swap) {
+		uint32_t* fields = &header.endianness;
+		size_t count = (sizeof(header) - sizeof(header.identifier)) / sizeof(uint32_t);
+		for (size_t i = 0; i < count; i++) fields[i] = Swap32(fields[i]);
+	}
+
+	if (	header.pixel_depth > 1 || header.array_elements > 0 ||
+		header.faces != 1 || header.pixel_width == 0 || header.pixel_height == 0)
+	{
+		throw std::runtime_error(path + ": only single 2D textures are supported");
+	}
+
+	ImageData image;
+	image.format = FormatFromGl(header.gl_internal_format);
+
+	file.seekg(header.key_value_bytes, std::ios::cur);
+
+	uint32_t level_count = std::max(header.mip_levels, 1u);
+	uint32_t width = header.pixel_width;
+	uint32_t height = header.pixel_height;
+
+	for (uint32_t level = 0; level < level_count; level++) {
+		uint32_t image_size;
+		if (!file.read((char*) &image_size, sizeof(image_size))) {
+			throw std::runtime_error(path + ": truncated KTX level");
+		}
+		if (swap) image_size = Swap32(image_size);
+
+		if (image_size != LevelBytes(image.format, width, height)) {
+			throw std::runtime_error(path + ": KTX level size does not match its format");
+		}
+
+		uint8_t* data = image.AddLevel(width, height, image_size);
+		if (!file.read((char*) data, image_size)) {
+			throw std::runtime_error(path + ": truncated KTX level");
+		}
+
+		// Level data is padded to a multiple of four bytes
+		file.seekg(3 - ((image_size + 3) % 4), std::ios::cur);
+
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+
+	return image;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "image_data.hpp"
+
+#include <string>
+
+// Reads a KTX 1.1 container holding a single 2D texture, with or without a
+// mip chain, in one of the formats of BlockFormat. Throws std::runtime_error
+// for anything else.
+ImageData LoadKtx(const std::string& path);
@@ -0,0 +1,83 @@
+#include "layout_cache.hpp"
+
+#include <algorithm>
+
+void LayoutCache::Init(vk::Device d, const vk::AllocationCallbacks* a) {
+	device = d;
+	allocator = a;
+}
+
+void LayoutCache::Destroy() {
+	for (auto& entry : pipeline_layouts) device.destroyPipelineLayout(entry.second, allocator);
+	for (auto& entry : set_layouts) device.destroyDescriptorSetLayout(entry.second, allocator);
+
+	pipeline_layouts.clear();
+	set_layouts.clear();
+}
+
+vk::DescriptorSetLayout LayoutCache::GetSetLayout(const std::vector<vk::DescriptorSetLayoutBinding>& unsorted) {
+	// The same bindings listed in another order are the same layout
+	std::vector<vk::DescriptorSetLayoutBinding> bindings = unsorted;
+	std::sort(bindings.begin(), bindings.end(),
+		[](const vk::DescriptorSetLayoutBinding& a, const vk::DescriptorSetLayoutBinding& b) {
+			return a.binding < b.binding;
+		});
+
+	Key key;
+	for (const auto& binding : bindings) {
+		key.push_back(binding.binding);
+		key.push_back((uint32_t) binding.descriptorType);
+		key.push_back(binding.descriptorCount);
+		key.push_back((uint32_t) binding.stageFlags);
+	}
+
+	auto found = set_layouts.find(key);
+	if (found != set_layouts.end()) return found->second;
+
+	auto layout_info = vk::DescriptorSetLayoutCreateInfo()
+	.setBindingCount((uint32_t) bindings.size())
+	.setPBindings(bindings.data());
+
+	vk::DescriptorSetLayout layout = device.createDescriptorSetLayout(layout_info, allocator);
+	set_layouts[key] = layout;
+	return layout;
+}
+
+vk::DescriptorSetLayout LayoutCache::GetSetLayout(const ShaderInterface& shader, uint32_t set) {
+	return GetSetLayout(shader.GetSetBindings(set));
+}
+
+vk::PipelineLayout LayoutCache::GetPipelineLayout(const ShaderInterface& shader) {
+	std::vector<vk::DescriptorSetLayout> layouts;
+	for (uint32_t set = 0; set < shader.GetSetCount(); set++) {
+		layouts.push_back(GetSetLayout(shader, set));
+	}
+
+	// Set layouts are already unique, so their handles stand in for them
+	Key key;
+	key.push_back((uint32_t) shader.push_constant_stages);
+	key.push_back(shader.push_constant_size);
+	for (vk::DescriptorSetLayout layout : layouts) {
+		uint64_t handle = (uint64_t) (VkDescriptorSetLayout) layout;
+		key.push_back((uint32_t) handle);
+		key.push_back((uint32_t) (handle >> 32));
+	}
+
+	auto found = pipeline_layouts.find(key);
+	if (found != pipeline_layouts.end()) return found->second;
+
+	auto push_constant_range = vk::PushConstantRange()
+	.setStageFlags(shader.push_constant_stages)
+	.setOffset(0)
+	.setSize(shader.push_constant_size);
+
+	auto layout_info = vk::PipelineLayoutCreateInfo()
+	.setSetLayoutCount((uint32_t) layouts.size())
+	.setPSetLayouts(layouts.data())
+	.setPushConstantRangeCount(shader.push_constant_size > 0 ? 1 : 0)
+	.setPPushConstantRanges(&push_constant_range);
+
+	vk::PipelineLayout layout = device.createPipelineLayout(layout_info, allocator);
+	pipeline_layouts[key] = layout;
+	return layout;
+}
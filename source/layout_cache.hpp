@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include "shader_reflection.hpp"
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// Descriptor set and pipeline layouts built from reflected shader
+// interfaces, one object per distinct interface: shaders that declare the
+// same bindings and push constants get the same handles back, so their
+// pipelines stay layout-compatible and descriptor sets bound for one can be
+// used with the other.
+//
+// The cache owns everything it hands out; Destroy() releases it all, after
+// every pipeline using the layouts is gone.
+class LayoutCache {
+public:
+	void Init(vk::Device, const vk::AllocationCallbacks*);
+	void Destroy();
+
+	vk::DescriptorSetLayout GetSetLayout(const std::vector<vk::DescriptorSetLayoutBinding>&);
+
+	// Sets the interface does not use become empty layouts
+	vk::DescriptorSetLayout GetSetLayout(const ShaderInterface&, uint32_t set);
+	vk::PipelineLayout GetPipelineLayout(const ShaderInterface&);
+
+protected:
+	// Layouts are small, so their descriptions flattened into words make
+	// exact keys without any hashing
+	using Key = std::vector<uint32_t>;
+
+	vk::Device device;
+	const vk::AllocationCallbacks* allocator = nullptr;
+
+	std::map<Key, vk::DescriptorSetLayout>	set_layouts;
+	std::map<Key, vk::PipelineLayout>		pipeline_layouts;
+};
@@ -0,0 +1,87 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Lighting subpass of the deferred path. The G-buffer is read with
+// subpassLoad, so each pixel only ever sees its own values and the driver
+// can keep them in tile memory.
+
+layout(input_attachment_index = 0, binding = 1) uniform subpassInput gbuffer_albedo;
+layout(input_attachment_index = 1, binding = 2) uniform subpassInput gbuffer_normal;
+layout(input_attachment_index = 2, binding = 3) uniform subpassInput gbuffer_depth;
+
+// The light cluster grid, as in light_cull.comp
+layout(constant_id = 0) const uint CLUSTERS_X = 16;
+layout(constant_id = 1) const uint CLUSTERS_Y = 9;
+layout(constant_id = 2) const uint CLUSTERS_Z = 24;
+layout(constant_id = 3) const uint MAX_LIGHTS_PER_CLUSTER = 128;
+
+// Matches FrameLight in vk_app.hpp
+struct FrameLight {
+	vec4 position_radius;
+	vec4 color;
+	vec4 direction_cos;
+	vec4 view_position;
+};
+
+layout(std430, binding = 4) readonly buffer FrameLights { FrameLight frame_lights[]; };
+layout(std430, binding = 5) readonly buffer ClusterCounts { uint cluster_counts[]; };
+layout(std430, binding = 6) readonly buffer ClusterIndices { uint cluster_indices[]; };
+
+layout(location = 0) in vec2 frag_ndc;
+layout(location = 1) flat in mat4 frag_inverse_view_proj;
+layout(location = 5) flat in vec3 frag_camera_position;
+layout(location = 6) flat in vec4 frag_depth_to_slice;
+
+layout(location = 0) out vec4 out_color;
+
+const vec3 ambient = vec3(0.1);
+
+void main() {
+	// Nothing was drawn here; the cleared background stays
+	float depth = subpassLoad(gbuffer_depth).r;
+	if (depth >= 1.0) discard;
+
+	vec4 world = frag_inverse_view_proj * vec4(frag_ndc, depth, 1.0);
+	vec3 position = world.xyz / world.w;
+
+	vec3 albedo = subpassLoad(gbuffer_albedo).rgb;
+	vec3 normal = normalize(subpassLoad(gbuffer_normal).xyz * 2.0 - 1.0);
+	if (dot(normal, frag_camera_position - position) < 0.0) normal = -normal;
+
+	// Only the lights culled into this pixel's cluster are looked at
+	float view_depth = frag_depth_to_slice.y / (depth + frag_depth_to_slice.x);
+	float slice = log(view_depth) * frag_depth_to_slice.z + frag_depth_to_slice.w;
+	uvec3 cell = uvec3(clamp(
+		vec3(
+			(frag_ndc * 0.5 + 0.5) * vec2(CLUSTERS_X, CLUSTERS_Y),
+			slice
+		),
+		vec3(0.0),
+		vec3(CLUSTERS_X - 1, CLUSTERS_Y - 1, CLUSTERS_Z - 1)
+	));
+	uint cluster = (cell.z * CLUSTERS_Y + cell.y) * CLUSTERS_X + cell.x;
+
+	vec3 light = ambient;
+	uint count = cluster_counts[cluster];
+	for (uint i = 0; i < count; i++) {
+		FrameLight frame_light = frame_lights[cluster_indices[cluster * MAX_LIGHTS_PER_CLUSTER + i]];
+
+		vec3 to_light = frame_light.position_radius.xyz - position;
+		float light_distance = length(to_light);
+		float radius = frame_light.position_radius.w;
+		if (light_distance >= radius) continue;
+
+		// Point lights have a cone cosine below -1, which every direction
+		// passes
+		vec3 direction = to_light / light_distance;
+		float cone_cos = frame_light.direction_cos.w;
+		float cone = smoothstep(cone_cos, cone_cos + 0.05, dot(-direction, frame_light.direction_cos.xyz));
+
+		// Smooth falloff that reaches zero at the radius
+		float falloff = 1.0 - light_distance / radius;
+		float diffuse = max(dot(normal, direction), 0.0);
+		light += frame_light.color.rgb * frame_light.color.a * diffuse * falloff * falloff * cone;
+	}
+
+	out_color = vec4(albedo * light, 1.0);
+}
@@ -0,0 +1,41 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(binding = 0) uniform UniformBufferObject {
+	mat4 model;
+	mat4 view;
+	mat4 proj;
+} ubo;
+
+// Depth slices of the light clusters; see light_cull.comp
+layout(constant_id = 2) const uint CLUSTERS_Z = 24;
+
+layout(location = 0) out vec2 frag_ndc;
+layout(location = 1) flat out mat4 frag_inverse_view_proj;	// locations 1 to 4
+layout(location = 5) flat out vec3 frag_camera_position;
+layout(location = 6) flat out vec4 frag_depth_to_slice;	// P22, P32, slice scale, slice bias
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+void main() {
+	// One triangle covering the screen: (-1, -1), (3, -1), (-1, 3)
+	vec2 ndc = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2) * 2.0 - 1.0;
+
+	gl_Position = vec4(ndc, 0.0, 1.0);
+	frag_ndc = ndc;
+
+	// Three invocations a frame, so the inverses cost nothing here
+	frag_inverse_view_proj = inverse(ubo.proj * ubo.view);
+	frag_camera_position = inverse(ubo.view)[3].xyz;
+
+	// The slice of a view depth d is log(d) * scale + bias, from
+	// d = n * (f / n)^(slice / CLUSTERS_Z)
+	float p22 = ubo.proj[2][2];
+	float p32 = ubo.proj[3][2];
+	float near_plane = p32 / (p22 - 1.0);
+	float far_plane = p32 / (p22 + 1.0);
+	float scale = float(CLUSTERS_Z) / log(far_plane / near_plane);
+	frag_depth_to_slice = vec4(p22, p32, scale, -log(near_plane) * scale);
+}
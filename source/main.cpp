@@ -1,10 +1,121 @@
 #include "vk_app.hpp"
 
+#include <cctype>
+#include <cstdint>
 #include <iostream>
 #include <stdexcept>
+#include <string>
 
-int main() {
+namespace {
+
+const unsigned long max_windows = 16;
+const unsigned long max_samples = 64;
+const unsigned long max_count = UINT32_MAX;
+
+// A whole number in [0, max]. std::stoul alone would take "-1" and wrap
+// it around to ULONG_MAX, and ignore anything after the digits.
+bool ParseCount(const std::string& text, unsigned long max, unsigned long& value) {
+	if (text.empty() || !std::isdigit((unsigned char) text[0])) return false;
+
+	try {
+		size_t used;
+		value = std::stoul(text, &used);
+		return used == text.size() && value <= max;
+	} catch (const std::exception&) {
+		return false;	// out of range for unsigned long
+	}
+}
+
+bool ParseRate(const std::string& text, double& value) {
+	try {
+		size_t used;
+		value = std::stod(text, &used);
+		return used == text.size();
+	} catch (const std::exception&) {
+		return false;
+	}
+}
+
+void InvalidValue(const std::string& arg) {
+	std::cerr << "Invalid value in option " << arg << std::endl;
+}
+
+}
+
+int main(int argc, char** argv) {
 	VkApp app("Vulkan");
+	SceneVariant variant;
+	unsigned long check_frames = 0;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		unsigned long count;
+		double rate;
+
+		if (arg == "--low-latency") {
+			app.SetPresentPolicy(PresentPolicy::LowLatency);
+		} else if (arg == "--throughput") {
+			app.SetPresentPolicy(PresentPolicy::Throughput);
+		} else if (arg == "--power-save") {
+			app.SetPresentPolicy(PresentPolicy::PowerSave);
+		} else if (arg.compare(0, 10, "--texture=") == 0) {
+			app.LoadTexture(arg.substr(10));
+		} else if (arg == "--idle") {
+			app.SetIdleMode(true);
+		} else if (arg.compare(0, 6, "--fps=") == 0) {
+			if (ParseRate(arg.substr(6), rate)) app.SetTargetFrameRate(rate);
+			else InvalidValue(arg);
+		} else if (arg == "--depth-prepass") {
+			app.SetDepthPrepass(true);
+		} else if (arg == "--deferred") {
+			app.SetDeferred(true);
+		} else if (arg.compare(0, 9, "--lights=") == 0) {
+			if (ParseCount(arg.substr(9), max_count, count)) app.SetLightCount((uint32_t) count);
+			else InvalidValue(arg);
+		} else if (arg.compare(0, 10, "--windows=") == 0) {
+			if (ParseCount(arg.substr(10), max_windows, count)) {
+				for (unsigned long w = 1; w < count; w++) {
+					app.AddWindow("Vulkan " + std::to_string(w + 1), 800, 600);
+				}
+			} else {
+				InvalidValue(arg);
+			}
+		} else if (arg.compare(0, 7, "--msaa=") == 0) {
+			if (ParseCount(arg.substr(7), max_samples, count)) app.SetSampleCount((uint32_t) count);
+			else InvalidValue(arg);
+		} else if (arg.compare(0, 12, "--particles=") == 0) {
+			if (ParseCount(arg.substr(12), max_count, count)) app.SetParticleCapacity((uint32_t) count);
+			else InvalidValue(arg);
+		} else if (arg.compare(0, 17, "--particle-check=") == 0) {
+			if (!ParseCount(arg.substr(17), max_count, check_frames)) InvalidValue(arg);
+		} else if (arg.compare(0, 10, "--capture=") == 0) {
+			app.SetCaptureDirectory(arg.substr(10));
+		} else if (arg == "--no-vertex-color") {
+			variant.vertex_color = VK_FALSE;
+		} else if (arg == "--instancing") {
+			variant.instanced = VK_TRUE;
+		} else if (arg == "--quantize") {
+			variant.quantized = VK_TRUE;
+		} else if (arg == "--hud") {
+			app.SetHud(true);
+		} else if (arg.compare(0, 10, "--metrics=") == 0) {
+			app.SetMetricsPath(arg.substr(10));
+		} else {
+			std::cerr << "Unknown option " << arg << std::endl;
+		}
+	}
+
+	app.SetSceneVariant(variant);
+
+	// Headless, and the exit status is the result
+	if (check_frames > 0) {
+		try {
+			return app.RunParticleCheck((uint32_t) check_frames) ? 0 : 1;
+		} catch (const std::runtime_error& e) {
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+	}
 
 	try {
 		app.Run();
@@ -13,10 +124,10 @@ int main() {
 		return 0;
 	}
 
-	#ifdef _WIN32
-
-		// Don't close the console immediately
-		getchar();
+	#ifdef _WIN32
+
+		// Don't close the console immediately
+		getchar();
 
 	#endif // _WIN32
 
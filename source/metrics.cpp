@@ -0,0 +1,185 @@
+#include "metrics.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+// Shortest form that still round-trips the values we export
+void WriteNumber(std::ostream& out, double value) {
+	char text[32];
+	snprintf(text, sizeof(text), "%.9g", value);
+	out << text;
+}
+
+}
+
+Metric::Metric(const std::string& n, const std::string& h)
+	: name(n), help(h) {
+}
+
+const std::string& Metric::GetName() const {
+	return name;
+}
+
+void Metric::WriteHeader(std::ostream& out, const char* type) const {
+	out << "# HELP " << name << " " << help << "\n";
+	out << "# TYPE " << name << " " << type << "\n";
+}
+
+void MetricCounter::Add(uint64_t amount) {
+	value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+uint64_t MetricCounter::Get() const {
+	return value.load(std::memory_order_relaxed);
+}
+
+void MetricCounter::Write(std::ostream& out) const {
+	WriteHeader(out, "counter");
+	out << name << " " << Get() << "\n";
+}
+
+void MetricGauge::Set(double v) {
+	value.store(v, std::memory_order_relaxed);
+}
+
+double MetricGauge::Get() const {
+	return value.load(std::memory_order_relaxed);
+}
+
+void MetricGauge::Write(std::ostream& out) const {
+	WriteHeader(out, "gauge");
+	out << name << " ";
+	WriteNumber(out, Get());
+	out << "\n";
+}
+
+MetricHistogram::MetricHistogram(
+	const std::string& n, const std::string& h, const std::vector<double>& b
+) : Metric(n, h), bounds(b), buckets(new std::atomic<uint64_t>[b.size() + 1]) {
+	for (size_t i = 0; i <= bounds.size(); i++) buckets[i] = 0;
+}
+
+std::vector<double> MetricHistogram::ExponentialBounds(double start, double factor, size_t count) {
+	std::vector<double> result(count);
+	for (size_t i = 0; i < count; i++) {
+		result[i] = start;
+		start *= factor;
+	}
+	return result;
+}
+
+void MetricHistogram::Observe(double v) {
+	// A dozen or so bounds, so a linear search beats anything cleverer
+	size_t bucket = 0;
+	while (bucket < bounds.size() && v > bounds[bucket]) bucket++;
+
+	buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+
+	// No fetch_add for doubles before C++20
+	double expected = sum.load(std::memory_order_relaxed);
+	while (!sum.compare_exchange_weak(expected, expected + v, std::memory_order_relaxed)) {}
+}
+
+void MetricHistogram::ObserveSince(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	Observe(elapsed.count());
+}
+
+void MetricHistogram::Write(std::ostream& out) const {
+	WriteHeader(out, "histogram");
+
+	// Prometheus buckets are cumulative
+	uint64_t cumulative = 0;
+	for (size_t i = 0; i < bounds.size(); i++) {
+		cumulative += buckets[i].load(std::memory_order_relaxed);
+		out << name << "_bucket{le=\"";
+		WriteNumber(out, bounds[i]);
+		out << "\"} " << cumulative << "\n";
+	}
+	cumulative += buckets[bounds.size()].load(std::memory_order_relaxed);
+	out << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+
+	out << name << "_sum ";
+	WriteNumber(out, sum.load(std::memory_order_relaxed));
+	out << "\n";
+	out << name << "_count " << count.load(std::memory_order_relaxed) << "\n";
+}
+
+void MetricsRegistry::Add(const Metric& metric) {
+	std::lock_guard<std::mutex> lock(mutex);
+	metrics.push_back(&metric);
+}
+
+void MetricsRegistry::Write(std::ostream& out) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (const Metric* metric : metrics) metric->Write(out);
+}
+
+MetricsExporter::~MetricsExporter() {
+	Stop();
+}
+
+void MetricsExporter::Start(const MetricsRegistry& r, const std::string& p, double interval_seconds) {
+	Stop();
+
+	registry = &r;
+	path = p;
+	interval = std::chrono::milliseconds((long long) (interval_seconds * 1000.0));
+	stopping = false;
+	failed = false;
+	worker = std::thread(&MetricsExporter::WorkerLoop, this);
+}
+
+void MetricsExporter::Stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+
+	if (worker.joinable()) worker.join();
+}
+
+void MetricsExporter::WorkerLoop() {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		bool stop = condition.wait_for(lock, interval, [this] { return stopping; });
+
+		lock.unlock();
+		WriteSnapshot();
+		lock.lock();
+
+		if (stop) return;
+	}
+}
+
+void MetricsExporter::WriteSnapshot() {
+	std::string temporary = path + ".tmp";
+
+	{
+		std::ofstream file(temporary, std::ios::trunc);
+		if (file) registry->Write(file);
+
+		if (!file) {
+			// Reported once; the render loop carries on either way
+			if (!failed) std::cout << "Failed to write metrics to " << temporary << std::endl;
+			failed = true;
+			return;
+		}
+	}
+
+	#ifdef _WIN32
+	// rename() does not replace an existing file here
+	std::remove(path.c_str());
+	#endif
+
+	if (std::rename(temporary.c_str(), path.c_str()) != 0 && !failed) {
+		std::cout << "Failed to replace " << path << std::endl;
+		failed = true;
+	}
+}
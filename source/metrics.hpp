@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A named value exported in the Prometheus text format. Updates are
+// relaxed atomics, so the render thread never blocks on a reader; a
+// snapshot taken mid-update may be off by that one update.
+class Metric {
+public:
+	Metric(const std::string& name, const std::string& help);
+	virtual ~Metric() = default;
+
+	Metric(const Metric&) = delete;
+	Metric& operator=(const Metric&) = delete;
+
+	const std::string& GetName() const;
+
+	// HELP and TYPE lines followed by the samples
+	virtual void Write(std::ostream&) const = 0;
+
+protected:
+	std::string name;
+	std::string help;
+
+	void WriteHeader(std::ostream&, const char* type) const;
+};
+
+// Only ever goes up
+class MetricCounter : public Metric {
+public:
+	using Metric::Metric;
+
+	void Add(uint64_t amount = 1);
+	uint64_t Get() const;
+
+	void Write(std::ostream&) const override;
+
+protected:
+	std::atomic<uint64_t> value { 0 };
+};
+
+// The latest value of something
+class MetricGauge : public Metric {
+public:
+	using Metric::Metric;
+
+	void Set(double);
+	double Get() const;
+
+	void Write(std::ostream&) const override;
+
+protected:
+	std::atomic<double> value { 0.0 };
+};
+
+// Counts observations into fixed buckets, each bounded above by one of
+// `bounds` (ascending); anything larger lands in the implicit +Inf bucket
+class MetricHistogram : public Metric {
+public:
+	MetricHistogram(
+		const std::string& name, const std::string& help, const std::vector<double>& bounds
+	);
+
+	// `count` bounds, starting at `start` and growing by `factor`
+	static std::vector<double> ExponentialBounds(double start, double factor, size_t count);
+
+	void Observe(double);
+
+	// Observes the time since `start` in seconds
+	void ObserveSince(std::chrono::steady_clock::time_point start);
+
+	void Write(std::ostream&) const override;
+
+protected:
+	std::vector<double> bounds;
+	std::unique_ptr<std::atomic<uint64_t>[]> buckets;	// not cumulative
+	std::atomic<uint64_t> count { 0 };
+	std::atomic<double> sum { 0.0 };
+};
+
+// The set of metrics one process exports. Metrics are owned elsewhere and
+// must outlive the registry (or at least any exporter reading it).
+class MetricsRegistry {
+public:
+	void Add(const Metric&);
+
+	// Every metric in the Prometheus text exposition format
+	void Write(std::ostream&) const;
+
+protected:
+	mutable std::mutex mutex;
+	std::vector<const Metric*> metrics;
+};
+
+// Periodically writes a registry snapshot to a file on its own thread, for
+// node_exporter's textfile collector or anything else that scrapes files.
+// Each snapshot goes to a temporary file first and is renamed over the old
+// one, so a reader never sees a partial write.
+class MetricsExporter {
+public:
+	MetricsExporter() = default;
+	~MetricsExporter();
+
+	MetricsExporter(const MetricsExporter&) = delete;
+	MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+	void Start(const MetricsRegistry&, const std::string& path, double interval_seconds = 1.0);
+
+	// Writes one last snapshot, then joins the worker
+	void Stop();
+
+protected:
+	const MetricsRegistry* registry = nullptr;
+	std::string path;
+	std::chrono::milliseconds interval { 1000 };
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping = false;
+	bool failed = false;
+
+	void WorkerLoop();
+	void WriteSnapshot();
+};
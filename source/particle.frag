@@ -0,0 +1,13 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec3 frag_color;
+layout(location = 1) in vec2 frag_offset;
+
+layout(location = 0) out vec4 out_color;
+
+void main() {
+	// Round, soft-edged dot; blended additively
+	float falloff = max(1.0 - dot(frag_offset, frag_offset), 0.0);
+	out_color = vec4(frag_color * falloff, 1.0);
+}
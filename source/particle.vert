@@ -0,0 +1,41 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Draws each particle as a camera-facing quad; there is no vertex buffer,
+// the instance index picks the particle and the vertex index the corner
+
+layout(binding = 0) uniform UniformBufferObject {
+	mat4 model;
+	mat4 view;
+	mat4 proj;
+} ubo;
+
+layout(std430, binding = 1) readonly buffer Positions { vec4 position_age[]; };
+layout(std430, binding = 2) readonly buffer Velocities { vec4 velocity_lifetime[]; };
+
+layout(location = 0) out vec3 frag_color;
+layout(location = 1) out vec2 frag_offset;
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+const vec2 corners[6] = vec2[](
+	vec2(-1.0, -1.0), vec2( 1.0, -1.0), vec2( 1.0,  1.0),
+	vec2( 1.0,  1.0), vec2(-1.0,  1.0), vec2(-1.0, -1.0)
+);
+
+const float particle_size = 0.008;
+
+void main() {
+	vec4 position = position_age[gl_InstanceIndex];
+	float age = clamp(position.w / velocity_lifetime[gl_InstanceIndex].w, 0.0, 1.0);
+
+	vec2 corner = corners[gl_VertexIndex];
+	vec4 view_position = ubo.view * ubo.model * vec4(position.xyz, 1.0);
+	view_position.xy += corner * particle_size;
+
+	gl_Position = ubo.proj * view_position;
+	frag_color = mix(vec3(1.0, 0.8, 0.3), vec3(0.8, 0.1, 0.05), age) * (1.0 - age);
+	frag_offset = corner;
+}
@@ -0,0 +1,77 @@
+#include "pipeline_compiler.hpp"
+
+#include <exception>
+
+PipelineCompiler::~PipelineCompiler() {
+	Stop();
+}
+
+void PipelineCompiler::Start(vk::PipelineCache c) {
+	Stop();
+
+	cache = c;
+	stopping = false;
+	worker = std::thread(&PipelineCompiler::WorkerLoop, this);
+}
+
+void PipelineCompiler::Stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		tasks.clear();
+	}
+	condition.notify_all();
+
+	if (worker.joinable()) worker.join();
+}
+
+std::shared_ptr<PendingPipeline> PipelineCompiler::Submit(BuildFunction build) {
+	auto result = std::make_shared<PendingPipeline>();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back({ std::move(build), result });
+	}
+	condition.notify_one();
+
+	return result;
+}
+
+void PipelineCompiler::SetCompletionCallback(std::function<void()> callback) {
+	std::lock_guard<std::mutex> lock(mutex);
+	on_complete = std::move(callback);
+}
+
+size_t PipelineCompiler::QueuedCount() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return tasks.size();
+}
+
+void PipelineCompiler::WorkerLoop() {
+	while (true) {
+		Task task;
+		std::function<void()> callback;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+			if (stopping) return;
+
+			task = std::move(tasks.front());
+			tasks.pop_front();
+			callback = on_complete;
+		}
+
+		try {
+			task.result->pipeline = task.build(cache);
+		} catch (const std::exception& e) {
+			task.result->failed = true;
+			task.result->error = e.what();
+		}
+
+		task.result->ready.store(true, std::memory_order_release);
+
+		if (callback) callback();
+	}
+}
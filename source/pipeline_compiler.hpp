@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Result slot for a pipeline being built in the background. The worker fills
+// in `pipeline` (or `error`) and then sets `ready`; the render thread polls
+// `ready` and takes ownership of the pipeline once it is set.
+struct PendingPipeline {
+	std::atomic<bool> ready { false };
+
+	vk::Pipeline pipeline;
+	bool failed = false;
+	std::string error;
+};
+
+class PipelineCompiler {
+public:
+	using BuildFunction = std::function<vk::Pipeline(vk::PipelineCache)>;
+
+	PipelineCompiler() = default;
+	~PipelineCompiler();
+
+	PipelineCompiler(const PipelineCompiler&) = delete;
+	PipelineCompiler& operator=(const PipelineCompiler&) = delete;
+
+	// The cache is shared by every build; vkCreate*Pipelines synchronizes
+	// access to it internally, so no extra locking is needed here.
+	void Start(vk::PipelineCache cache);
+
+	// Joins the worker. Builds still queued are dropped and never become ready.
+	void Stop();
+
+	std::shared_ptr<PendingPipeline> Submit(BuildFunction build);
+
+	// Invoked on the worker thread after each build finishes
+	void SetCompletionCallback(std::function<void()>);
+
+	size_t QueuedCount();
+
+protected:
+	struct Task {
+		BuildFunction build;
+		std::shared_ptr<PendingPipeline> result;
+	};
+
+	vk::PipelineCache cache;
+	std::function<void()> on_complete;
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::deque<Task> tasks;
+	bool stopping = false;
+
+	void WorkerLoop();
+};
@@ -0,0 +1,105 @@
+#include "scene.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+const uint32_t Scene::no_parent;
+
+uint32_t Scene::Create(
+	const glm::mat4& local, MeshRef mesh, const Aabb& bounds,
+	uint32_t material, uint32_t parent
+) {
+	uint32_t object = (uint32_t) parents.size();
+
+	if (parent != no_parent && parent >= object) {
+		throw std::runtime_error("Scene parent must be created before its children");
+	}
+
+	local_transforms.push_back(local);
+	world_transforms.push_back(local);
+	mesh_bounds.push_back(bounds);
+	world_bounds.push_back(bounds);
+	meshes.push_back(mesh);
+	materials.push_back(material);
+
+	parents.push_back(parent);
+	first_children.push_back(no_parent);
+	next_siblings.push_back(no_parent);
+
+	if (parent != no_parent) {
+		next_siblings[object] = first_children[parent];
+		first_children[parent] = object;
+	}
+
+	// New objects are picked up by the next update like any other change
+	dirty.push_back(1);
+	dirty_objects.push_back(object);
+
+	return object;
+}
+
+void Scene::Clear() {
+	local_transforms.clear();
+	world_transforms.clear();
+	mesh_bounds.clear();
+	world_bounds.clear();
+	meshes.clear();
+	materials.clear();
+	parents.clear();
+	first_children.clear();
+	next_siblings.clear();
+	dirty.clear();
+	dirty_objects.clear();
+	changed.clear();
+}
+
+void Scene::SetLocalTransform(uint32_t object, const glm::mat4& local) {
+	local_transforms[object] = local;
+
+	if (!dirty[object]) {
+		dirty[object] = 1;
+		dirty_objects.push_back(object);
+	}
+}
+
+void Scene::UpdateWorld(uint32_t object) {
+	uint32_t parent = parents[object];
+
+	world_transforms[object] = parent == no_parent
+		? local_transforms[object]
+		: world_transforms[parent] * local_transforms[object];
+	world_bounds[object] = mesh_bounds[object].Transformed(world_transforms[object]);
+
+	changed.push_back(object);
+}
+
+const std::vector<uint32_t>& Scene::UpdateTransforms() {
+	changed.clear();
+
+	// Ancestors have lower ids, so in ascending order a dirty object's
+	// subtree is always recomputed before any dirty descendant is reached;
+	// those are cleared on the way and skipped.
+	std::sort(dirty_objects.begin(), dirty_objects.end());
+
+	for (uint32_t root : dirty_objects) {
+		if (!dirty[root]) continue;
+
+		stack.clear();
+		stack.push_back(root);
+
+		while (!stack.empty()) {
+			uint32_t object = stack.back();
+			stack.pop_back();
+
+			dirty[object] = 0;
+			UpdateWorld(object);
+
+			for (uint32_t child = first_children[object]; child != no_parent; child = next_siblings[child]) {
+				stack.push_back(child);
+			}
+		}
+	}
+
+	dirty_objects.clear();
+	return changed;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "bvh.hpp"
+
+// Range of the shared index buffer drawn for an object; an empty range
+// means the object only exists to carry a transform
+struct MeshRef {
+	uint32_t first_index = 0;
+	uint32_t index_count = 0;
+};
+
+// Scene objects stored as parallel arrays indexed by object id, so passes
+// that only need one component (world matrices for recording, bounds for
+// culling) stream through contiguous memory.
+//
+// Objects form a hierarchy; a parent always has a lower id than its
+// children. Changing a local transform only marks that object, and
+// UpdateTransforms() recomputes the world matrices of the marked subtrees
+// alone.
+class Scene {
+public:
+	static const uint32_t no_parent = UINT32_MAX;
+
+	uint32_t Create(
+		const glm::mat4& local, MeshRef mesh, const Aabb& mesh_bounds,
+		uint32_t material = 0, uint32_t parent = no_parent
+	);
+	void Clear();
+
+	void SetLocalTransform(uint32_t object, const glm::mat4& local);
+
+	// Brings world matrices and bounds up to date. Returns the objects
+	// whose world state changed, valid until the next call.
+	const std::vector<uint32_t>& UpdateTransforms();
+
+	size_t Size() const { return parents.size(); }
+
+	uint32_t GetParent(uint32_t object) const { return parents[object]; }
+	const glm::mat4& GetLocalTransform(uint32_t object) const { return local_transforms[object]; }
+	const glm::mat4& GetWorldTransform(uint32_t object) const { return world_transforms[object]; }
+	const Aabb& GetWorldBounds(uint32_t object) const { return world_bounds[object]; }
+	const MeshRef& GetMesh(uint32_t object) const { return meshes[object]; }
+	uint32_t GetMaterial(uint32_t object) const { return materials[object]; }
+
+	const std::vector<glm::mat4>& GetWorldTransforms() const { return world_transforms; }
+	const std::vector<Aabb>& GetWorldBounds() const { return world_bounds; }
+
+protected:
+	std::vector<glm::mat4> local_transforms;
+	std::vector<glm::mat4> world_transforms;
+	std::vector<Aabb> mesh_bounds;
+	std::vector<Aabb> world_bounds;
+	std::vector<MeshRef> meshes;
+	std::vector<uint32_t> materials;
+
+	// Hierarchy as intrusive child lists
+	std::vector<uint32_t> parents;
+	std::vector<uint32_t> first_children;
+	std::vector<uint32_t> next_siblings;
+
+	std::vector<uint8_t> dirty;
+	std::vector<uint32_t> dirty_objects;
+	std::vector<uint32_t> changed;
+	std::vector<uint32_t> stack;
+
+	void UpdateWorld(uint32_t object);
+};
@@ -0,0 +1,147 @@
+// Compares Scene::UpdateTransforms with a few dirty subtrees against
+// recomputing every world matrix, and checks that both give the same
+// matrices and bounds. Standalone: needs neither Vulkan nor a window.
+// Exits non-zero if any object differs.
+//
+//	make scene-benchmark
+//	./scene_benchmark [roots] [children per root] [moved percent]
+
+#include "scene.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const int repeats = 5;
+
+using Clock = chrono::steady_clock;
+
+double Milliseconds(Clock::time_point start) {
+	return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+// What UpdateTransforms has to agree with: every object recomputed in id
+// order, parents first
+void FullRecompute(const Scene& scene, vector<glm::mat4>& world) {
+	world.resize(scene.Size());
+	for (uint32_t object = 0; object < scene.Size(); object++) {
+		uint32_t parent = scene.GetParent(object);
+		world[object] = parent == Scene::no_parent
+			? scene.GetLocalTransform(object)
+			: world[parent] * scene.GetLocalTransform(object);
+	}
+}
+
+bool Matches(const Scene& scene, const vector<glm::mat4>& world, const Aabb& mesh_bounds) {
+	for (uint32_t object = 0; object < scene.Size(); object++) {
+		const Aabb& bounds = scene.GetWorldBounds(object);
+		Aabb expected = mesh_bounds.Transformed(world[object]);
+
+		if (scene.GetWorldTransform(object) != world[object]
+			|| bounds.min.x != expected.min.x || bounds.min.y != expected.min.y || bounds.min.z != expected.min.z
+			|| bounds.max.x != expected.max.x || bounds.max.y != expected.max.y || bounds.max.z != expected.max.z) {
+			cerr << "Object " << object << " differs from the full recompute" << endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+glm::mat4 Spin(float angle, const glm::vec3& offset) {
+	return glm::rotate(glm::translate(glm::mat4(), offset), angle, glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+}
+
+int main(int argc, char** argv) {
+	uint32_t roots = argc > 1 ? (uint32_t) strtoul(argv[1], nullptr, 10) : 10000;
+	uint32_t children = argc > 2 ? (uint32_t) strtoul(argv[2], nullptr, 10) : 9;
+	double moved_percent = argc > 3 ? strtod(argv[3], nullptr) : 1.0;
+	if (roots == 0 || moved_percent < 0.0 || moved_percent > 100.0) {
+		cerr << "Usage: " << argv[0] << " [roots] [children per root] [moved percent]" << endl;
+		return 1;
+	}
+
+	mt19937 random(1234);
+	uniform_real_distribution<float> position(-100.0f, 100.0f);
+	uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+
+	Aabb mesh_bounds = { glm::vec3(-0.5f), glm::vec3(0.5f) };
+
+	// Each root carries a small subtree, as a chain so the updates walk
+	// real parent links
+	Scene scene;
+	vector<uint32_t> root_ids;
+	for (uint32_t r = 0; r < roots; r++) {
+		glm::vec3 offset(position(random), position(random), position(random));
+		uint32_t parent = scene.Create(Spin(angle(random), offset), MeshRef(), mesh_bounds);
+		root_ids.push_back(parent);
+
+		for (uint32_t c = 0; c < children; c++) {
+			parent = scene.Create(Spin(angle(random), glm::vec3(1.0f, 0.0f, 0.0f)), MeshRef(), mesh_bounds, 0, parent);
+		}
+	}
+	scene.UpdateTransforms();
+
+	uint32_t moved = max((uint32_t) (roots * moved_percent / 100.0), 1u);
+	cout << scene.Size() << " objects, " << moved << " of " << roots
+		<< " subtrees moved, best of " << repeats << " runs" << endl;
+
+	vector<glm::mat4> world;
+	double incremental_ms = 1e30, full_ms = 1e30, all_dirty_ms = 1e30;
+	size_t changed = 0;
+	bool ok = true;
+
+	for (int r = 0; r < repeats && ok; r++) {
+		shuffle(root_ids.begin(), root_ids.end(), random);
+		for (uint32_t k = 0; k < moved; k++) {
+			uint32_t root = root_ids[k];
+			glm::mat4 local = scene.GetLocalTransform(root);
+			scene.SetLocalTransform(root, Spin(angle(random), glm::vec3(local[3])));
+		}
+
+		auto start = Clock::now();
+		changed = scene.UpdateTransforms().size();
+		incremental_ms = min(incremental_ms, Milliseconds(start));
+
+		start = Clock::now();
+		FullRecompute(scene, world);
+		full_ms = min(full_ms, Milliseconds(start));
+
+		ok = Matches(scene, world, mesh_bounds);
+
+		// The scene's own path with everything marked, for comparison
+		for (uint32_t object = 0; object < scene.Size(); object++) {
+			scene.SetLocalTransform(object, scene.GetLocalTransform(object));
+		}
+		start = Clock::now();
+		scene.UpdateTransforms();
+		all_dirty_ms = min(all_dirty_ms, Milliseconds(start));
+
+		ok = ok && Matches(scene, world, mesh_bounds);
+	}
+
+	if (!ok) {
+		cerr << "Scene::UpdateTransforms does not match the full recompute" << endl;
+		return 1;
+	}
+
+	cout << fixed << setprecision(3)
+		<< "dirty subtrees: " << changed << " objects, " << incremental_ms << " ms" << endl
+		<< "full recompute: " << full_ms << " ms (matrices only)" << endl
+		<< "all dirty:      " << all_dirty_ms << " ms" << endl
+		<< setprecision(1) << "speedup: " << all_dirty_ms / incremental_ms << "x" << endl;
+
+	return 0;
+}
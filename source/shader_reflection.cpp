@@ -0,0 +1,404 @@
+#include "shader_reflection.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+namespace {
+
+const uint32_t spirv_magic = 0x07230203;
+
+// The handful of opcodes, decorations and enums we look at; see the SPIR-V
+// specification for the full lists
+enum Op : uint32_t {
+	OpEntryPoint = 15,
+	OpTypeBool = 20,
+	OpTypeInt = 21,
+	OpTypeFloat = 22,
+	OpTypeVector = 23,
+	OpTypeMatrix = 24,
+	OpTypeImage = 25,
+	OpTypeSampler = 26,
+	OpTypeSampledImage = 27,
+	OpTypeArray = 28,
+	OpTypeRuntimeArray = 29,
+	OpTypeStruct = 30,
+	OpTypePointer = 32,
+	OpConstant = 43,
+	OpVariable = 59,
+	OpDecorate = 71,
+	OpMemberDecorate = 72
+};
+
+enum Decoration : uint32_t {
+	DecorationBlock = 2,
+	DecorationBufferBlock = 3,
+	DecorationArrayStride = 6,
+	DecorationMatrixStride = 7,
+	DecorationBuiltIn = 11,
+	DecorationLocation = 30,
+	DecorationBinding = 33,
+	DecorationDescriptorSet = 34,
+	DecorationOffset = 35
+};
+
+enum StorageClass : uint32_t {
+	StorageUniformConstant = 0,
+	StorageInput = 1,
+	StorageUniform = 2,
+	StoragePushConstant = 9,
+	StorageStorageBuffer = 12
+};
+
+const uint32_t dim_buffer = 5;
+const uint32_t dim_subpass_data = 6;
+
+struct Member {
+	uint32_t offset = 0;
+	uint32_t matrix_stride = 0;
+};
+
+// Everything known about one result id
+struct Id {
+	uint32_t opcode = 0;
+	std::vector<uint32_t> operands;		// the instruction's words after the result id
+
+	bool block = false;
+	bool buffer_block = false;
+	bool builtin = false;
+	bool has_location = false;
+	bool has_binding = false;
+	uint32_t location = 0;
+	uint32_t binding = 0;
+	uint32_t set = 0;
+	uint32_t array_stride = 0;
+	std::vector<Member> members;
+};
+
+class Parser {
+public:
+	explicit Parser(const std::vector<char>& code) {
+		if (code.size() < 20 || code.size() % 4 != 0) {
+			throw std::runtime_error("Shader is not SPIR-V");
+		}
+
+		words.resize(code.size() / 4);
+		memcpy(words.data(), code.data(), code.size());
+
+		if (words[0] != spirv_magic) throw std::runtime_error("Shader is not SPIR-V");
+	}
+
+	ShaderInterface Parse() {
+		ShaderInterface result;
+		vk::ShaderStageFlags stage;
+
+		// Instructions start after the five header words
+		for (size_t i = 5; i < words.size(); ) {
+			uint32_t count = words[i] >> 16;
+			uint32_t opcode = words[i] & 0xffff;
+			if (count == 0 || i + count > words.size()) throw std::runtime_error("Truncated SPIR-V");
+
+			const uint32_t* operands = &words[i + 1];
+			Record(opcode, operands, count - 1, stage);
+			i += count;
+		}
+
+		for (auto& entry : ids) {
+			const Id& variable = entry.second;
+			if (variable.opcode != OpVariable) continue;
+
+			uint32_t storage = variable.operands[1];
+			const Id& pointer = Get(variable.operands[0]);
+			const Id& type = Get(pointer.operands[1]);
+
+			switch (storage) {
+			case StorageUniformConstant:
+			case StorageUniform:
+			case StorageStorageBuffer:
+				AddBinding(result, variable, type, storage, stage);
+				break;
+
+			case StoragePushConstant:
+				result.push_constant_stages = stage;
+				result.push_constant_size = std::max(result.push_constant_size, SizeOf(type, 0));
+				break;
+
+			case StorageInput:
+				if (stage == vk::ShaderStageFlagBits::eVertex && variable.has_location && !variable.builtin) {
+					uint32_t locations = LocationCount(type);
+					for (uint32_t l = 0; l < locations; l++) {
+						result.input_locations.push_back(variable.location + l);
+					}
+				}
+				break;
+			}
+		}
+
+		std::sort(result.bindings.begin(), result.bindings.end(),
+			[](const ShaderBinding& a, const ShaderBinding& b) {
+				return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+			});
+		std::sort(result.input_locations.begin(), result.input_locations.end());
+
+		return result;
+	}
+
+protected:
+	std::vector<uint32_t> words;
+	std::unordered_map<uint32_t, Id> ids;
+
+	const Id& Get(uint32_t id) {
+		auto found = ids.find(id);
+		if (found == ids.end()) throw std::runtime_error("SPIR-V refers to an undefined id");
+		return found->second;
+	}
+
+	void Record(uint32_t opcode, const uint32_t* operands, uint32_t count, vk::ShaderStageFlags& stage) {
+		switch (opcode) {
+		case OpEntryPoint:
+			// A module with several entry points is taken as its first one
+			if (!stage) stage = StageOf(operands[0]);
+			break;
+
+		case OpDecorate: {
+			if (count < 2) break;
+			Id& target = ids[operands[0]];
+			uint32_t value = count > 2 ? operands[2] : 0;
+
+			switch (operands[1]) {
+			case DecorationBlock:			target.block = true; break;
+			case DecorationBufferBlock:		target.buffer_block = true; break;
+			case DecorationArrayStride:		target.array_stride = value; break;
+			case DecorationBuiltIn:			target.builtin = true; break;
+			case DecorationLocation:		target.has_location = true; target.location = value; break;
+			case DecorationBinding:			target.has_binding = true; target.binding = value; break;
+			case DecorationDescriptorSet:	target.set = value; break;
+			}
+			break;
+		}
+
+		case OpMemberDecorate: {
+			if (count < 4) break;
+			Id& target = ids[operands[0]];
+			uint32_t member = operands[1];
+			if (target.members.size() <= member) target.members.resize(member + 1);
+
+			if (operands[2] == DecorationOffset) target.members[member].offset = operands[3];
+			if (operands[2] == DecorationMatrixStride) target.members[member].matrix_stride = operands[3];
+			break;
+		}
+
+		case OpTypeBool:
+		case OpTypeInt:
+		case OpTypeFloat:
+		case OpTypeVector:
+		case OpTypeMatrix:
+		case OpTypeImage:
+		case OpTypeSampler:
+		case OpTypeSampledImage:
+		case OpTypeArray:
+		case OpTypeRuntimeArray:
+		case OpTypeStruct:
+		case OpTypePointer:
+			// Result id first
+			if (count < 1) break;
+			Store(operands[0], opcode, operands + 1, count - 1);
+			break;
+
+		case OpConstant:
+		case OpVariable:
+			// Result type, then result id
+			if (count < 2) break;
+			Store(operands[1], opcode, operands, count);
+			ids[operands[1]].operands.erase(ids[operands[1]].operands.begin() + 1);
+			break;
+		}
+	}
+
+	void Store(uint32_t id, uint32_t opcode, const uint32_t* operands, uint32_t count) {
+		Id& entry = ids[id];
+		entry.opcode = opcode;
+		entry.operands.assign(operands, operands + count);
+	}
+
+	static vk::ShaderStageFlags StageOf(uint32_t execution_model) {
+		switch (execution_model) {
+		case 0: return vk::ShaderStageFlagBits::eVertex;
+		case 1: return vk::ShaderStageFlagBits::eTessellationControl;
+		case 2: return vk::ShaderStageFlagBits::eTessellationEvaluation;
+		case 3: return vk::ShaderStageFlagBits::eGeometry;
+		case 4: return vk::ShaderStageFlagBits::eFragment;
+		case 5: return vk::ShaderStageFlagBits::eCompute;
+		}
+		throw std::runtime_error("Unsupported shader stage in SPIR-V");
+	}
+
+	uint32_t ConstantValue(uint32_t id) {
+		const Id& constant = Get(id);
+		if (constant.opcode != OpConstant || constant.operands.size() < 2) {
+			throw std::runtime_error("SPIR-V array length is not a plain constant");
+		}
+		return constant.operands[1];
+	}
+
+	void AddBinding(
+		ShaderInterface& result, const Id& variable, const Id& declared,
+		uint32_t storage, vk::ShaderStageFlags stage
+	) {
+		ShaderBinding binding;
+		binding.set = variable.set;
+		binding.binding = variable.binding;
+		binding.stages = stage;
+
+		// Arrays of descriptors are one binding with a count
+		const Id* type = &declared;
+		if (type->opcode == OpTypeArray) {
+			binding.count = ConstantValue(type->operands[1]);
+			type = &Get(type->operands[0]);
+		} else if (type->opcode == OpTypeRuntimeArray) {
+			throw std::runtime_error("Runtime-sized descriptor arrays are not supported");
+		}
+
+		if (storage == StorageStorageBuffer || (storage == StorageUniform && type->buffer_block)) {
+			binding.type = vk::DescriptorType::eStorageBuffer;
+		} else if (storage == StorageUniform) {
+			binding.type = vk::DescriptorType::eUniformBuffer;
+		} else if (type->opcode == OpTypeSampledImage) {
+			binding.type = vk::DescriptorType::eCombinedImageSampler;
+		} else if (type->opcode == OpTypeSampler) {
+			binding.type = vk::DescriptorType::eSampler;
+		} else if (type->opcode == OpTypeImage) {
+			// Sampled type, dim, depth, arrayed, multisampled, sampled
+			uint32_t dim = type->operands[1];
+			bool storage_image = type->operands[5] == 2;
+
+			if (dim == dim_buffer) {
+				binding.type = storage_image ? vk::DescriptorType::eStorageTexelBuffer : vk::DescriptorType::eUniformTexelBuffer;
+			} else if (dim == dim_subpass_data) {
+				binding.type = vk::DescriptorType::eInputAttachment;
+			} else {
+				binding.type = storage_image ? vk::DescriptorType::eStorageImage : vk::DescriptorType::eSampledImage;
+			}
+		} else {
+			throw std::runtime_error("Unsupported descriptor type in SPIR-V");
+		}
+
+		result.bindings.push_back(binding);
+	}
+
+	// Bytes taken by a type in a block; `matrix_stride` comes from the
+	// member holding it
+	uint32_t SizeOf(const Id& type, uint32_t matrix_stride) {
+		switch (type.opcode) {
+		case OpTypeBool:
+			return 4;
+
+		case OpTypeInt:
+		case OpTypeFloat:
+			return type.operands[0] / 8;
+
+		case OpTypeVector:
+			return type.operands[1] * SizeOf(Get(type.operands[0]), 0);
+
+		case OpTypeMatrix: {
+			uint32_t column = SizeOf(Get(type.operands[0]), 0);
+			return type.operands[1] * std::max(matrix_stride, column);
+		}
+
+		case OpTypeArray: {
+			uint32_t length = ConstantValue(type.operands[1]);
+			uint32_t stride = type.array_stride ? type.array_stride : SizeOf(Get(type.operands[0]), matrix_stride);
+			return length * stride;
+		}
+
+		case OpTypeStruct: {
+			uint32_t size = 0;
+			for (size_t m = 0; m < type.operands.size(); m++) {
+				Member member = m < type.members.size() ? type.members[m] : Member();
+				size = std::max(size, member.offset + SizeOf(Get(type.operands[m]), member.matrix_stride));
+			}
+			return size;
+		}
+		}
+
+		return 0;
+	}
+
+	uint32_t LocationCount(const Id& type) {
+		switch (type.opcode) {
+		case OpTypeMatrix:
+			return type.operands[1];
+
+		case OpTypeArray:
+			return ConstantValue(type.operands[1]) * LocationCount(Get(type.operands[0]));
+
+		case OpTypeVector: {
+			// 64-bit three and four component vectors take two locations
+			const Id& component = Get(type.operands[0]);
+			bool wide = !component.operands.empty() && component.operands[0] == 64 && type.operands[1] > 2;
+			return wide ? 2 : 1;
+		}
+		}
+
+		return 1;
+	}
+};
+
+}
+
+ShaderInterface ShaderInterface::Reflect(const std::vector<char>& code) {
+	return Parser(code).Parse();
+}
+
+void ShaderInterface::Merge(const ShaderInterface& other) {
+	for (const ShaderBinding& binding : other.bindings) {
+		auto existing = std::find_if(bindings.begin(), bindings.end(),
+			[&](const ShaderBinding& b) { return b.set == binding.set && b.binding == binding.binding; });
+
+		if (existing == bindings.end()) {
+			bindings.push_back(binding);
+		} else if (existing->type != binding.type || existing->count != binding.count) {
+			throw std::runtime_error(
+				"Shader stages disagree about set " + std::to_string(binding.set) +
+				", binding " + std::to_string(binding.binding));
+		} else {
+			existing->stages |= binding.stages;
+		}
+	}
+
+	std::sort(bindings.begin(), bindings.end(),
+		[](const ShaderBinding& a, const ShaderBinding& b) {
+			return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+		});
+
+	if (other.push_constant_size > 0) {
+		push_constant_stages |= other.push_constant_stages;
+		push_constant_size = std::max(push_constant_size, other.push_constant_size);
+	}
+
+	input_locations.insert(input_locations.end(), other.input_locations.begin(), other.input_locations.end());
+	std::sort(input_locations.begin(), input_locations.end());
+	input_locations.erase(std::unique(input_locations.begin(), input_locations.end()), input_locations.end());
+}
+
+uint32_t ShaderInterface::GetSetCount() const {
+	return bindings.empty() ? 0 : bindings.back().set + 1;
+}
+
+std::vector<vk::DescriptorSetLayoutBinding> ShaderInterface::GetSetBindings(uint32_t set) const {
+	std::vector<vk::DescriptorSetLayoutBinding> result;
+
+	for (const ShaderBinding& binding : bindings) {
+		if (binding.set != set) continue;
+
+		result.push_back(vk::DescriptorSetLayoutBinding()
+		.setBinding(binding.binding)
+		.setDescriptorType(binding.type)
+		.setDescriptorCount(binding.count)
+		.setStageFlags(binding.stages));
+	}
+
+	return result;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// One descriptor a shader declares
+struct ShaderBinding {
+	uint32_t				set = 0;
+	uint32_t				binding = 0;
+	vk::DescriptorType		type = vk::DescriptorType::eUniformBuffer;
+	uint32_t				count = 1;
+	vk::ShaderStageFlags	stages;
+};
+
+// What a pipeline's shaders expect from their layout and vertex input,
+// read straight from the SPIR-V. Only the parts of the format this needs
+// are parsed: decorations, types, constants and interface variables.
+//
+// Merging the interfaces of every stage of a pipeline gives its layout;
+// bindings that appear in several stages get the union of their stages.
+struct ShaderInterface {
+	std::vector<ShaderBinding>	bindings;	// sorted by set, then binding
+
+	vk::ShaderStageFlags		push_constant_stages;
+	uint32_t					push_constant_size = 0;
+
+	// Locations the vertex stage reads; a matrix takes one per column
+	std::vector<uint32_t>		input_locations;
+
+	// Throws if the code is not SPIR-V or uses a descriptor kind we do not
+	// know how to describe
+	static ShaderInterface Reflect(const std::vector<char>& code);
+
+	// Throws if both declare the same binding with different types
+	void Merge(const ShaderInterface&);
+
+	// One past the highest set used
+	uint32_t GetSetCount() const;
+	std::vector<vk::DescriptorSetLayoutBinding> GetSetBindings(uint32_t set) const;
+};
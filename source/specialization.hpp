@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// Specialization constants for one pipeline, held by value so they can be
+// copied to the compiler thread along with the rest of the description.
+//
+// A variant is a plain struct whose members are the shader's constants in
+// constant_id order, so toggles can be written as ordinary (constexpr)
+// values and the driver compiles the branches they switch off away:
+//
+//	struct Variant { VkBool32 fog = VK_TRUE; float fog_density = 0.1f; };
+//	desc.specialization = ShaderSpecialization::From(Variant());
+//
+// with `layout(constant_id = 0) const bool FOG` and
+// `layout(constant_id = 1) const float FOG_DENSITY` in the shader.
+struct ShaderSpecialization {
+	std::vector<vk::SpecializationMapEntry>	entries;
+	std::vector<uint8_t>					data;
+
+	// Member i of `variant` becomes constant_id i. Every member has to be a
+	// 32-bit scalar, which is what GLSL bool, int, uint and float constants
+	// read; use VkBool32 rather than bool.
+	template <typename T>
+	static ShaderSpecialization From(const T& variant) {
+		static_assert(std::is_standard_layout<T>::value && std::is_trivially_copyable<T>::value,
+			"Specialization variants must be plain structs");
+		static_assert(sizeof(T) % 4 == 0 && alignof(T) == 4,
+			"Specialization variants may only hold 32-bit scalars");
+
+		ShaderSpecialization specialization;
+		specialization.data.resize(sizeof(T));
+		memcpy(specialization.data.data(), &variant, sizeof(T));
+
+		for (uint32_t id = 0; id < sizeof(T) / 4; id++) {
+			specialization.entries.push_back(vk::SpecializationMapEntry(id, id * 4, 4));
+		}
+
+		return specialization;
+	}
+
+	bool Empty() const {
+		return entries.empty();
+	}
+
+	// Points into this object, so it is only valid while that is unchanged
+	vk::SpecializationInfo GetInfo() const {
+		return vk::SpecializationInfo()
+		.setMapEntryCount((uint32_t) entries.size())
+		.setPMapEntries(entries.data())
+		.setDataSize(data.size())
+		.setPData(data.data());
+	}
+};
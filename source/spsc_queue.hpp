@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Push and Pop never block or allocate; the producer owns `tail`,
+// the consumer owns `head`, and each only reads the other's index.
+//
+// The capacity is rounded up to a power of two so positions wrap with a
+// mask. Indices grow without bound and are only masked on access, which
+// keeps full and empty distinguishable without a spare slot.
+template <typename T>
+class SpscQueue {
+public:
+	explicit SpscQueue(size_t capacity = 256) {
+		size_t size = 1;
+		while (size < capacity) size *= 2;
+
+		slots.reset(new T[size]);
+		mask = size - 1;
+	}
+
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator=(const SpscQueue&) = delete;
+
+	// Producer only. False when the queue is full.
+	bool Push(const T& value) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) > mask) return false;
+
+		slots[t & mask] = value;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer only. False when the queue is empty.
+	bool Pop(T& value) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) return false;
+
+		value = slots[h & mask];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Empty() const {
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+
+	size_t Capacity() const { return mask + 1; }
+
+protected:
+	std::unique_ptr<T[]> slots;
+	size_t mask;
+
+	// On separate cache lines so the two threads do not false-share
+	alignas(64) std::atomic<size_t> head { 0 };
+	alignas(64) std::atomic<size_t> tail { 0 };
+};
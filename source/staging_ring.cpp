@@ -0,0 +1,82 @@
+#include "staging_ring.hpp"
+
+void StagingRing::Init(
+	vk::Device d, vk::Buffer b, vk::DeviceMemory m, vk::DeviceSize s
+) {
+	device	= d;
+	buffer	= b;
+	memory	= m;
+	size	= s;
+
+	mapped = (char*) device.mapMemory(memory, 0, size, {});
+
+	head = tail = 0;
+	full = false;
+	batches.clear();
+}
+
+void StagingRing::Destroy() {
+	if (mapped) device.unmapMemory(memory);
+	mapped = nullptr;
+}
+
+bool StagingRing::Allocate(
+	vk::DeviceSize bytes, vk::DeviceSize alignment,
+	vk::DeviceSize& offset, void*& data
+) {
+	if (bytes > size || full) return false;
+
+	vk::DeviceSize start = (head + alignment - 1) / alignment * alignment;
+	bool empty = head == tail;
+
+	if (head >= tail) {
+		// Free space is [head, size) followed by [0, tail)
+		if (start + bytes > size) {
+			if (bytes > tail && !empty) return false;
+			if (empty) tail = 0;
+			start = 0;
+		}
+	} else if (start + bytes > tail) {
+		return false;
+	}
+
+	offset = start;
+	data = mapped + start;
+
+	head = start + bytes;
+	if (head == size) head = 0;
+	full = head == tail;
+
+	return true;
+}
+
+StagingRing::Marker StagingRing::Submit() {
+	batches.push_back(head);
+	return head;
+}
+
+void StagingRing::Retire(Marker marker) {
+	// Batches complete in submission order, so everything up to and
+	// including this one is free again
+	while (!batches.empty()) {
+		Marker front = batches.front();
+		batches.pop_front();
+
+		tail = front;
+		full = false;
+
+		if (front == marker) break;
+	}
+
+	if (batches.empty() && tail == head) {
+		head = tail = 0;
+	}
+}
+
+vk::Buffer StagingRing::GetBuffer() const {
+	return buffer;
+}
+
+vk::DeviceSize StagingRing::GetSize() const {
+	return size;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <deque>
+
+// Ring allocator over a persistently mapped, host-visible staging buffer.
+// Uploads carve their source data out of the ring, and each submitted batch
+// is released again (in submission order) once its fence has signaled.
+class StagingRing {
+public:
+	// Position of the write head after a batch; released through Retire()
+	using Marker = vk::DeviceSize;
+
+	void Init(vk::Device, vk::Buffer, vk::DeviceMemory, vk::DeviceSize size);
+	void Destroy();
+
+	// Returns false if there is no room until earlier batches are retired
+	bool Allocate(
+		vk::DeviceSize size, vk::DeviceSize alignment,
+		vk::DeviceSize& offset, void*& data
+	);
+
+	// Closes the current batch; the marker must be retired when it completes
+	Marker Submit();
+	void Retire(Marker);
+
+	vk::Buffer GetBuffer() const;
+	vk::DeviceSize GetSize() const;
+
+protected:
+	vk::Device device;
+	vk::Buffer buffer;
+	vk::DeviceMemory memory;
+	vk::DeviceSize size = 0;
+	char* mapped = nullptr;
+
+	// Allocations live in [tail, head), wrapping around the end of the buffer
+	vk::DeviceSize head = 0;
+	vk::DeviceSize tail = 0;
+	bool full = false;
+
+	std::deque<Marker> batches;
+};
@@ -0,0 +1,116 @@
+#include "texture_loader.hpp"
+#include "bc_encoder.hpp"
+#include "ktx.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+TextureLoader::~TextureLoader() {
+	Stop();
+}
+
+void TextureLoader::Start(JobSystem& job_system) {
+	Stop();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	jobs = &job_system;
+	stopping = false;
+}
+
+void TextureLoader::Stop() {
+	std::vector<JobSystem::Handle> tasks;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		tasks.swap(in_flight);
+	}
+
+	// The tasks hold on to `this`; ones that have not started return
+	// straight away
+	for (auto& task : tasks) jobs->Wait(task);
+}
+
+std::shared_ptr<PendingImage> TextureLoader::Load(const std::string& path) {
+	auto result = std::make_shared<PendingImage>();
+	result->path = path;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!jobs || stopping) {
+		result->failed = true;
+		result->error = "Texture loader is not running";
+		result->ready.store(true, std::memory_order_release);
+		return result;
+	}
+
+	// Finished loads are only forgotten here, so Stop() has less to wait on
+	in_flight.erase(
+		std::remove_if(in_flight.begin(), in_flight.end(),
+			[](const JobSystem::Handle& task) { return task->done.load(); }),
+		in_flight.end()
+	);
+	in_flight.push_back(jobs->Submit([this, result] { Run(*result); }));
+
+	return result;
+}
+
+void TextureLoader::SetCompletionCallback(std::function<void()> callback) {
+	std::lock_guard<std::mutex> lock(mutex);
+	on_complete = std::move(callback);
+}
+
+void TextureLoader::SetCompression(bool enabled) {
+	compress = enabled;
+}
+
+ImageData TextureLoader::Decode(const std::string& path) {
+	int width, height, channels;
+	stbi_uc* pixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+
+	if (!pixels) {
+		throw std::runtime_error("Failed to load image " + path + ": " + stbi_failure_reason());
+	}
+
+	ImageData image;
+	size_t size = LevelBytes(BlockFormat::RGBA8, width, height);
+	memcpy(image.AddLevel(width, height, size), pixels, size);
+
+	stbi_image_free(pixels);
+	return image;
+}
+
+void TextureLoader::Run(PendingImage& request) {
+	if (stopping) return;
+
+	try {
+		const std::string& path = request.path;
+		bool is_ktx = path.size() >= 4 && path.compare(path.size() - 4, 4, ".ktx") == 0;
+
+		ImageData image = is_ktx ? LoadKtx(path) : Decode(path);
+
+		// Compression fans out over the same pool; waiting on it from
+		// inside this task runs other tasks meanwhile
+		if (compress && image.format == BlockFormat::RGBA8) {
+			BlockFormat format = HasAlpha(image) ? BlockFormat::BC3 : BlockFormat::BC1;
+			image = CompressImage(image, format, jobs);
+		}
+
+		request.image = std::move(image);
+	} catch (const std::exception& e) {
+		request.failed = true;
+		request.error = e.what();
+	}
+
+	request.ready.store(true, std::memory_order_release);
+
+	std::function<void()> callback;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		callback = on_complete;
+	}
+	if (callback) callback();
+}
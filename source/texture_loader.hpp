@@ -0,0 +1,62 @@
+#pragma once
+
+#include "image_data.hpp"
+#include "job_system.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Result slot for an image being decoded in the background; same contract
+// as PendingPipeline: check `ready`, then either `failed` or `image`.
+struct PendingImage {
+	std::atomic<bool> ready { false };
+
+	std::string path;
+	ImageData image;
+	bool failed = false;
+	std::string error;
+};
+
+// Reads and decodes image files as tasks on the job system so the frame
+// loop only ever sees finished pixel data. KTX files are taken as they
+// are; other images are decoded to RGBA8 and, with compression enabled,
+// encoded to BC1 (opaque) or BC3 (with alpha) together with their mip
+// chain. Several images load in parallel and may finish in any order.
+class TextureLoader {
+public:
+	TextureLoader() = default;
+	~TextureLoader();
+
+	TextureLoader(const TextureLoader&) = delete;
+	TextureLoader& operator=(const TextureLoader&) = delete;
+
+	// `jobs` runs the decoding and block compression, and must outlive
+	// Stop(). Loads requested before Start() fail.
+	void Start(JobSystem& jobs);
+	// Skips loads that have not started yet and waits for the rest
+	void Stop();
+
+	std::shared_ptr<PendingImage> Load(const std::string& path);
+
+	// Invoked on the job system's thread after each image finishes
+	void SetCompletionCallback(std::function<void()>);
+
+	void SetCompression(bool enabled);
+
+	static ImageData Decode(const std::string& path);
+
+protected:
+	std::mutex mutex;
+	std::vector<JobSystem::Handle> in_flight;
+	std::function<void()> on_complete;
+	std::atomic<bool> compress { false };
+	std::atomic<bool> stopping { false };
+	JobSystem* jobs = nullptr;
+
+	void Run(PendingImage& request);
+};
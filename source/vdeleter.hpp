@@ -17,20 +17,21 @@ void DestroyDebugReportCallbackEXT(
 template <typename T>
 class VDeleter {
 public:
-	VDeleter() : VDeleter([](T, VkAllocationCallbacks*) {}) {}
+	VDeleter() : VDeleter([](T, const VkAllocationCallbacks*) {}) {}
 	//VDeleter() : VDeleter([](T, vk::AllocationCallbacks*) {}) {}
 
-	VDeleter(std::function<void(T, VkAllocationCallbacks*)> deletef) {
+	// `allocator` must match the one the object was created with
+	VDeleter(std::function<void(T, const VkAllocationCallbacks*)> deletef, const VkAllocationCallbacks* allocator = nullptr) {
 	//VDeleter(std::function<void(T, vk::AllocationCallbacks*)> deletef) {
-		this->deleter = [=](T obj) { deletef(obj, nullptr); };
+		this->deleter = [=](T obj) { deletef(obj, allocator); };
 	}
 
-	VDeleter(const VDeleter<VkInstance>& instance, std::function<void(VkInstance, T, VkAllocationCallbacks*)> deletef) {
-		this->deleter = [&instance, deletef](T obj) { deletef(instance, obj, nullptr); };
+	VDeleter(const VDeleter<VkInstance>& instance, std::function<void(VkInstance, T, const VkAllocationCallbacks*)> deletef, const VkAllocationCallbacks* allocator = nullptr) {
+		this->deleter = [&instance, deletef, allocator](T obj) { deletef(instance, obj, allocator); };
 	}
 
-	VDeleter(const VDeleter<VkDevice>& device, std::function<void(VkDevice, T, VkAllocationCallbacks*)> deletef) {
-		this->deleter = [&device, deletef](T obj) { deletef(device, obj, nullptr); };
+	VDeleter(const VDeleter<VkDevice>& device, std::function<void(VkDevice, T, const VkAllocationCallbacks*)> deletef, const VkAllocationCallbacks* allocator = nullptr) {
+		this->deleter = [&device, deletef, allocator](T obj) { deletef(device, obj, allocator); };
 	}
 
 	~VDeleter() {
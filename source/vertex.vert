@@ -7,16 +7,43 @@ layout(binding = 0) uniform UniformBufferObject {
 	mat4 proj;
 } ubo;
 
-layout(location = 0) in vec2 in_position;
+layout(push_constant) uniform PushConstants {
+	mat4 model;
+} push;
+
+// Feature toggles, one pipeline per combination (SceneVariant in
+// vk_app.hpp); whatever a variant switches off is compiled out
+layout(constant_id = 0) const bool VERTEX_COLOR = true;
+layout(constant_id = 1) const bool INSTANCED = false;
+layout(constant_id = 2) const bool QUANTIZED = false;
+layout(constant_id = 3) const float POSITION_SCALE = 1.0;
+
+layout(location = 0) in vec3 in_position;
 layout(location = 1) in vec3 in_color;
+layout(location = 2) in vec2 in_tex_coord;
+layout(location = 3) in mat4 in_instance_model;	// locations 3 to 6
 
 layout(location = 0) out vec3 frag_color;
+layout(location = 1) out vec2 frag_tex_coord;
+layout(location = 2) out vec3 frag_world_position;	// read by gbuffer.frag only
 
 out gl_PerVertex {
 	vec4 gl_Position;
 };
 
+// The depth prepass and the shading pass must agree bit for bit for the
+// equal depth test to pass
+invariant gl_Position;
+
 void main() {
-	gl_Position = ubo.proj * ubo.view * ubo.model * vec4(in_position, 0.0, 1.0);
-	frag_color = in_color;
+	// Quantized positions arrive in [-1, 1] from the snorm fetch
+	vec3 position = QUANTIZED ? in_position * POSITION_SCALE : in_position;
+	mat4 model = INSTANCED ? in_instance_model : push.model;
+
+	vec4 world_position = ubo.model * model * vec4(position, 1.0);
+
+	gl_Position = ubo.proj * ubo.view * world_position;
+	frag_world_position = world_position.xyz;
+	frag_color = VERTEX_COLOR ? in_color : vec3(1.0);
+	frag_tex_coord = in_tex_coord;
 }
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+// Vertex input descriptions derived from a vertex struct's members at
+// compile time. A layout lists the members in shader location order:
+//
+//	using Layout = VertexLayout<Vertex, 0, VK_VERTEX_INPUT_RATE_VERTEX, 0,
+//		VERTEX_MEMBER(Vertex, pos), VERTEX_MEMBER(Vertex, uv)>;
+//
+// and each member's format and location count follow from its type
+// (VertexFormat below). Every byte of the struct has to be covered, so a
+// member added to the struct but not to its layout fails to compile.
+
+// Packed attributes that are decoded by the vertex fetch; the shader sees
+// floats (or ints for the integer formats)
+template <typename T, size_t N, VkFormat F>
+struct PackedVector {
+	T v[N];
+
+	T& operator[](size_t i) { return v[i]; }
+	const T& operator[](size_t i) const { return v[i]; }
+};
+
+using Snorm16x2 = PackedVector<int16_t, 2, VK_FORMAT_R16G16_SNORM>;
+using Snorm16x4 = PackedVector<int16_t, 4, VK_FORMAT_R16G16B16A16_SNORM>;
+using Unorm16x2 = PackedVector<uint16_t, 2, VK_FORMAT_R16G16_UNORM>;
+using Unorm16x4 = PackedVector<uint16_t, 4, VK_FORMAT_R16G16B16A16_UNORM>;
+using Snorm8x4 = PackedVector<int8_t, 4, VK_FORMAT_R8G8B8A8_SNORM>;
+using Unorm8x4 = PackedVector<uint8_t, 4, VK_FORMAT_R8G8B8A8_UNORM>;
+using Half2 = PackedVector<uint16_t, 2, VK_FORMAT_R16G16_SFLOAT>;		// IEEE half bits
+using Half4 = PackedVector<uint16_t, 4, VK_FORMAT_R16G16B16A16_SFLOAT>;
+
+// Format of a member type, and how many locations it takes: matrices take
+// one per column, `stride` bytes apart
+template <typename T>
+struct VertexFormat;
+
+template <VkFormat F, uint32_t Columns = 1, uint32_t Stride = 0>
+struct VertexFormatOf {
+	static constexpr VkFormat format = F;
+	static constexpr uint32_t columns = Columns;
+	static constexpr uint32_t stride = Stride;
+};
+
+template <> struct VertexFormat<float>		: VertexFormatOf<VK_FORMAT_R32_SFLOAT> {};
+template <> struct VertexFormat<glm::vec2>	: VertexFormatOf<VK_FORMAT_R32G32_SFLOAT> {};
+template <> struct VertexFormat<glm::vec3>	: VertexFormatOf<VK_FORMAT_R32G32B32_SFLOAT> {};
+template <> struct VertexFormat<glm::vec4>	: VertexFormatOf<VK_FORMAT_R32G32B32A32_SFLOAT> {};
+template <> struct VertexFormat<int32_t>	: VertexFormatOf<VK_FORMAT_R32_SINT> {};
+template <> struct VertexFormat<glm::ivec2>	: VertexFormatOf<VK_FORMAT_R32G32_SINT> {};
+template <> struct VertexFormat<glm::ivec3>	: VertexFormatOf<VK_FORMAT_R32G32B32_SINT> {};
+template <> struct VertexFormat<glm::ivec4>	: VertexFormatOf<VK_FORMAT_R32G32B32A32_SINT> {};
+template <> struct VertexFormat<uint32_t>	: VertexFormatOf<VK_FORMAT_R32_UINT> {};
+template <> struct VertexFormat<glm::uvec2>	: VertexFormatOf<VK_FORMAT_R32G32_UINT> {};
+template <> struct VertexFormat<glm::uvec3>	: VertexFormatOf<VK_FORMAT_R32G32B32_UINT> {};
+template <> struct VertexFormat<glm::uvec4>	: VertexFormatOf<VK_FORMAT_R32G32B32A32_UINT> {};
+template <> struct VertexFormat<float[2]>	: VertexFormatOf<VK_FORMAT_R32G32_SFLOAT> {};
+template <> struct VertexFormat<float[3]>	: VertexFormatOf<VK_FORMAT_R32G32B32_SFLOAT> {};
+template <> struct VertexFormat<float[4]>	: VertexFormatOf<VK_FORMAT_R32G32B32A32_SFLOAT> {};
+template <> struct VertexFormat<glm::mat3>	: VertexFormatOf<VK_FORMAT_R32G32B32_SFLOAT, 3, sizeof(glm::vec3)> {};
+template <> struct VertexFormat<glm::mat4>	: VertexFormatOf<VK_FORMAT_R32G32B32A32_SFLOAT, 4, sizeof(glm::vec4)> {};
+
+template <typename T, size_t N, VkFormat F>
+struct VertexFormat<PackedVector<T, N, F>> : VertexFormatOf<F> {};
+
+// One member of a vertex struct, read as `Type`
+template <typename Type, size_t Offset>
+struct VertexMember {
+	using type = Type;
+	static constexpr uint32_t offset = (uint32_t) Offset;
+	static constexpr uint32_t size = (uint32_t) sizeof(Type);
+};
+
+#define VERTEX_MEMBER(Struct, member) \
+	VertexMember<decltype(Struct::member), offsetof(Struct, member)>
+
+// For members stored as one type but read as another of the same size,
+// e.g. a uint32_t holding four unorm bytes
+#define VERTEX_MEMBER_AS(Struct, member, Type) \
+	VertexMember<Type, offsetof(Struct, member)>
+
+constexpr uint32_t VertexLayoutSum(std::initializer_list<uint32_t> values) {
+	uint32_t sum = 0;
+	for (uint32_t value : values) sum += value;
+	return sum;
+}
+
+template <typename Vertex, uint32_t Binding, VkVertexInputRate Rate, uint32_t FirstLocation, typename... Members>
+class VertexLayout {
+public:
+	static constexpr uint32_t binding = Binding;
+	static constexpr uint32_t first_location = FirstLocation;
+	static constexpr uint32_t attribute_count = VertexLayoutSum({ VertexFormat<typename Members::type>::columns... });
+	// Where the next binding's attributes start
+	static constexpr uint32_t next_location = FirstLocation + attribute_count;
+
+	static_assert(VertexLayoutSum({ Members::size... }) == sizeof(Vertex),
+		"Vertex layout does not cover every member of the vertex");
+
+	using Attributes = std::array<VkVertexInputAttributeDescription, attribute_count>;
+
+	static constexpr VkVertexInputBindingDescription GetBinding() {
+		return { Binding, (uint32_t) sizeof(Vertex), Rate };
+	}
+
+	static constexpr Attributes GetAttributes() {
+		const VkFormat formats[] = { VertexFormat<typename Members::type>::format... };
+		const uint32_t columns[] = { VertexFormat<typename Members::type>::columns... };
+		const uint32_t strides[] = { VertexFormat<typename Members::type>::stride... };
+		const uint32_t offsets[] = { Members::offset... };
+
+		Attributes attributes = {};
+		uint32_t location = FirstLocation;
+		size_t index = 0;
+
+		for (size_t member = 0; member < sizeof...(Members); member++) {
+			for (uint32_t column = 0; column < columns[member]; column++) {
+				// std::array's non-const operator[] is not constexpr until C++17
+				VkVertexInputAttributeDescription& attribute =
+					const_cast<VkVertexInputAttributeDescription&>(static_cast<const Attributes&>(attributes)[index++]);
+
+				attribute.location = location++;
+				attribute.binding = Binding;
+				attribute.format = formats[member];
+				attribute.offset = offsets[member] + column * strides[member];
+			}
+		}
+
+		return attributes;
+	}
+
+	// Adds this layout's binding and attributes to a pipeline's vertex input
+	static void AppendTo(
+		std::vector<vk::VertexInputBindingDescription>& bindings,
+		std::vector<vk::VertexInputAttributeDescription>& attributes
+	) {
+		bindings.push_back(GetBinding());
+		for (const auto& attribute : GetAttributes()) attributes.push_back(attribute);
+	}
+};
@@ -1,4 +1,5 @@
 #include "vk_app.hpp"
+#include "alloc_counter.hpp"
 
 #include <iostream>
 #include <fstream>
@@ -8,8 +9,11 @@
 #include <vector>
 #include <set>
 
-#include <thread>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <thread>
 
 using std::string;
 using std::vector;
@@ -18,9 +22,7 @@ using std::cout;
 using std::endl;
 
 VkApp::VkApp(string t, uint32_t w, uint32_t h, bool enable_validation) {
-	title	= t;
-	width	= w;
-	height	= h;
+	AddWindow(t, w, h);
 
 	deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 	validationLayers.push_back("VK_LAYER_LUNARG_standard_validation");
@@ -30,9 +32,26 @@ VkApp::VkApp(string t, uint32_t w, uint32_t h, bool enable_validation) {
 	#else
 	validation_enabled = true;
 	#endif
+
+	RegisterMetrics();
+}
+
+void VkApp::AddWindow(const string& title, uint32_t width, uint32_t height) {
+	std::unique_ptr<Output> output(new Output());
+	output->app = this;
+	output->index = (uint32_t) outputs.size();
+	output->title = title;
+	output->width = width;
+	output->height = height;
+
+	outputs.push_back(std::move(output));
 }
 
 void VkApp::Run() {
+	job_system.Start();
+	if (!capture_directory.empty()) capture_writer.Start(capture_directory);
+	if (!metrics_path.empty()) metrics_exporter.Start(metrics, metrics_path);
+
 	InitWindow();
 	InitVulkan();
 
@@ -48,83 +67,331 @@ void VkApp::InitWindow() {
 	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 	//glfwWindowHint(GLFW_REFRESH_RATE, 60);
 
-	window = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr);
+	for (auto& output : outputs) {
+		GLFWwindow* window = glfwCreateWindow(
+			output->width, output->height, output->title.c_str(), nullptr, nullptr
+		);
+		output->window = window;
+
+		glfwSetWindowUserPointer(window, output.get());
+		glfwSetWindowSizeCallback(window, VkApp::OnWindowResized);
+		glfwSetWindowIconifyCallback(window, VkApp::OnWindowIconified);
+		glfwSetWindowRefreshCallback(window, VkApp::OnWindowRefresh);
+		glfwSetKeyCallback(window, VkApp::OnKey);
+	}
 
-	glfwSetWindowUserPointer(window, this);
-	glfwSetWindowSizeCallback(window, VkApp::OnWindowResized);
+	SetTargetFrameRate(target_frame_rate);
 }
 
 void VkApp::MainLoop() {
-	using namespace std::chrono_literals;
+	// This thread only turns window events into messages; everything that
+	// touches Vulkan runs on the render thread, so a slow event handler can
+	// no longer hold up presentation.
+	render_quit = false;
+	render_thread = std::thread(&VkApp::RenderLoop, this);
+
+	// Closing any of the windows ends the program
+	auto should_close = [this] {
+		for (auto& output : outputs) {
+			if (glfwWindowShouldClose(output->window)) return true;
+		}
+		return false;
+	};
+
+	while (!should_close()) {
+		glfwWaitEvents();
+	}
+
+	render_quit = true;
+	WakeRenderThread();
+	render_thread.join();
+
+	if (render_error) std::rethrow_exception(render_error);
+}
+
+void VkApp::RenderLoop() {
+	try {
+		// Wake the loop when a background pipeline build lands
+		pipeline_compiler.SetCompletionCallback([this] { WakeRenderThread(); });
+		last_update = FramePacer::Clock::now();
+
+		while (!render_quit) {
+			ProcessMessages();
+
+			// Finished uploads request a redraw themselves
+			UpdateTextureUploads();
+
+			bool all_iconified = true;
+			for (auto& output : outputs) all_iconified = all_iconified && output->iconified;
+
+			if (all_iconified || (idle_mode && !NeedsRedraw())) {
+				// GPU uploads signal nothing, so keep polling their fences
+				WaitForWake(texture_uploads.empty() ? 0.0 : 2.0);
+
+				frame_pacer.Reset();
+				last_frame_start = FramePacer::Clock::time_point();
+				continue;
+			}
 
-	auto start = std::chrono::high_resolution_clock::now();
+			// Messages are drained again after the pacer's sleep so input
+			// is as fresh as possible when the frame is built
+			frame_pacer.BeginFrame();
+			ProcessMessages();
+			if (render_quit) break;
+
+			// Anything that dirties the frame while it is drawn (a swapchain
+			// recreation, for instance) asks for another one
+			redraw_requested = false;
+			uint64_t allocations = HeapAllocationCount();
+			auto frame_start = FramePacer::Clock::now();
+
+			UpdateUniformBuffer();
+			DrawFrame();
+
+			frame_cpu_seconds.ObserveSince(frame_start);
+			if (last_frame_start != FramePacer::Clock::time_point()) {
+				frame_interval_seconds.Observe(
+					std::chrono::duration<double>(frame_start - last_frame_start).count()
+				);
+			}
+			if (hud_enabled) AddFrameSample(frame_start);
+			last_frame_start = frame_start;
+
+			// Only counted in COUNT_HEAP_ALLOCATIONS builds. Frames that
+			// recreate the swapchain or start a texture upload are expected
+			// to allocate; 'make alloc-check' fails on any other.
+			if (IsCountingHeapAllocations()) {
+				heap_allocations_total.Add(HeapAllocationCount() - allocations);
+			}
+			frame_number++;
+			frames_total.Add();
+
+			// The pacer measures the interval as it ends the frame
+			frame_pacer.EndFrame();
+			pacing_error_gauge.Set(frame_pacer.GetPacingError() * 0.001);
+			mean_pacing_error_gauge.Set(frame_pacer.GetMeanPacingError() * 0.001);
+		}
+	} catch (...) {
+		// Handed to the main thread, which rethrows it once joined. Nothing
+		// drains the message queue from here on, so stop its producers
+		// from waiting for room.
+		render_error = std::current_exception();
+		render_quit = true;
+		glfwSetWindowShouldClose(outputs[0]->window, GLFW_TRUE);
+		glfwPostEmptyEvent();
+	}
+
+	pipeline_compiler.SetCompletionCallback(nullptr);
+}
 
-	while (!glfwWindowShouldClose(window)) {
-		glfwPollEvents();
+void VkApp::PostWindowMessage(const WindowMessage& message) {
+	// The render thread drains the queue every frame, so it only fills up
+	// if that thread is stuck; wait for room rather than lose the event
+	while (!window_messages.Push(message)) {
+		if (render_quit) return;
+		std::this_thread::yield();
+	}
 
-		UpdateUniformBuffer();
-		DrawFrame();
+	WakeRenderThread();
+}
 
-		auto end = std::chrono::high_resolution_clock::now();
-		std::chrono::duration<double, std::milli> elapsed = end - start;
-		if (elapsed.count() < 15.0f) {
-			std::this_thread::sleep_for(10ms);
+void VkApp::ProcessMessages() {
+	WindowMessage message;
+	while (window_messages.Pop(message)) {
+		switch (message.type) {
+		case WindowMessage::Type::Resize:
+			// A drag-resize sends many of these; only the latest extent
+			// matters, and it is applied at the start of the next frame
+			outputs[message.output]->width = message.width;
+			outputs[message.output]->height = message.height;
+			outputs[message.output]->stale = true;
+			RequestRedraw();
+			break;
+
+		case WindowMessage::Type::Iconify:
+			outputs[message.output]->iconified = message.iconified;
+			RequestRedraw();
+			break;
+
+		case WindowMessage::Type::Refresh:
+			RequestRedraw();
+			break;
+
+		case WindowMessage::Type::ToggleAnimation:
+			animate = !animate;
+			RequestRedraw();
+			break;
+
+		case WindowMessage::Type::PresentPolicyChanged:
+			for (auto& output : outputs) output->stale = true;
+			RequestRedraw();
+			break;
 		}
+	}
+}
+
+void VkApp::WakeRenderThread() {
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex);
+		wake_pending = true;
+	}
+	wake_condition.notify_one();
+}
+
+void VkApp::WaitForWake(double timeout_ms) {
+	std::unique_lock<std::mutex> lock(wake_mutex);
+	auto woken = [this] { return wake_pending || render_quit; };
+
+	if (timeout_ms > 0.0) {
+		wake_condition.wait_for(lock, std::chrono::duration<double, std::milli>(timeout_ms), woken);
+	} else {
+		wake_condition.wait(lock, woken);
+	}
+
+	wake_pending = false;
+}
+
+bool VkApp::NeedsRedraw() {
+	if (redraw_requested || animate) return true;
+
+	return HasPipelineUpdate();
+}
 
-		start = std::chrono::high_resolution_clock::now();
+void VkApp::SetIdleMode(bool enabled) {
+	idle_mode = enabled;
+	RequestRedraw();
+}
+
+void VkApp::RequestRedraw() {
+	redraw_requested = true;
+}
+
+void VkApp::SetTargetFrameRate(double rate) {
+	target_frame_rate = rate;
+
+	if (rate <= 0.0) {
+		// Only known once GLFW is up; InitWindow calls back in here
+		GLFWmonitor* monitor = glfwGetPrimaryMonitor();
+		const GLFWvidmode* mode = monitor ? glfwGetVideoMode(monitor) : nullptr;
+		rate = (mode && mode->refreshRate > 0) ? mode->refreshRate : 60.0;
 	}
+
+	frame_pacer.SetTargetRate(rate);
+}
+
+const FramePacer& VkApp::GetFramePacer() const {
+	return frame_pacer;
+}
+
+void VkApp::SetMetricsPath(const string& path) {
+	metrics_path = path;
+}
+
+void VkApp::RegisterMetrics() {
+	metrics.Add(frames_total);
+	metrics.Add(frame_cpu_seconds);
+	metrics.Add(frame_interval_seconds);
+	metrics.Add(acquire_seconds);
+	metrics.Add(fence_wait_seconds);
+	metrics.Add(submit_seconds);
+	metrics.Add(upload_bytes_total);
+	metrics.Add(device_allocations_total);
+	metrics.Add(device_local_bytes_gauge);
+	metrics.Add(host_visible_bytes_gauge);
+	metrics.Add(swapchain_recreations_total);
+	metrics.Add(pacing_error_gauge);
+	metrics.Add(mean_pacing_error_gauge);
+
+	// Always zero otherwise
+	if (IsCountingHeapAllocations()) metrics.Add(heap_allocations_total);
 }
 
 void VkApp::Cleanup() {
+	pipeline_compiler.Stop();
+	texture_loader.Stop();
+	job_system.Stop();
 	device.waitIdle();
 
+	metrics_exporter.Stop();
+
+	DestroyCaptureResources();
+	capture_writer.Stop();
+	if (!capture_directory.empty()) {
+		cout << "Captured " << capture_writer.GetWrittenCount() << " frames to "
+			<< capture_directory << " (" << dropped_captures << " skipped)" << endl;
+	}
+
+	DestroyPipelineSlot(graphics_pipeline);
+	DestroyPipelineSlot(depth_pipeline);
+	DestroyDeferredLighting();
+	DestroyParticleSystem();
+	DestroyHudFrames();
+	DestroyTimestamps();
+	DestroyHud();
+	DestroyInstanceBuffer();
+
+	for (auto& upload : texture_uploads) {
+		device.destroyFence(upload.fence, allocator);
+		DestroyTexture(upload.texture);
+	}
+	texture_uploads.clear();
+	pending_image.reset();
+
+	for (uint32_t i = 0; i < retired_textures.size(); i++) DestroyRetiredTextures(i);
+
+	DestroyTexture(texture);
+	DestroyTexture(placeholder_texture);
+	device.destroySampler(texture_sampler, allocator);
+
+	staging_ring.Destroy();
+	device.destroyBuffer(staging_buffer, allocator);
+	FreeDeviceMemory(staging_buffer_memory);
+	device.destroyCommandPool(upload_command_pool, allocator);
+
 	auto func = (PFN_vkDestroyDebugReportCallbackEXT)
 		instance.getProcAddr("vkDestroyDebugReportCallbackEXT");
-	if (func != nullptr) { func(instance, callback, nullptr); }
+	if (func != nullptr) { func(instance, callback, (const VkAllocationCallbacks*) allocator); }
 
-	device.destroyDescriptorPool(descriptor_pool);
+	device.destroyDescriptorPool(descriptor_pool, allocator);
 
-	device.destroyBuffer(uniform_staging_buffer);
-	device.freeMemory(uniform_staging_buffer_memory);
+	DestroyUniformStaging();
 
-	device.destroyBuffer(uniform_buffer);
-	device.freeMemory(uniform_buffer_memory);
+	device.destroyBuffer(uniform_buffer, allocator);
+	FreeDeviceMemory(uniform_buffer_memory);
 
-	device.destroyBuffer(index_buffer);
-	device.freeMemory(index_buffer_memory);
+	device.destroyBuffer(index_buffer, allocator);
+	FreeDeviceMemory(index_buffer_memory);
 
-	device.destroyBuffer(vertex_buffer);
-	device.freeMemory(vertex_buffer_memory);
+	device.destroyBuffer(vertex_buffer, allocator);
+	FreeDeviceMemory(vertex_buffer_memory);
 
-	device.destroySwapchainKHR(swapchain);
-	instance.destroySurfaceKHR(surface);
-	device.destroyCommandPool(command_pool);
+	DestroySemaphores();
+	for (auto& output : outputs) DestroyOutput(*output);
+	device.destroyCommandPool(command_pool, allocator);
 
-	size_t views_count = swapchain_imageviews.size();
-	for (size_t i = 0; i < views_count; i++) {
-		device.destroyImageView(swapchain_imageviews.back());
-		swapchain_imageviews.pop_back();
-	}
+	for (auto fence : command_buffer_fences) device.destroyFence(fence, allocator);
+	command_buffer_fences.clear();
 
-	size_t framebuffer_count = swapchain_framebuffers.size();
-	for (size_t i = 0; i < framebuffer_count; i++) {
-		device.destroyFramebuffer(swapchain_framebuffers.back());
-		swapchain_framebuffers.pop_back();
-	}
+	for (uint32_t i = 0; i < retired_pipelines.size(); i++) DestroyRetiredPipelines(i);
 
-	device.destroySemaphore(semaphore_render_finished);
-	device.destroySemaphore(semaphore_image_available);
+	layout_cache.Destroy();
+	device.destroyRenderPass(render_pass, allocator);
 
-	device.destroyDescriptorSetLayout(descriptor_set_layout);
+	DestroyGBuffer();
+	DestroyDepthResources();
+	DestroyColorResources();
 
-	device.destroyPipelineLayout(pipeline_layout);
-	device.destroyRenderPass(render_pass);
-	device.destroyPipeline(graphics_pipeline);
+	SavePipelineCache();
+	device.destroyPipelineCache(pipeline_cache, allocator);
 
-	device.destroy();
-	instance.destroy();
+	device.destroy(allocator);
+	instance.destroy(allocator);
 
-	glfwDestroyWindow(window);
+	if (HostAllocator::IsEnabled()) host_allocator.PrintReport(cout);
+
+	for (auto& output : outputs) {
+		if (output->window) glfwDestroyWindow(output->window);
+	}
 }
 
 // #############################################################################
@@ -133,27 +400,43 @@ void VkApp::Cleanup() {
 void VkApp::InitVulkan() {
 	CreateInstance();
 	SetupDebugCallback();
-	CreateSurface();
+	CreateSurfaces();
 
 	PickPhysicalDevice();
 	CreateLogicalDevice();
 
-	CreateSwapchain();
-	CreateImageViews();
+	CreateSwapchains();
 	CreateRenderPass();
 	CreateDescriptorSetLayout();
+	CreatePipelineCache();
 	CreateGraphicsPipeline();
-	CreateFramebuffers();
+	CreateColorResources();
+	CreateDepthResources();
+	CreateGBuffer();
+	for (auto& output : outputs) CreateFramebuffers(*output);
 	CreateCommandPool();
+	CreateTextureUploader();
+	CreateTextureSampler();
 
 	CreateVertexBuffer();
 	CreateIndexBuffer();
+	CreateScene();
 	CreateUniformBuffer();
 	CreateDescriptorPool();
-	CreateDescriptorSet();
+	CreateDeferredLighting();
+	CreateParticleSystem();
+	CreatePlaceholderTexture();
+	CreateHud();
+	if (!texture_path.empty()) LoadTexture(texture_path);
 	CreateCommandBuffers();
 
 	CreateSemaphores();
+	CreateFences();
+	CreateInstanceBuffer();
+	CreateUniformStaging();
+	CreateHudFrames();
+	CreateTimestamps();
+	CreateCaptureResources();
 }
 
 void VkApp::CreateInstance() {
@@ -162,7 +445,7 @@ void VkApp::CreateInstance() {
 	}
 
 	vk::ApplicationInfo app_info;
-	app_info.pApplicationName = title.c_str();
+	app_info.pApplicationName = outputs[0]->title.c_str();
 	app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 	app_info.pEngineName = "No Engine";
 	app_info.apiVersion = VK_API_VERSION_1_0;
@@ -182,16 +465,17 @@ void VkApp::CreateInstance() {
 		instance_info.ppEnabledLayerNames = validationLayers.data();
 	}
 
-	if (instance) instance.destroy();
-	instance = vk::createInstance(instance_info);
+	if (instance) instance.destroy(allocator);
+	instance = vk::createInstance(instance_info, allocator);
 }
 
 vector<const char*> VkApp::GetRequiredExtensions() {
 	vector<const char*> extensions;
 
+	// Headless, GLFW is never initialized and nothing needs a surface
 	unsigned int glfw_ext_count = 0;
-	const char** glfw_extensions;
-	glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_ext_count);
+	const char** glfw_extensions = nullptr;
+	if (!headless) glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_ext_count);
 
 	for (unsigned int i = 0; i < glfw_ext_count; i++) {
 		extensions.push_back(glfw_extensions[i]);
@@ -273,7 +557,7 @@ void VkApp::SetupDebugCallback() {
 		r = func(
 			instance,
 			&(callback_info),
-			nullptr, &callback
+			(const VkAllocationCallbacks*) allocator, &callback
 		);
 	}
 
@@ -296,16 +580,19 @@ VKAPI_ATTR VkBool32 VKAPI_CALL VkApp::DebugCallback(
 	return VK_FALSE;
 }
 
-void VkApp::CreateSurface() {
-	instance.destroySurfaceKHR(surface, nullptr);
-	VkSurfaceKHR s = (VkSurfaceKHR) surface;
-	VkResult r = glfwCreateWindowSurface(instance, window, nullptr, &s);
+void VkApp::CreateSurfaces() {
+	for (auto& output : outputs) {
+		instance.destroySurfaceKHR(output->surface, allocator);
+		VkSurfaceKHR s = (VkSurfaceKHR) output->surface;
+		VkResult r = glfwCreateWindowSurface(
+			instance, output->window, (const VkAllocationCallbacks*) allocator, &s);
 
-	if (r != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create window surface");
-	}
+		if (r != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create window surface");
+		}
 
-	surface = s;
+		output->surface = s;
+	}
 }
 
 void VkApp::PickPhysicalDevice() {
@@ -325,18 +612,23 @@ void VkApp::PickPhysicalDevice() {
 	if (!physical_device) {
 		throw std::runtime_error("Failed to find a suitable GPU");
 	}
+
+	// The surfaces never change, so neither do these
+	queue_families = FindQueueFamilies(physical_device);
 }
 
 bool VkApp::isDeviceSuitable(vk::PhysicalDevice device) {
 	QueueFamilyIndices indices = FindQueueFamilies(device);
 	bool extensions_supported = CheckDeviceExtensionSupport(device);
 
-	bool swapchain_adequate = false;
-	if (extensions_supported) {
-		SwapChainSupportDetails swapchain_support = QuerySwapchainSupport(device);
+	// Every window has to be presentable from this device
+	bool swapchain_adequate = extensions_supported;
+	for (size_t i = 0; swapchain_adequate && !headless && i < outputs.size(); i++) {
+		SwapChainSupportDetails support;
+		QuerySwapchainSupport(device, outputs[i]->surface, support);
 
 		swapchain_adequate =
-		!swapchain_support.formats.empty() && !swapchain_support.present_modes.empty();
+		!support.formats.empty() && !support.present_modes.empty();
 	}
 
 	return indices.isComplete() && extensions_supported && swapchain_adequate;
@@ -354,16 +646,29 @@ QueueFamilyIndices VkApp::FindQueueFamilies(vk::PhysicalDevice device) {
 
 	int i = 0;
 	for (const auto& queue_family : queue_families) {
+		// The particle passes are recorded into the frame's command
+		// buffer, so the graphics queue has to run compute as well
+		vk::QueueFlags needed = vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute;
 		if (	queue_family.queueCount > 0 &&
-			queue_family.queueFlags & vk::QueueFlagBits::eGraphics)
+			(queue_family.queueFlags & needed) == needed)
 		{
 			indices.graphics_family = i;
 		}
 
-		VkBool32 presentation_support = false;
-		device.getSurfaceSupportKHR(i, surface, &presentation_support);
-		if (queue_family.queueCount > 0  && presentation_support) {
-			indices.present_family = i;
+		// All windows are presented from one queue in one call, so it
+		// has to support every surface. Headless, there are no surfaces.
+		if (headless) {
+			indices.present_family = indices.graphics_family;
+		} else {
+			bool presentation_support = queue_family.queueCount > 0;
+			for (auto& output : outputs) {
+				VkBool32 supported = false;
+				device.getSurfaceSupportKHR(i, output->surface, &supported);
+				presentation_support = presentation_support && supported;
+			}
+			if (presentation_support) {
+				indices.present_family = i;
+			}
 		}
 
 		if (indices.isComplete()) break;
@@ -374,7 +679,7 @@ QueueFamilyIndices VkApp::FindQueueFamilies(vk::PhysicalDevice device) {
 }
 
 void VkApp::CreateLogicalDevice() {
-	QueueFamilyIndices indices = FindQueueFamilies(physical_device);
+	const QueueFamilyIndices& indices = queue_families;
 
 	vector<vk::DeviceQueueCreateInfo> queue_infos;
 	set<int> unique_queue_families = {
@@ -391,7 +696,11 @@ void VkApp::CreateLogicalDevice() {
 		queue_infos.push_back(queue_info);
 	}
 
-	vk::PhysicalDeviceFeatures device_features;
+	// Compressed texture formats need their feature enabled to be used
+	vk::PhysicalDeviceFeatures supported_features = physical_device.getFeatures();
+	device_features = vk::PhysicalDeviceFeatures();
+	device_features.textureCompressionBC = supported_features.textureCompressionBC;
+	device_features.textureCompressionETC2 = supported_features.textureCompressionETC2;
 
 	vk::DeviceCreateInfo device_info;
 	device_info.queueCreateInfoCount = (uint32_t) queue_infos.size();
@@ -404,7 +713,8 @@ void VkApp::CreateLogicalDevice() {
 		device_info.ppEnabledLayerNames = validationLayers.data();
 	}
 
-	device = physical_device.createDevice(device_info);
+	device = physical_device.createDevice(device_info, allocator);
+	layout_cache.Init(device, allocator);
 
 	graphics_queue = device.getQueue(indices.graphics_family, 0);
 	presentation_queue = device.getQueue(indices.present_family, 0);
@@ -422,14 +732,22 @@ bool VkApp::CheckDeviceExtensionSupport(vk::PhysicalDevice device) {
 	return required_extensions.empty();
 }
 
-SwapChainSupportDetails VkApp::QuerySwapchainSupport(vk::PhysicalDevice device) {
-	SwapChainSupportDetails details;
-
-	details.capabilities	= device.getSurfaceCapabilitiesKHR(surface);
-	details.formats		= device.getSurfaceFormatsKHR(surface);
-	details.present_modes	= device.getSurfacePresentModesKHR(surface);
-
-	return details;
+void VkApp::QuerySwapchainSupport(
+	vk::PhysicalDevice device, vk::SurfaceKHR surface, SwapChainSupportDetails& details
+) {
+	details.capabilities = device.getSurfaceCapabilitiesKHR(surface);
+
+	// Filled through the count/pointer queries so a resize reuses the
+	// vectors' storage instead of allocating new ones
+	uint32_t count = 0;
+	device.getSurfaceFormatsKHR(surface, &count, nullptr);
+	details.formats.resize(count);
+	device.getSurfaceFormatsKHR(surface, &count, details.formats.data());
+
+	count = 0;
+	device.getSurfacePresentModesKHR(surface, &count, nullptr);
+	details.present_modes.resize(count);
+	device.getSurfacePresentModesKHR(surface, &count, details.present_modes.data());
 }
 
 vk::SurfaceFormatKHR
@@ -456,23 +774,69 @@ VkApp::ChooseSwapSurfaceFormat(const vector<vk::SurfaceFormatKHR>& available_for
 vk::PresentModeKHR VkApp::ChooseSwapPresentMode(
 	const vector<vk::PresentModeKHR>& available_present_modes
 ) {
-	for (const auto& mode : available_present_modes) {
-		if (mode == vk::PresentModeKHR::eMailbox) {
-			return mode;
+	vector<vk::PresentModeKHR> preferred;
+
+	switch (present_policy) {
+	case PresentPolicy::LowLatency:
+		preferred = {
+			vk::PresentModeKHR::eImmediate,
+			vk::PresentModeKHR::eMailbox,
+			vk::PresentModeKHR::eFifoRelaxed
+		};
+		break;
+	case PresentPolicy::Throughput:
+		preferred = {
+			vk::PresentModeKHR::eMailbox,
+			vk::PresentModeKHR::eFifoRelaxed
+		};
+		break;
+	case PresentPolicy::PowerSave:
+		break;
+	}
+
+	for (auto wanted : preferred) {
+		for (const auto& mode : available_present_modes) {
+			if (mode == wanted) return mode;
 		}
 	}
 
+	// FIFO is the only mode the spec guarantees
 	return vk::PresentModeKHR::eFifo;
 }
 
+uint32_t VkApp::ChooseSwapImageCount(
+	const vk::SurfaceCapabilitiesKHR& capabilities, vk::PresentModeKHR mode
+) {
+	uint32_t image_count = capabilities.minImageCount;
+
+	switch (present_policy) {
+	case PresentPolicy::LowLatency:
+		// Mailbox needs a spare image to replace, immediate does not
+		if (mode == vk::PresentModeKHR::eMailbox) image_count += 1;
+		break;
+	case PresentPolicy::Throughput:
+		image_count += 1;
+		break;
+	case PresentPolicy::PowerSave:
+		image_count = std::max(image_count, 2u);
+		break;
+	}
+
+	if (capabilities.maxImageCount > 0 && image_count > capabilities.maxImageCount) {
+		image_count = capabilities.maxImageCount;
+	}
+
+	return image_count;
+}
+
 vk::Extent2D VkApp::ChooseSwapExtent(
-	const vk::SurfaceCapabilitiesKHR& capabilities
+	const vk::SurfaceCapabilitiesKHR& capabilities, const Output& output
 ) {
 	if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
 		return capabilities.currentExtent;
 	}
 
-	vk::Extent2D extent = { width, height };
+	vk::Extent2D extent = { output.width, output.height };
 	extent.width = std::max(capabilities.minImageExtent.width,
 		std::min(capabilities.maxImageExtent.width, extent.width));
 	extent.height = std::max(capabilities.minImageExtent.height,
@@ -481,31 +845,72 @@ vk::Extent2D VkApp::ChooseSwapExtent(
 	return extent;
 }
 
-void VkApp::CreateSwapchain() {
-	SwapChainSupportDetails support = QuerySwapchainSupport(physical_device);
+void VkApp::CreateSwapchains() {
+	// On recreation only the stale ones are replaced
+	for (auto& output : outputs) {
+		if (output->swapchain && !output->stale) continue;
+		CreateSwapchain(*output);
+		CreateImageViews(*output);
+	}
+
+	// The attachments are shared, so they cover every window
+	attachment_extent = vk::Extent2D(0, 0);
+	for (auto& output : outputs) {
+		attachment_extent.width = std::max(attachment_extent.width, output->extent.width);
+		attachment_extent.height = std::max(attachment_extent.height, output->extent.height);
+	}
+}
+
+void VkApp::CreateSwapchain(Output& output) {
+	QuerySwapchainSupport(physical_device, output.surface, output.support);
+	const SwapChainSupportDetails& support = output.support;
 	vk::SurfaceFormatKHR format = ChooseSwapSurfaceFormat(support.formats);
 	vk::PresentModeKHR mode	= ChooseSwapPresentMode(support.present_modes);
 
-	swapchain_extent = ChooseSwapExtent(support.capabilities);
-	swapchain_format = format.format;
-
-	uint32_t image_count = support.capabilities.minImageCount + 1;
-	if (	support.capabilities.maxImageCount > 0 &&
-		image_count > support.capabilities.maxImageCount)
-	{
-		image_count = support.capabilities.maxImageCount;
+	// The first window picks the format; the others render through the
+	// same render pass, so they have to take it too
+	bool primary = output.index == 0;
+	if (primary) {
+		swapchain_format = format.format;
+	} else if (format.format != swapchain_format) {
+		auto match = std::find_if(support.formats.begin(), support.formats.end(),
+			[this](const vk::SurfaceFormatKHR& f) { return f.format == swapchain_format; });
+		if (match == support.formats.end()) {
+			throw std::runtime_error("Window " + output.title + " has no surface format in common with the first");
+		}
+		format = *match;
 	}
 
+	output.extent = ChooseSwapExtent(support.capabilities, output);
+
+	uint32_t image_count = ChooseSwapImageCount(support.capabilities, mode);
+
 	vk::SwapchainCreateInfoKHR swapchain_info;
-	swapchain_info.surface = surface;
+	swapchain_info.surface = output.surface;
 	swapchain_info.minImageCount = image_count;
 	swapchain_info.imageFormat = format.format;
 	swapchain_info.imageColorSpace = format.colorSpace;
-	swapchain_info.imageExtent = swapchain_extent;
+	swapchain_info.imageExtent = output.extent;
 	swapchain_info.imageArrayLayers = 1;
 	swapchain_info.imageUsage = vk::ImageUsageFlagBits::eColorAttachment;
 
-	QueueFamilyIndices indices = FindQueueFamilies(physical_device);
+	// Captured frames are copied straight out of the primary window's
+	// images, so they need transfer usage and a format the writer understands
+	if (primary && !capture_directory.empty()) {
+		bool readable_format =
+			format.format == vk::Format::eB8G8R8A8Unorm || format.format == vk::Format::eB8G8R8A8Srgb ||
+			format.format == vk::Format::eR8G8B8A8Unorm || format.format == vk::Format::eR8G8B8A8Srgb;
+		bool transfer_usage = (bool) (support.capabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferSrc);
+
+		capture_enabled = readable_format && transfer_usage;
+		if (capture_enabled) {
+			swapchain_info.imageUsage |= vk::ImageUsageFlagBits::eTransferSrc;
+		} else {
+			cout << "Frame capture is not supported for this swapchain" << endl;
+		}
+	}
+
+	const QueueFamilyIndices& indices = queue_families;
 	uint32_t queue_families_indices[] = {
 		(uint32_t) indices.graphics_family,
 		(uint32_t) indices.present_family
@@ -523,45 +928,152 @@ void VkApp::CreateSwapchain() {
 	swapchain_info.clipped = true;
 
 	vk::SwapchainKHR old_swapchain;
-	if (swapchain) {
-		old_swapchain = swapchain;
+	if (output.swapchain) {
+		old_swapchain = output.swapchain;
 		swapchain_info.oldSwapchain = old_swapchain;
 	}
 
 	vk::SwapchainKHR new_swapchain;
-	new_swapchain = device.createSwapchainKHR(swapchain_info);
+	new_swapchain = device.createSwapchainKHR(swapchain_info, allocator);
+
+	if (old_swapchain) device.destroySwapchainKHR(old_swapchain, allocator);
+	output.swapchain = new_swapchain;
+	output.images = device.getSwapchainImagesKHR(output.swapchain);
+	output.present_mode = mode;
+
+	output.stale = false;
+
+	// The driver may hand out more images than requested
+	cout << "Swapchain (" << output.title << "): " << vk::to_string(output.present_mode) << ", "
+		<< output.images.size() << " images (requested "
+		<< image_count << ")" << endl;
+}
+
+void VkApp::DestroyOutput(Output& output) {
+	for (auto framebuffer : output.framebuffers) device.destroyFramebuffer(framebuffer, allocator);
+	for (auto view : output.imageviews) device.destroyImageView(view, allocator);
+	output.framebuffers.clear();
+	output.imageviews.clear();
+	output.images.clear();
+
+	device.destroySwapchainKHR(output.swapchain, allocator);
+	instance.destroySurfaceKHR(output.surface, allocator);
+
+	output.swapchain = nullptr;
+	output.surface = nullptr;
+}
 
-	if (old_swapchain) device.destroySwapchainKHR(old_swapchain);
-	swapchain = new_swapchain;
-	swapchain_images = device.getSwapchainImagesKHR(swapchain);
+void VkApp::SetPresentPolicy(PresentPolicy policy) {
+	if (present_policy.exchange(policy) == policy) return;
+
+	// The swapchains belong to the render thread; it recreates them at the
+	// start of its next frame. Before Run() they do not exist yet.
+	if (!render_thread.joinable()) return;
+
+	WindowMessage message;
+	message.type = WindowMessage::Type::PresentPolicyChanged;
+	PostWindowMessage(message);
+}
+
+PresentPolicy VkApp::GetPresentPolicy() const {
+	return present_policy;
+}
+
+vk::PresentModeKHR VkApp::GetPresentMode() const {
+	return outputs[0]->present_mode;
+}
+
+uint32_t VkApp::GetSwapchainImageCount() const {
+	return (uint32_t) outputs[0]->images.size();
 }
 
-void VkApp::RecreateSwapchain() {
+void VkApp::RecreateSwapchains() {
 	device.waitIdle();
+	swapchain_recreations_total.Add();
 
-	CreateSwapchain();
-	CreateImageViews();
+	// Sized to the old extent; any finished copies are written out first
+	DestroyCaptureResources();
+
+	// Viewport and scissor are dynamic state, so the pipeline survives a
+	// resize and only the swapchain-sized objects have to be rebuilt. The
+	// shared attachments follow the largest window, so every framebuffer
+	// is replaced, not just those of the stale swapchains.
+	CreateSwapchains();
 	//CreateRenderPass();
-	CreateGraphicsPipeline();
-	CreateFramebuffers();
+	CreateColorResources();
+	CreateDepthResources();
+	CreateGBuffer();
+	WriteLightingDescriptors();
+	for (auto& output : outputs) CreateFramebuffers(*output);
 	CreateCommandBuffers();
+	CreateSemaphores();
+	CreateFences();
+	CreateInstanceBuffer();
+	CreateUniformStaging();
+	CreateHudFrames();
+	CreateTimestamps();
+	CreateCaptureResources();
+
+	RequestRedraw();
 }
 
+// The callbacks below run on the main thread and only post messages; the
+// render thread applies them between frames. Each window's user pointer
+// is its Output, which knows the app and its own index.
+
 void VkApp::OnWindowResized(GLFWwindow* window, int w, int h) {
 	if (w == 0 || h == 0) return;
 
-	VkApp *app = reinterpret_cast<VkApp*>(glfwGetWindowUserPointer(window));
-	app->width = w;
-	app->height = h;
-	app->RecreateSwapchain();
+	Output* output = reinterpret_cast<Output*>(glfwGetWindowUserPointer(window));
+
+	WindowMessage message;
+	message.type = WindowMessage::Type::Resize;
+	message.output = output->index;
+	message.width = (uint32_t) w;
+	message.height = (uint32_t) h;
+	output->app->PostWindowMessage(message);
+}
+
+void VkApp::OnWindowIconified(GLFWwindow* window, int iconified) {
+	Output* output = reinterpret_cast<Output*>(glfwGetWindowUserPointer(window));
+
+	WindowMessage message;
+	message.type = WindowMessage::Type::Iconify;
+	message.output = output->index;
+	message.iconified = iconified == GLFW_TRUE;
+	output->app->PostWindowMessage(message);
 }
 
-void VkApp::CreateImageViews() {
-	swapchain_imageviews.resize(swapchain_images.size());
+void VkApp::OnWindowRefresh(GLFWwindow* window) {
+	Output* output = reinterpret_cast<Output*>(glfwGetWindowUserPointer(window));
 
-	for (uint32_t i = 0; i < swapchain_images.size(); i++) {
+	WindowMessage message;
+	message.type = WindowMessage::Type::Refresh;
+	message.output = output->index;
+	output->app->PostWindowMessage(message);
+}
+
+void VkApp::OnKey(GLFWwindow* window, int key, int scancode, int action, int mods) {
+	if (action != GLFW_PRESS) return;
+
+	Output* output = reinterpret_cast<Output*>(glfwGetWindowUserPointer(window));
+	if (key == GLFW_KEY_SPACE) {
+		WindowMessage message;
+		message.type = WindowMessage::Type::ToggleAnimation;
+		message.output = output->index;
+		output->app->PostWindowMessage(message);
+	}
+}
+
+void VkApp::CreateImageViews(Output& output) {
+	// Views of the old swapchain's images; the framebuffers using them are
+	// replaced right after
+	for (auto view : output.imageviews) device.destroyImageView(view, allocator);
+	output.imageviews.resize(output.images.size());
+
+	for (uint32_t i = 0; i < output.images.size(); i++) {
 		vk::ImageViewCreateInfo view_info = vk::ImageViewCreateInfo()
-		.setImage(swapchain_images[i])
+		.setImage(output.images[i])
 		.setViewType(vk::ImageViewType::e2D)
 		.setFormat(swapchain_format);
 
@@ -572,24 +1084,128 @@ void VkApp::CreateImageViews() {
 			.setBaseArrayLayer(0)	// optional
 			.setLayerCount(1);
 
-		if (swapchain_imageviews[i]) device.destroyImageView(swapchain_imageviews[i]);
-		swapchain_imageviews[i] = device.createImageView(view_info);
+		output.imageviews[i] = device.createImageView(view_info, allocator);
+	}
+}
+
+void VkApp::CreatePipelineCache() {
+	vector<char> initial_data;
+	try {
+		initial_data = ReadFile("pipeline_cache.bin");
+	} catch (const std::runtime_error&) {
+		// No cache from a previous run, start empty
+	}
+
+	// The driver validates the header and ignores data from other devices
+	auto cache_info = vk::PipelineCacheCreateInfo()
+	.setInitialDataSize(initial_data.size())
+	.setPInitialData(initial_data.data());
+
+	if (pipeline_cache) device.destroyPipelineCache(pipeline_cache, allocator);
+	pipeline_cache = device.createPipelineCache(cache_info, allocator);
+
+	pipeline_compiler.Start(pipeline_cache);
+}
+
+void VkApp::SavePipelineCache() {
+	if (!pipeline_cache) return;
+
+	auto data = device.getPipelineCacheData(pipeline_cache);
+
+	std::ofstream file("pipeline_cache.bin", std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		cout << "Could not write pipeline cache" << endl;
+		return;
 	}
+
+	file.write((const char*) data.data(), data.size());
 }
 
 void VkApp::CreateGraphicsPipeline() {
-	#ifdef _WIN32
-		auto vertex_shader_code = ReadFile("../../../shaders/vertex-v.spv");
-		auto fragment_shader_code = ReadFile("../../../shaders/fragment-f.spv");
-	#else
-		auto vertex_shader_code	  = ReadFile("shaders/vertex-v.spv");
-		auto fragment_shader_code = ReadFile("shaders/fragment-f.spv");
-	#endif
+	// Deferred, the scene only fills the G-buffer and is lit afterwards
+	auto vertex_shader_code	  = ReadShader("vertex-v.spv");
+	auto fragment_shader_code = ReadShader(deferred ? "gbuffer-f.spv" : "fragment-f.spv");
+
+	// The pipelines themselves are built on the compiler thread; until they
+	// are ready the frame keeps drawing with whatever it had (or nothing).
+	GraphicsPipelineDesc color_desc;
+	color_desc.layout = pipeline_layout;
+	color_desc.render_pass = render_pass;
+	color_desc.subpass = geometry_subpass;
+	color_desc.allocator = allocator;
+	color_desc.samples = msaa_samples;
+	color_desc.color_attachments = deferred ? 2 : 1;
+	color_desc.vertex_code = vertex_shader_code;
+	color_desc.fragment_code = fragment_shader_code;
+
+	// One shader pair for every variant; the constants pick the features
+	color_desc.specialization = ShaderSpecialization::From(scene_variant);
+
+	if (scene_variant.quantized) {
+		QuantizedVertexInput::AppendTo(color_desc.vertex_bindings, color_desc.vertex_attributes);
+	} else {
+		VertexInput::AppendTo(color_desc.vertex_bindings, color_desc.vertex_attributes);
+	}
+	InstanceInput::AppendTo(color_desc.vertex_bindings, color_desc.vertex_attributes);
+
+	if (depth_prepass) {
+		// Depth is already resolved; only the visible fragment at each
+		// pixel passes the equality test and gets shaded
+		color_desc.depth_write = false;
+		color_desc.depth_compare = vk::CompareOp::eEqual;
+
+		GraphicsPipelineDesc depth_desc;
+		depth_desc.layout = pipeline_layout;
+		depth_desc.render_pass = render_pass;
+		depth_desc.subpass = 0;
+		depth_desc.allocator = allocator;
+		depth_desc.vertex_code = vertex_shader_code;
+		depth_desc.vertex_bindings = color_desc.vertex_bindings;
+		depth_desc.vertex_attributes = color_desc.vertex_attributes;
+		depth_desc.specialization = color_desc.specialization;
+		depth_desc.color_attachments = 0;
+		depth_desc.samples = msaa_samples;
+
+		CompilePipeline(depth_pipeline, depth_desc);
+	}
+
+	CompilePipeline(graphics_pipeline, color_desc);
+}
+
+void VkApp::CompilePipeline(PipelineSlot& slot, const GraphicsPipelineDesc& desc) {
+	// Checked here rather than on the compiler thread so a mismatch fails
+	// loudly instead of leaving the slot empty
+	ShaderInterface shader = ShaderInterface::Reflect(desc.vertex_code);
+	for (uint32_t location : shader.input_locations) {
+		auto fed = std::find_if(desc.vertex_attributes.begin(), desc.vertex_attributes.end(),
+			[location](const vk::VertexInputAttributeDescription& a) { return a.location == location; });
+
+		if (fed == desc.vertex_attributes.end()) {
+			throw std::runtime_error(
+				"Vertex shader reads location " + std::to_string(location) +
+				" but the pipeline has no attribute for it");
+		}
+	}
+
+	vk::Device dev = device;
+
+	slot.pending = pipeline_compiler.Submit(
+		[dev, desc](vk::PipelineCache cache) {
+			return BuildGraphicsPipeline(dev, cache, desc);
+		}
+	);
+}
+
+vk::Pipeline VkApp::BuildGraphicsPipeline(
+	vk::Device device, vk::PipelineCache cache, const GraphicsPipelineDesc& desc
+) {
 	vk::ShaderModule vertex_smodule;
 	vk::ShaderModule fragment_smodule;
 
-	CreateShaderModule(vertex_shader_code, vertex_smodule);
-	CreateShaderModule(fragment_shader_code, fragment_smodule);
+	CreateShaderModule(device, desc.vertex_code, vertex_smodule, desc.allocator);
+	if (!desc.fragment_code.empty()) {
+		CreateShaderModule(device, desc.fragment_code, fragment_smodule, desc.allocator);
+	}
 
 	auto vert_pipeline_info = vk::PipelineShaderStageCreateInfo()
 	.setStage(vk::ShaderStageFlagBits::eVertex)
@@ -601,47 +1217,47 @@ void VkApp::CreateGraphicsPipeline() {
 	.setModule(fragment_smodule)
 	.setPName("main");
 
+	auto specialization = desc.specialization.GetInfo();
+	if (!desc.specialization.Empty()) {
+		vert_pipeline_info.setPSpecializationInfo(&specialization);
+		frag_pipeline_info.setPSpecializationInfo(&specialization);
+	}
+
+	// A depth-only pipeline has no fragment stage at all
 	vk::PipelineShaderStageCreateInfo shader_stages[] = {
 		vert_pipeline_info, frag_pipeline_info
 	};
-
-	auto binding_description = Vertex::GetBindingDescription();
-	auto attribute_descriptions = Vertex::GetAttributeDescriptions();
+	uint32_t stage_count = fragment_smodule ? 2 : 1;
 
 	auto vert_input_info = vk::PipelineVertexInputStateCreateInfo()
-	.setVertexBindingDescriptionCount(1)
-	.setPVertexBindingDescriptions(&binding_description)
-	.setVertexAttributeDescriptionCount(attribute_descriptions.size())
-	.setPVertexAttributeDescriptions(attribute_descriptions.data());
+	.setVertexBindingDescriptionCount((uint32_t) desc.vertex_bindings.size())
+	.setPVertexBindingDescriptions(desc.vertex_bindings.data())
+	.setVertexAttributeDescriptionCount((uint32_t) desc.vertex_attributes.size())
+	.setPVertexAttributeDescriptions(desc.vertex_attributes.data());
 
 	auto input_assembly = vk::PipelineInputAssemblyStateCreateInfo()
 	.setTopology(vk::PrimitiveTopology::eTriangleList)
 	.setPrimitiveRestartEnable(false);
 
-	auto viewport = vk::Viewport()
-	.setX(0.0f)
-	.setY(0.0f)
-	.setWidth((float) swapchain_extent.width)
-	.setHeight((float) swapchain_extent.height)
-	.setMinDepth(0.0f)
-	.setMaxDepth(1.0f);
-
-	auto scissor = vk::Rect2D()
-	.setOffset({ 0, 0 })
-	.setExtent(swapchain_extent);
-
+	// Viewport and scissor are set when recording the command buffer
 	auto viewport_state = vk::PipelineViewportStateCreateInfo()
 	.setViewportCount(1)
-	.setPViewports(&viewport)
-	.setScissorCount(1)
-	.setPScissors(&scissor);
+	.setScissorCount(1);
+
+	vk::DynamicState dynamic_states[] = {
+		vk::DynamicState::eViewport, vk::DynamicState::eScissor
+	};
+
+	auto dynamic_state = vk::PipelineDynamicStateCreateInfo()
+	.setDynamicStateCount(2)
+	.setPDynamicStates(dynamic_states);
 
 	auto rasterizer = vk::PipelineRasterizationStateCreateInfo()
 	.setDepthClampEnable(false)
 	.setRasterizerDiscardEnable(false)
 	.setPolygonMode(vk::PolygonMode::eFill)
 	.setLineWidth(1.0f)
-	.setCullMode(vk::CullModeFlagBits::eBack)
+	.setCullMode(desc.cull_mode)
 	.setFrontFace(vk::FrontFace::eCounterClockwise)
 	.setDepthBiasEnable(false)
 	.setDepthBiasConstantFactor(0.0f)
@@ -650,17 +1266,24 @@ void VkApp::CreateGraphicsPipeline() {
 
 	auto multisampling = vk::PipelineMultisampleStateCreateInfo()
 	.setSampleShadingEnable(false)
-	.setRasterizationSamples(vk::SampleCountFlagBits::e1)
+	.setRasterizationSamples(desc.samples)
 	.setMinSampleShading(1.0f)
 	.setPSampleMask(nullptr)
 	.setAlphaToCoverageEnable(false)
 	.setAlphaToOneEnable(false);
 
+	auto depth_stencil = vk::PipelineDepthStencilStateCreateInfo()
+	.setDepthTestEnable(desc.depth_test)
+	.setDepthWriteEnable(desc.depth_write)
+	.setDepthCompareOp(desc.depth_compare)
+	.setDepthBoundsTestEnable(false)
+	.setStencilTestEnable(false);
+
 	auto color_blend_attachment = vk::PipelineColorBlendAttachmentState()
 	.setColorWriteMask(
 		vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
 		vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA )
-	.setBlendEnable(false)
+	.setBlendEnable(desc.blend != BlendMode::Opaque)
 	.setSrcColorBlendFactor(vk::BlendFactor::eOne)
 	.setDstColorBlendFactor(vk::BlendFactor::eZero)
 	.setColorBlendOp(vk::BlendOp::eAdd)
@@ -668,66 +1291,204 @@ void VkApp::CreateGraphicsPipeline() {
 	.setDstAlphaBlendFactor(vk::BlendFactor::eZero)
 	.setAlphaBlendOp(vk::BlendOp::eAdd);
 
+	if (desc.blend == BlendMode::Additive) {
+		color_blend_attachment
+		.setDstColorBlendFactor(vk::BlendFactor::eOne)
+		.setDstAlphaBlendFactor(vk::BlendFactor::eOne);
+	} else if (desc.blend == BlendMode::Alpha) {
+		color_blend_attachment
+		.setSrcColorBlendFactor(vk::BlendFactor::eSrcAlpha)
+		.setDstColorBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha)
+		.setDstAlphaBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha);
+	}
+
+	// Every color attachment of the subpass blends the same way
+	vector<vk::PipelineColorBlendAttachmentState> color_blend_attachments(
+		desc.color_attachments, color_blend_attachment);
+
 	auto color_blending = vk::PipelineColorBlendStateCreateInfo()
 	.setLogicOpEnable(false)
 	.setLogicOp(vk::LogicOp::eCopy)
-	.setAttachmentCount(1)
-	.setPAttachments(&color_blend_attachment)
+	.setAttachmentCount(desc.color_attachments)
+	.setPAttachments(color_blend_attachments.data())
 	.setBlendConstants({ 0.0f, 0.0f, 0.0f, 0.0f });
 
-	vk::DescriptorSetLayout layouts[] = { descriptor_set_layout };
-	auto layout_info = vk::PipelineLayoutCreateInfo()
-	.setSetLayoutCount(1)
-	.setPSetLayouts(layouts)
-	.setPushConstantRangeCount(0)
-	.setPPushConstantRanges(nullptr);
-
-	if (pipeline_layout) device.destroyPipelineLayout(pipeline_layout);
-	pipeline_layout = device.createPipelineLayout(layout_info);
-
 	auto pipeline_info = vk::GraphicsPipelineCreateInfo()
-	.setStageCount(2)
+	.setStageCount(stage_count)
 	.setPStages(shader_stages)
 	.setPVertexInputState(&vert_input_info)
 	.setPInputAssemblyState(&input_assembly)
 	.setPViewportState(&viewport_state)
 	.setPRasterizationState(&rasterizer)
 	.setPMultisampleState(&multisampling)
-	.setPDepthStencilState(nullptr)
+	.setPDepthStencilState(&depth_stencil)
 	.setPColorBlendState(&color_blending)
-	.setPDynamicState(nullptr)
-	.setLayout(pipeline_layout)
-	.setRenderPass(render_pass)
-	.setSubpass(0)
+	.setPDynamicState(&dynamic_state)
+	.setLayout(desc.layout)
+	.setRenderPass(desc.render_pass)
+	.setSubpass(desc.subpass)
+	.setBasePipelineHandle(nullptr)
+	.setBasePipelineIndex(-1);
+
+	vk::Pipeline pipeline;
+	try {
+		pipeline = device.createGraphicsPipeline(cache, pipeline_info, desc.allocator);
+	} catch (...) {
+		if (fragment_smodule) device.destroyShaderModule(fragment_smodule, desc.allocator);
+		device.destroyShaderModule(vertex_smodule, desc.allocator);
+		throw;
+	}
+
+	if (fragment_smodule) device.destroyShaderModule(fragment_smodule, desc.allocator);
+	device.destroyShaderModule(vertex_smodule, desc.allocator);
+
+	return pipeline;
+}
+
+void VkApp::CompileComputePipeline(
+	PipelineSlot& slot, vk::PipelineLayout layout, const vector<char>& code,
+	const ShaderSpecialization& specialization
+) {
+	vk::Device dev = device;
+	const vk::AllocationCallbacks* callbacks = allocator;
+
+	slot.pending = pipeline_compiler.Submit(
+		[dev, layout, code, specialization, callbacks](vk::PipelineCache cache) {
+			return BuildComputePipeline(dev, cache, layout, code, specialization, callbacks);
+		}
+	);
+}
+
+vk::Pipeline VkApp::BuildComputePipeline(
+	vk::Device device, vk::PipelineCache cache, vk::PipelineLayout layout,
+	const vector<char>& code, const ShaderSpecialization& specialization,
+	const vk::AllocationCallbacks* allocator
+) {
+	vk::ShaderModule compute_smodule;
+	CreateShaderModule(device, code, compute_smodule, allocator);
+
+	auto stage_info = vk::PipelineShaderStageCreateInfo()
+	.setStage(vk::ShaderStageFlagBits::eCompute)
+	.setModule(compute_smodule)
+	.setPName("main");
+
+	auto specialization_info = specialization.GetInfo();
+	if (!specialization.Empty()) stage_info.setPSpecializationInfo(&specialization_info);
+
+	auto pipeline_info = vk::ComputePipelineCreateInfo()
+	.setStage(stage_info)
+	.setLayout(layout)
 	.setBasePipelineHandle(nullptr)
 	.setBasePipelineIndex(-1);
 
-	if (graphics_pipeline) device.destroyPipeline(graphics_pipeline);
-	graphics_pipeline = device.createGraphicsPipeline(nullptr, pipeline_info);
+	vk::Pipeline pipeline;
+	try {
+		pipeline = device.createComputePipeline(cache, pipeline_info, allocator);
+	} catch (...) {
+		device.destroyShaderModule(compute_smodule, allocator);
+		throw;
+	}
+
+	device.destroyShaderModule(compute_smodule, allocator);
+	return pipeline;
+}
+
+void VkApp::UpdatePipelines() {
+	for (PipelineSlot* slot : {
+		&graphics_pipeline, &depth_pipeline,
+		&particle_emit_pipeline, &particle_simulate_pipeline,
+		&particle_compact_pipeline, &particle_draw_pipeline,
+		&hud_pipeline, &lighting_pipeline,
+		&light_update_pipeline, &light_cull_pipeline
+	}) {
+		UpdatePipelineSlot(*slot);
+	}
+}
+
+void VkApp::UpdatePipelineSlot(PipelineSlot& slot) {
+	if (!slot.pending) return;
+	if (!slot.pending->ready.load(std::memory_order_acquire)) return;
+
+	auto result = slot.pending;
+	slot.pending.reset();
+
+	if (result->failed) {
+		throw std::runtime_error("Failed to create pipeline: " + result->error);
+	}
 
-	device.destroyShaderModule(fragment_smodule);
-	device.destroyShaderModule(vertex_smodule);
+	// Frames in flight may still use the old pipeline. The frame being
+	// built does not, and once its fence signals neither do the ones
+	// submitted before it, so it goes away when this slot comes round again.
+	if (slot.pipeline) retired_pipelines[frame_slot].push_back(slot.pipeline);
+
+	slot.pipeline = result->pipeline;
+}
+
+bool VkApp::HasPipelineUpdate() {
+	for (PipelineSlot* slot : {
+		&graphics_pipeline, &depth_pipeline,
+		&particle_emit_pipeline, &particle_simulate_pipeline,
+		&particle_compact_pipeline, &particle_draw_pipeline,
+		&hud_pipeline, &lighting_pipeline,
+		&light_update_pipeline, &light_cull_pipeline
+	}) {
+		if (slot->pending && slot->pending->ready) return true;
+	}
+
+	return false;
+}
+
+void VkApp::DestroyRetiredPipelines(uint32_t i) {
+	for (vk::Pipeline pipeline : retired_pipelines[i]) device.destroyPipeline(pipeline, allocator);
+	retired_pipelines[i].clear();
 }
 
-void VkApp::CreateFramebuffers() {
-	swapchain_framebuffers.resize(swapchain_imageviews.size());
+void VkApp::DestroyPipelineSlot(PipelineSlot& slot) {
+	// Only valid once the compiler has been stopped
+	if (slot.pending && slot.pending->ready) {
+		device.destroyPipeline(slot.pending->pipeline, allocator);
+	}
+	slot.pending.reset();
+
+	if (slot.pipeline) device.destroyPipeline(slot.pipeline, allocator);
+	slot.pipeline = nullptr;
+}
 
-	for (size_t i = 0; i < swapchain_imageviews.size(); i++) {
-		vk::ImageView attachments[] = { swapchain_imageviews[i] };
+void VkApp::CreateFramebuffers(Output& output) {
+	for (auto framebuffer : output.framebuffers) device.destroyFramebuffer(framebuffer, allocator);
+	output.framebuffers.resize(output.imageviews.size());
+
+	for (size_t i = 0; i < output.imageviews.size(); i++) {
+		// Must match the attachment order in CreateRenderPass. The shared
+		// attachments may be larger than the window; only their top-left
+		// corner is rendered to.
+		vector<vk::ImageView> attachments = { output.imageviews[i], depth_image_view };
+		if (color_image_view) attachments.push_back(color_image_view);
+		if (gbuffer_albedo_view) {
+			attachments.push_back(gbuffer_albedo_view);
+			attachments.push_back(gbuffer_normal_view);
+		}
 
 		auto framebuffer_info = vk::FramebufferCreateInfo()
 		.setRenderPass(render_pass)
-		.setAttachmentCount(1)
-		.setPAttachments(attachments)
-		.setWidth(swapchain_extent.width)
-		.setHeight(swapchain_extent.height)
+		.setAttachmentCount((uint32_t) attachments.size())
+		.setPAttachments(attachments.data())
+		.setWidth(output.extent.width)
+		.setHeight(output.extent.height)
 		.setLayers(1);
 
-		if (swapchain_framebuffers[i]) device.destroyFramebuffer(swapchain_framebuffers[i]);
-		swapchain_framebuffers[i] = device.createFramebuffer(framebuffer_info);
+		output.framebuffers[i] = device.createFramebuffer(framebuffer_info, allocator);
 	}
 }
 
+vector<char> VkApp::ReadShader(const string& name) {
+	#ifdef _WIN32
+		return ReadFile("../../../shaders/" + name);
+	#else
+		return ReadFile("shaders/" + name);
+	#endif
+}
+
 vector<char> VkApp::ReadFile(const string& filename) {
 	std::ifstream file(filename, std::ios::ate | std::ios::binary);
 	if (!file.is_open()) {
@@ -744,212 +1505,2375 @@ vector<char> VkApp::ReadFile(const string& filename) {
 	return buffer;
 }
 
-void VkApp::CreateShaderModule(const vector<char>& code, vk::ShaderModule& module) {
+void VkApp::CreateShaderModule(
+	vk::Device device, const vector<char>& code, vk::ShaderModule& module,
+	const vk::AllocationCallbacks* allocator
+) {
 	vk::ShaderModuleCreateInfo module_info = vk::ShaderModuleCreateInfo()
 	.setCodeSize(code.size())
 	.setPCode((uint32_t*) code.data());
 
-	module = device.createShaderModule(module_info);
+	module = device.createShaderModule(module_info, allocator);
 }
 
 void VkApp::CreateRenderPass() {
-	auto color_attachment = vk::AttachmentDescription()
+	depth_format = FindDepthFormat();
+
+	// Input attachments are read per pixel, not per sample, so the
+	// deferred path renders single-sampled
+	msaa_samples = deferred ? vk::SampleCountFlagBits::e1 : ChooseSampleCount(requested_samples);
+	if (deferred && requested_samples > 1) cout << "MSAA is not used with deferred shading" << endl;
+
+	bool multisampled = msaa_samples != vk::SampleCountFlagBits::e1;
+
+	// Attachment 0 is always the swapchain image. With MSAA it only receives
+	// the resolve, so its old contents are never loaded.
+	auto present_attachment = vk::AttachmentDescription()
 	.setFormat(swapchain_format)
 	.setSamples(vk::SampleCountFlagBits::e1)
-	.setLoadOp(vk::AttachmentLoadOp::eClear)
+	.setLoadOp(multisampled ? vk::AttachmentLoadOp::eDontCare : vk::AttachmentLoadOp::eClear)
 	.setStoreOp(vk::AttachmentStoreOp::eStore)
 	.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
 	.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
 	.setInitialLayout(vk::ImageLayout::eUndefined)
 	.setFinalLayout(vk::ImageLayout::ePresentSrcKHR);
 
+	// Depth only lives for the duration of the pass
+	auto depth_attachment = vk::AttachmentDescription()
+	.setFormat(depth_format)
+	.setSamples(msaa_samples)
+	.setLoadOp(vk::AttachmentLoadOp::eClear)
+	.setStoreOp(vk::AttachmentStoreOp::eDontCare)
+	.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+	.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+	.setInitialLayout(vk::ImageLayout::eUndefined)
+	.setFinalLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
+
+	// The multisampled samples are resolved inside the subpass and then
+	// thrown away, so on tiled GPUs they never leave on-chip memory
+	auto msaa_attachment = vk::AttachmentDescription()
+	.setFormat(swapchain_format)
+	.setSamples(msaa_samples)
+	.setLoadOp(vk::AttachmentLoadOp::eClear)
+	.setStoreOp(vk::AttachmentStoreOp::eDontCare)
+	.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+	.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+	.setInitialLayout(vk::ImageLayout::eUndefined)
+	.setFinalLayout(vk::ImageLayout::eColorAttachmentOptimal);
+
 	auto color_attachment_ref = vk::AttachmentReference()
+	.setAttachment(multisampled ? 2 : 0)
+	.setLayout(vk::ImageLayout::eColorAttachmentOptimal);
+
+	auto resolve_attachment_ref = vk::AttachmentReference()
 	.setAttachment(0)
 	.setLayout(vk::ImageLayout::eColorAttachmentOptimal);
 
-	vk::SubpassDescription subpass;
-	subpass.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
-	.setColorAttachmentCount(1)
-	.setPColorAttachments(&color_attachment_ref);
+	auto depth_attachment_ref = vk::AttachmentReference()
+	.setAttachment(1)
+	.setLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
 
-	auto dependency = vk::SubpassDependency()
-	.setSrcSubpass(VK_SUBPASS_EXTERNAL)
-	.setDstSubpass(0)
-	.setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
-	.setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
-	.setDstAccessMask(
-		vk::AccessFlagBits::eColorAttachmentRead |
+	// Deferred only: the G-buffer lives for the duration of the pass, and
+	// the lighting subpass reads it (and depth) from tile memory
+	auto gbuffer_attachment = vk::AttachmentDescription()
+	.setSamples(vk::SampleCountFlagBits::e1)
+	.setLoadOp(vk::AttachmentLoadOp::eDontCare)
+	.setStoreOp(vk::AttachmentStoreOp::eDontCare)
+	.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+	.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+	.setInitialLayout(vk::ImageLayout::eUndefined)
+	.setFinalLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+
+	auto albedo_attachment = gbuffer_attachment;
+	albedo_attachment.setFormat(gbuffer_albedo_format);
+	auto normal_attachment = gbuffer_attachment;
+	normal_attachment.setFormat(gbuffer_normal_format);
+
+	vk::AttachmentReference gbuffer_output_refs[] = {
+		vk::AttachmentReference(2, vk::ImageLayout::eColorAttachmentOptimal),
+		vk::AttachmentReference(3, vk::ImageLayout::eColorAttachmentOptimal)
+	};
+
+	// Order matches input_attachment_index in lighting.frag
+	vk::AttachmentReference gbuffer_input_refs[] = {
+		vk::AttachmentReference(2, vk::ImageLayout::eShaderReadOnlyOptimal),
+		vk::AttachmentReference(3, vk::ImageLayout::eShaderReadOnlyOptimal),
+		vk::AttachmentReference(1, vk::ImageLayout::eDepthStencilReadOnlyOptimal)
+	};
+
+	// Lighting reads depth as an input while what is drawn after it still
+	// tests against it, so the subpass has it read-only in both roles
+	auto depth_read_only_ref = vk::AttachmentReference()
+	.setAttachment(1)
+	.setLayout(vk::ImageLayout::eDepthStencilReadOnlyOptimal);
+
+	vector<vk::SubpassDescription> subpasses;
+	vector<vk::SubpassDependency> dependencies;
+
+	geometry_subpass = depth_prepass ? 1 : 0;
+	color_subpass = deferred ? geometry_subpass + 1 : geometry_subpass;
+
+	if (depth_prepass) {
+		vk::SubpassDescription prepass;
+		prepass.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+		.setColorAttachmentCount(0)
+		.setPDepthStencilAttachment(&depth_attachment_ref);
+		subpasses.push_back(prepass);
+
+		// Shading only starts once the prepass has finished writing depth
+		dependencies.push_back(vk::SubpassDependency()
+		.setSrcSubpass(0)
+		.setDstSubpass(geometry_subpass)
+		.setSrcStageMask(vk::PipelineStageFlagBits::eLateFragmentTests)
+		.setDstStageMask(vk::PipelineStageFlagBits::eEarlyFragmentTests)
+		.setSrcAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentWrite)
+		.setDstAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentRead)
+		.setDependencyFlags(vk::DependencyFlagBits::eByRegion));
+	}
+
+	if (deferred) {
+		vk::SubpassDescription geometry;
+		geometry.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+		.setColorAttachmentCount(2)
+		.setPColorAttachments(gbuffer_output_refs)
+		.setPDepthStencilAttachment(&depth_attachment_ref);
+		subpasses.push_back(geometry);
+
+		vk::SubpassDescription lighting;
+		lighting.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+		.setInputAttachmentCount(3)
+		.setPInputAttachments(gbuffer_input_refs)
+		.setColorAttachmentCount(1)
+		.setPColorAttachments(&color_attachment_ref)
+		.setPDepthStencilAttachment(&depth_read_only_ref);
+		subpasses.push_back(lighting);
+
+		// By region: each pixel is lit from the G-buffer values at that
+		// same pixel, which is what lets tiled GPUs keep them on-chip
+		dependencies.push_back(vk::SubpassDependency()
+		.setSrcSubpass(geometry_subpass)
+		.setDstSubpass(color_subpass)
+		.setSrcStageMask(
+			vk::PipelineStageFlagBits::eColorAttachmentOutput |
+			vk::PipelineStageFlagBits::eLateFragmentTests
+		)
+		.setDstStageMask(
+			vk::PipelineStageFlagBits::eFragmentShader |
+			vk::PipelineStageFlagBits::eEarlyFragmentTests
+		)
+		.setSrcAccessMask(
+			vk::AccessFlagBits::eColorAttachmentWrite |
+			vk::AccessFlagBits::eDepthStencilAttachmentWrite
+		)
+		.setDstAccessMask(
+			vk::AccessFlagBits::eInputAttachmentRead |
+			vk::AccessFlagBits::eDepthStencilAttachmentRead
+		)
+		.setDependencyFlags(vk::DependencyFlagBits::eByRegion));
+
+		// The G-buffer is shared by every frame like depth, so its writes
+		// wait for the previous frame's lighting to have read it
+		dependencies.push_back(vk::SubpassDependency()
+		.setSrcSubpass(VK_SUBPASS_EXTERNAL)
+		.setDstSubpass(geometry_subpass)
+		.setSrcStageMask(
+			vk::PipelineStageFlagBits::eColorAttachmentOutput |
+			vk::PipelineStageFlagBits::eFragmentShader
+		)
+		.setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+		.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+		.setDstAccessMask(vk::AccessFlagBits::eColorAttachmentWrite));
+	} else {
+		vk::SubpassDescription subpass;
+		subpass.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+		.setColorAttachmentCount(1)
+		.setPColorAttachments(&color_attachment_ref)
+		.setPResolveAttachments(multisampled ? &resolve_attachment_ref : nullptr)
+		.setPDepthStencilAttachment(&depth_attachment_ref);
+		subpasses.push_back(subpass);
+	}
+
+	// The overlay is drawn straight into the single-sampled image after the
+	// scene, with the resolve (if any) already done
+	auto hud_attachment_ref = vk::AttachmentReference()
+	.setAttachment(0)
+	.setLayout(vk::ImageLayout::eColorAttachmentOptimal);
+
+	uint32_t last_subpass = color_subpass;
+
+	if (hud_enabled) {
+		hud_subpass = color_subpass + 1;
+		last_subpass = hud_subpass;
+
+		vk::SubpassDescription overlay;
+		overlay.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+		.setColorAttachmentCount(1)
+		.setPColorAttachments(&hud_attachment_ref);
+		subpasses.push_back(overlay);
+
+		dependencies.push_back(vk::SubpassDependency()
+		.setSrcSubpass(color_subpass)
+		.setDstSubpass(hud_subpass)
+		.setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+		.setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+		.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+		.setDstAccessMask(
+			vk::AccessFlagBits::eColorAttachmentRead |
+			vk::AccessFlagBits::eColorAttachmentWrite
+		)
+		.setDependencyFlags(vk::DependencyFlagBits::eByRegion));
+	}
+
+	// The depth image is shared by every frame, so the first depth access
+	// has to wait for the previous frame's depth writes (and, deferred,
+	// its reads as an input attachment)
+	vk::PipelineStageFlags depth_src_stages = vk::PipelineStageFlagBits::eLateFragmentTests;
+	if (deferred) depth_src_stages |= vk::PipelineStageFlagBits::eFragmentShader;
+
+	dependencies.push_back(vk::SubpassDependency()
+	.setSrcSubpass(VK_SUBPASS_EXTERNAL)
+	.setDstSubpass(0)
+	.setSrcStageMask(depth_src_stages)
+	.setDstStageMask(vk::PipelineStageFlagBits::eEarlyFragmentTests)
+	.setSrcAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentWrite)
+	.setDstAccessMask(
+		vk::AccessFlagBits::eDepthStencilAttachmentRead |
+		vk::AccessFlagBits::eDepthStencilAttachmentWrite
+	));
+
+	// Same for the multisampled color image; the resolve also writes in
+	// the color attachment output stage
+	dependencies.push_back(vk::SubpassDependency()
+	.setSrcSubpass(VK_SUBPASS_EXTERNAL)
+	.setDstSubpass(color_subpass)
+	.setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+	.setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+	.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+	.setDstAccessMask(
+		vk::AccessFlagBits::eColorAttachmentRead |
 		vk::AccessFlagBits::eColorAttachmentWrite
+	));
+
+	// Capture copies the swapchain image right after the pass
+	if (capture_enabled) {
+		dependencies.push_back(vk::SubpassDependency()
+		.setSrcSubpass(last_subpass)
+		.setDstSubpass(VK_SUBPASS_EXTERNAL)
+		.setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+		.setDstStageMask(vk::PipelineStageFlagBits::eTransfer)
+		.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+		.setDstAccessMask(vk::AccessFlagBits::eTransferRead));
+	}
+
+	vector<vk::AttachmentDescription> attachments = { present_attachment, depth_attachment };
+	if (multisampled) attachments.push_back(msaa_attachment);
+	if (deferred) {
+		attachments.push_back(albedo_attachment);
+		attachments.push_back(normal_attachment);
+	}
+
+	vk::RenderPassCreateInfo renderpass_info;
+	renderpass_info.setAttachmentCount((uint32_t) attachments.size())
+	.setPAttachments(attachments.data())
+	.setSubpassCount((uint32_t) subpasses.size())
+	.setPSubpasses(subpasses.data())
+	.setDependencyCount((uint32_t) dependencies.size())
+	.setPDependencies(dependencies.data());
+
+	if (render_pass) device.destroyRenderPass(render_pass, allocator);
+	render_pass = device.createRenderPass(renderpass_info, allocator);
+}
+
+void VkApp::SetSceneVariant(const SceneVariant& variant) {
+	scene_variant = variant;
+	scene_variant.position_scale = 1.0f;
+
+	// Quantized positions are stored relative to the largest coordinate
+	if (scene_variant.quantized) {
+		float extent = 0.0f;
+		for (const Vertex& vertex : vertices) {
+			for (int k = 0; k < 3; k++) extent = std::max(extent, std::abs(vertex.pos[k]));
+		}
+		if (extent > 0.0f) scene_variant.position_scale = extent;
+	}
+}
+
+void VkApp::SetDepthPrepass(bool enabled) {
+	depth_prepass = enabled;
+}
+
+void VkApp::SetSampleCount(uint32_t samples) {
+	requested_samples = std::max(samples, 1u);
+}
+
+vk::SampleCountFlagBits VkApp::GetSampleCount() const {
+	return msaa_samples;
+}
+
+vk::SampleCountFlagBits VkApp::ChooseSampleCount(uint32_t requested) {
+	auto limits = physical_device.getProperties().limits;
+	vk::SampleCountFlags supported =
+		limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts;
+
+	// Highest supported count that does not exceed the request
+	const vk::SampleCountFlagBits counts[] = {
+		vk::SampleCountFlagBits::e64, vk::SampleCountFlagBits::e32,
+		vk::SampleCountFlagBits::e16, vk::SampleCountFlagBits::e8,
+		vk::SampleCountFlagBits::e4, vk::SampleCountFlagBits::e2
+	};
+	for (vk::SampleCountFlagBits count : counts) {
+		if ((uint32_t) count <= requested && (supported & count)) return count;
+	}
+
+	return vk::SampleCountFlagBits::e1;
+}
+
+vk::Format VkApp::FindSupportedFormat(
+	const vector<vk::Format>& candidates,
+	vk::ImageTiling tiling, vk::FormatFeatureFlags features
+) {
+	for (vk::Format format : candidates) {
+		auto properties = physical_device.getFormatProperties(format);
+
+		vk::FormatFeatureFlags supported = tiling == vk::ImageTiling::eLinear
+			? properties.linearTilingFeatures
+			: properties.optimalTilingFeatures;
+
+		if ((supported & features) == features) return format;
+	}
+
+	throw std::runtime_error("Failed to find a supported format");
+}
+
+vk::Format VkApp::FindDepthFormat() {
+	// Most precise first; no stencil is used, so the pure depth format wins
+	return FindSupportedFormat(
+		{
+			vk::Format::eD32Sfloat,
+			vk::Format::eD32SfloatS8Uint,
+			vk::Format::eD24UnormS8Uint,
+			vk::Format::eD16Unorm
+		},
+		vk::ImageTiling::eOptimal,
+		vk::FormatFeatureFlagBits::eDepthStencilAttachment
+	);
+}
+
+void VkApp::CreateDepthResources() {
+	DestroyDepthResources();
+
+	// Deferred lighting reads depth back as an input attachment
+	vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eDepthStencilAttachment;
+	if (deferred) usage |= vk::ImageUsageFlagBits::eInputAttachment;
+
+	depth_image = CreateAttachmentImage(
+		depth_format,
+		usage,
+		msaa_samples,
+		depth_image_memory
+	);
+	depth_image_view = CreateImageView(
+		depth_image, depth_format, vk::ImageAspectFlagBits::eDepth, 1
+	);
+}
+
+void VkApp::DestroyDepthResources() {
+	if (!depth_image) return;
+
+	device.destroyImageView(depth_image_view, allocator);
+	device.destroyImage(depth_image, allocator);
+	FreeDeviceMemory(depth_image_memory);
+
+	depth_image = nullptr;
+	depth_image_view = nullptr;
+	depth_image_memory = nullptr;
+}
+
+void VkApp::CreateColorResources() {
+	DestroyColorResources();
+
+	if (msaa_samples == vk::SampleCountFlagBits::e1) return;
+
+	color_image = CreateAttachmentImage(
+		swapchain_format,
+		vk::ImageUsageFlagBits::eColorAttachment,
+		msaa_samples,
+		color_image_memory
+	);
+	color_image_view = CreateImageView(
+		color_image, swapchain_format, vk::ImageAspectFlagBits::eColor, 1
+	);
+}
+
+void VkApp::DestroyColorResources() {
+	if (!color_image) return;
+
+	device.destroyImageView(color_image_view, allocator);
+	device.destroyImage(color_image, allocator);
+	FreeDeviceMemory(color_image_memory);
+
+	color_image = nullptr;
+	color_image_view = nullptr;
+	color_image_memory = nullptr;
+}
+
+vk::Image VkApp::CreateAttachmentImage(
+	vk::Format format, vk::ImageUsageFlags usage,
+	vk::SampleCountFlagBits samples, vk::DeviceMemory& memory
+) {
+	// These attachments are never loaded or stored, so they can be transient.
+	// Where the image can live in lazily allocated memory (tiled GPUs) it
+	// may then never get physical backing at all; a device that has such
+	// memory but not for this image gets plain device-local memory.
+	return CreateImage(
+		attachment_extent.width, attachment_extent.height, 1,
+		format, vk::ImageTiling::eOptimal,
+		usage | vk::ImageUsageFlagBits::eTransientAttachment,
+		vk::MemoryPropertyFlagBits::eDeviceLocal,
+		memory,
+		samples,
+		vk::MemoryPropertyFlagBits::eLazilyAllocated
+	);
+}
+
+void VkApp::SetParticleCapacity(uint32_t capacity) {
+	particle_capacity = capacity;
+}
+
+void VkApp::CreateParticleSystem() {
+	if (particle_capacity == 0) return;
+
+	static_assert(sizeof(ParticleCounters) == 48, "ParticleCounters must match the shaders");
+
+	// The draw arguments are fixed apart from the instance count, which
+	// the GPU fills in every frame
+	ParticleCounters counters = {};
+	counters.draw.vertexCount = 6;
+	vk::DeviceSize counters_size = sizeof(counters);
+
+	vk::Buffer staging_buffer;
+	vk::DeviceMemory staging_buffer_memory;
+	staging_buffer = CreateBuffer(
+		counters_size,
+		vk::BufferUsageFlagBits::eTransferSrc,
+		vk::MemoryPropertyFlagBits::eHostVisible |
+		vk::MemoryPropertyFlagBits::eHostCoherent,
+		staging_buffer_memory
+	);
+
+	void* data;
+	data = device.mapMemory(staging_buffer_memory, 0, counters_size, {});
+	memcpy(data, &counters, sizeof(counters));
+	device.unmapMemory(staging_buffer_memory);
+
+	particle_counters = CreateBuffer(
+		counters_size,
+		vk::BufferUsageFlagBits::eStorageBuffer |
+		vk::BufferUsageFlagBits::eIndirectBuffer |
+		vk::BufferUsageFlagBits::eTransferSrc |
+		vk::BufferUsageFlagBits::eTransferDst,
+		vk::MemoryPropertyFlagBits::eDeviceLocal,
+		particle_counters_memory
+	);
+
+	CopyBuffer(staging_buffer, particle_counters, counters_size);
+
+	device.destroyBuffer(staging_buffer, allocator);
+	FreeDeviceMemory(staging_buffer_memory);
+
+	// Never read or written by the CPU, so no initial contents either
+	vk::DeviceSize list_size = (vk::DeviceSize) particle_capacity * sizeof(glm::vec4);
+	for (int i = 0; i < 2; i++) {
+		particle_positions[i] = CreateBuffer(
+			list_size,
+			vk::BufferUsageFlagBits::eStorageBuffer,
+			vk::MemoryPropertyFlagBits::eDeviceLocal,
+			particle_positions_memory[i]
+		);
+		particle_velocities[i] = CreateBuffer(
+			list_size,
+			vk::BufferUsageFlagBits::eStorageBuffer,
+			vk::MemoryPropertyFlagBits::eDeviceLocal,
+			particle_velocities_memory[i]
+		);
+	}
+
+	particle_list = 0;
+	particle_emit_budget = 0.0f;
+
+	CreateParticleDescriptors();
+	CreateParticlePipelines();
+}
+
+void VkApp::CreateParticleDescriptors() {
+	// Compute: counters, then the current list (in) and the other one (out).
+	// The three passes share one layout, so it covers all of their bindings.
+	ShaderInterface compute = ShaderInterface::Reflect(ReadShader("particle_emit-c.spv"));
+	compute.Merge(ShaderInterface::Reflect(ReadShader("particle_simulate-c.spv")));
+	compute.Merge(ShaderInterface::Reflect(ReadShader("particle_compact-c.spv")));
+
+	// Draw: the camera, then the list that was just compacted
+	ShaderInterface draw = ShaderInterface::Reflect(ReadShader("particle-v.spv"));
+	draw.Merge(ShaderInterface::Reflect(ReadShader("particle-f.spv")));
+
+	if (compute.GetSetBindings(0).size() != 5 || draw.GetSetBindings(0).size() != 3) {
+		throw std::runtime_error("Particle shaders do not match the particle descriptors");
+	}
+
+	particle_compute_set_layout = layout_cache.GetSetLayout(compute, 0);
+	particle_draw_set_layout = layout_cache.GetSetLayout(draw, 0);
+	particle_compute_layout = layout_cache.GetPipelineLayout(compute);
+	particle_draw_layout = layout_cache.GetPipelineLayout(draw);
+
+	vk::DescriptorPoolSize pool_sizes[2];
+	pool_sizes[0]
+	.setType(vk::DescriptorType::eStorageBuffer)
+	.setDescriptorCount(2 * 5 + 2 * 2);
+	pool_sizes[1]
+	.setType(vk::DescriptorType::eUniformBuffer)
+	.setDescriptorCount(2);
+
+	auto pool_info = vk::DescriptorPoolCreateInfo()
+	.setPoolSizeCount(2)
+	.setPPoolSizes(pool_sizes)
+	.setMaxSets(4);
+	particle_descriptor_pool = device.createDescriptorPool(pool_info, allocator);
+
+	vk::DescriptorSetLayout layouts[] = {
+		particle_compute_set_layout, particle_compute_set_layout,
+		particle_draw_set_layout, particle_draw_set_layout
+	};
+
+	auto alloc_info = vk::DescriptorSetAllocateInfo()
+	.setDescriptorPool(particle_descriptor_pool)
+	.setDescriptorSetCount(4)
+	.setPSetLayouts(layouts);
+
+	vk::DescriptorSet sets[4];
+	device.allocateDescriptorSets(&alloc_info, sets);
+
+	auto storage = [](vk::Buffer buffer) {
+		return vk::DescriptorBufferInfo().setBuffer(buffer).setOffset(0).setRange(VK_WHOLE_SIZE);
+	};
+	auto write = [](vk::DescriptorSet set, uint32_t binding, vk::DescriptorType type, const vk::DescriptorBufferInfo* info) {
+		return vk::WriteDescriptorSet()
+		.setDstSet(set)
+		.setDstBinding(binding)
+		.setDstArrayElement(0)
+		.setDescriptorType(type)
+		.setDescriptorCount(1)
+		.setPBufferInfo(info);
+	};
+
+	auto camera_info = vk::DescriptorBufferInfo()
+	.setBuffer(uniform_buffer)
+	.setOffset(0)
+	.setRange(sizeof(UniformBufferObject));
+
+	for (int list = 0; list < 2; list++) {
+		int other = 1 - list;
+
+		particle_compute_sets[list] = sets[list];
+		particle_draw_sets[list] = sets[2 + list];
+
+		vk::DescriptorBufferInfo compute_infos[5] = {
+			storage(particle_counters),
+			storage(particle_positions[list]), storage(particle_velocities[list]),
+			storage(particle_positions[other]), storage(particle_velocities[other])
+		};
+		vk::DescriptorBufferInfo draw_infos[2] = {
+			storage(particle_positions[list]), storage(particle_velocities[list])
+		};
+
+		vector<vk::WriteDescriptorSet> writes;
+		for (uint32_t b = 0; b < 5; b++) {
+			writes.push_back(write(sets[list], b, vk::DescriptorType::eStorageBuffer, &compute_infos[b]));
+		}
+		writes.push_back(write(sets[2 + list], 0, vk::DescriptorType::eUniformBuffer, &camera_info));
+		writes.push_back(write(sets[2 + list], 1, vk::DescriptorType::eStorageBuffer, &draw_infos[0]));
+		writes.push_back(write(sets[2 + list], 2, vk::DescriptorType::eStorageBuffer, &draw_infos[1]));
+
+		device.updateDescriptorSets(writes, {});
+	}
+}
+
+void VkApp::CreateParticlePipelines() {
+	CompileComputePipeline(particle_emit_pipeline, particle_compute_layout, ReadShader("particle_emit-c.spv"));
+	CompileComputePipeline(particle_simulate_pipeline, particle_compute_layout, ReadShader("particle_simulate-c.spv"));
+	CompileComputePipeline(particle_compact_pipeline, particle_compute_layout, ReadShader("particle_compact-c.spv"));
+
+	// The headless check has no render pass and draws nothing
+	if (!render_pass) return;
+
+	// Drawn after the scene in the shading subpass: tested against the
+	// scene's depth but never written, and blended additively so the
+	// order of the particles does not matter
+	GraphicsPipelineDesc draw_desc;
+	draw_desc.layout = particle_draw_layout;
+	draw_desc.render_pass = render_pass;
+	draw_desc.subpass = color_subpass;
+	draw_desc.allocator = allocator;
+	draw_desc.samples = msaa_samples;
+	draw_desc.vertex_code = ReadShader("particle-v.spv");
+	draw_desc.fragment_code = ReadShader("particle-f.spv");
+	draw_desc.blend = BlendMode::Additive;
+	draw_desc.depth_write = false;
+	draw_desc.cull_mode = vk::CullModeFlagBits::eNone;
+
+	CompilePipeline(particle_draw_pipeline, draw_desc);
+}
+
+void VkApp::DestroyParticleSystem() {
+	if (particle_capacity == 0) return;
+
+	DestroyPipelineSlot(particle_emit_pipeline);
+	DestroyPipelineSlot(particle_simulate_pipeline);
+	DestroyPipelineSlot(particle_compact_pipeline);
+	DestroyPipelineSlot(particle_draw_pipeline);
+
+	// The layouts belong to the layout cache
+	device.destroyDescriptorPool(particle_descriptor_pool, allocator);
+
+	for (int i = 0; i < 2; i++) {
+		device.destroyBuffer(particle_positions[i], allocator);
+		FreeDeviceMemory(particle_positions_memory[i]);
+		device.destroyBuffer(particle_velocities[i], allocator);
+		FreeDeviceMemory(particle_velocities_memory[i]);
+	}
+
+	device.destroyBuffer(particle_counters, allocator);
+	FreeDeviceMemory(particle_counters_memory);
+}
+
+bool VkApp::ParticlesReady() {
+	return particle_capacity > 0
+		&& particle_emit_pipeline.pipeline && particle_simulate_pipeline.pipeline
+		&& particle_compact_pipeline.pipeline && particle_draw_pipeline.pipeline;
+}
+
+void VkApp::RecordParticleUpdate(vk::CommandBuffer command_buffer) {
+	// Emit enough to keep the system near capacity at the mean lifetime
+	const float mean_lifetime = 2.0f;
+	particle_emit_budget += particle_dt * particle_capacity / mean_lifetime;
+
+	uint32_t emit_count = (uint32_t) std::min(particle_emit_budget, (float) particle_capacity);
+	particle_emit_budget -= emit_count;
+
+	ParticleParams& params = particle_params;
+	params.emitter = glm::vec4(0.0f, 0.0f, 0.1f, 0.4f);
+	params.dt = particle_dt;
+	params.emit_count = emit_count;
+	params.capacity = particle_capacity;
+	params.seed = particle_seed++;
+
+	// The previous frame's passes and draw still use what this frame
+	// rewrites; barriers reach back into earlier submissions on the queue
+	auto reuse = vk::MemoryBarrier()
+	.setSrcAccessMask(
+		vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite |
+		vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eTransferWrite)
+	.setDstAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+
+	command_buffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eDrawIndirect |
+		vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::DependencyFlags(),
+		{ reuse }, {}, {}
+	);
+
+	command_buffer.bindDescriptorSets(
+		vk::PipelineBindPoint::eCompute, particle_compute_layout,
+		0, { particle_compute_sets[particle_list] }, {}
+	);
+	command_buffer.pushConstants(
+		particle_compute_layout, vk::ShaderStageFlagBits::eCompute,
+		0, sizeof(params), &params
+	);
+
+	// Emit also writes the dispatch size for the next two passes, so the
+	// CPU never needs to know how many particles are alive
+	command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, particle_emit_pipeline.pipeline);
+	command_buffer.dispatch((std::max(emit_count, 1u) + 255) / 256, 1, 1);
+	frame_stats.pipeline_binds++;
+	frame_stats.dispatches++;
+
+	auto compute_to_compute = vk::MemoryBarrier()
+	.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+	.setDstAccessMask(
+		vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite |
+		vk::AccessFlagBits::eIndirectCommandRead);
+
+	command_buffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect,
+		vk::DependencyFlags(),
+		{ compute_to_compute }, {}, {}
+	);
+
+	command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, particle_simulate_pipeline.pipeline);
+	command_buffer.dispatchIndirect(particle_counters, offsetof(ParticleCounters, dispatch));
+	frame_stats.pipeline_binds++;
+	frame_stats.dispatches++;
+
+	command_buffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::DependencyFlags(),
+		{ compute_to_compute }, {}, {}
+	);
+
+	command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, particle_compact_pipeline.pipeline);
+	command_buffer.dispatchIndirect(particle_counters, offsetof(ParticleCounters, dispatch));
+	frame_stats.pipeline_binds++;
+	frame_stats.dispatches++;
+
+	// The survivor count becomes both the live count and the instance
+	// count of the draw; then the append counter starts over
+	auto compute_to_transfer = vk::MemoryBarrier()
+	.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+	.setDstAccessMask(vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite);
+
+	command_buffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::PipelineStageFlagBits::eTransfer,
+		vk::DependencyFlags(),
+		{ compute_to_transfer }, {}, {}
+	);
+
+	vk::BufferCopy copies[2];
+	copies[0]
+	.setSrcOffset(offsetof(ParticleCounters, next))
+	.setDstOffset(offsetof(ParticleCounters, alive))
+	.setSize(sizeof(uint32_t));
+	copies[1]
+	.setSrcOffset(offsetof(ParticleCounters, next))
+	.setDstOffset(offsetof(ParticleCounters, draw) + offsetof(VkDrawIndirectCommand, instanceCount))
+	.setSize(sizeof(uint32_t));
+	command_buffer.copyBuffer(particle_counters, particle_counters, 2, copies);
+
+	auto copy_to_fill = vk::MemoryBarrier()
+	.setSrcAccessMask(vk::AccessFlagBits::eTransferRead)
+	.setDstAccessMask(vk::AccessFlagBits::eTransferWrite);
+
+	command_buffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eTransfer,
+		vk::DependencyFlags(),
+		{ copy_to_fill }, {}, {}
+	);
+
+	command_buffer.fillBuffer(particle_counters, offsetof(ParticleCounters, next), sizeof(uint32_t), 0);
+
+	auto to_draw = vk::MemoryBarrier()
+	.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite)
+	.setDstAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eIndirectCommandRead);
+
+	command_buffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eDrawIndirect,
+		vk::DependencyFlags(),
+		{ to_draw }, {}, {}
+	);
+}
+
+void VkApp::RecordParticleDraw(vk::CommandBuffer command_buffer) {
+	command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, particle_draw_pipeline.pipeline);
+	command_buffer.bindDescriptorSets(
+		vk::PipelineBindPoint::eGraphics, particle_draw_layout,
+		0, { particle_draw_sets[particle_list] }, {}
+	);
+	command_buffer.drawIndirect(
+		particle_counters, offsetof(ParticleCounters, draw), 1, sizeof(VkDrawIndirectCommand)
+	);
+
+	frame_stats.pipeline_binds++;
+	frame_stats.draw_calls++;
+}
+
+namespace {
+
+// The particle passes' bookkeeping on the CPU: the same hash picks every
+// new particle's lifetime, and the GPU's steps are all exact or correctly
+// rounded, so the counts have to agree exactly. Only age and lifetime
+// decide survival; positions are left out.
+class ParticleModel {
+public:
+	uint32_t total = 0;		// after emission, as the emit pass sees it
+
+	uint32_t Step(const ParticleParams& params) {
+		uint32_t alive = (uint32_t) particles.size();
+		total = std::min(alive + params.emit_count, params.capacity);
+
+		for (uint32_t id = 0; id < total - alive; id++) {
+			uint32_t state = Hash(id ^ Hash(params.seed));
+			for (int i = 0; i < 3; i++) Random(state);	// angle, radius, lift
+			particles.push_back(glm::vec2(0.0f, 1.0f + Random(state) * 2.0f));
+		}
+
+		for (glm::vec2& particle : particles) particle.x += params.dt;
+		particles.erase(std::remove_if(particles.begin(), particles.end(),
+			[](const glm::vec2& particle) { return !(particle.x < particle.y); }),
+			particles.end());
+
+		return (uint32_t) particles.size();
+	}
+
+private:
+	std::vector<glm::vec2> particles;		// age, lifetime
+
+	static uint32_t Hash(uint32_t x) {
+		x ^= x >> 16;
+		x *= 0x7feb352du;
+		x ^= x >> 15;
+		x *= 0x846ca68bu;
+		x ^= x >> 16;
+		return x;
+	}
+
+	static float Random(uint32_t& state) {
+		state = Hash(state);
+		return (float) state * (1.0f / 4294967296.0f);
+	}
+};
+
+}
+
+bool VkApp::RunParticleCheck(uint32_t frames) {
+	if (particle_capacity == 0) {
+		throw std::runtime_error("The particle check needs a particle capacity");
+	}
+
+	// Only what the particle passes use: no windows, swapchains or render
+	// pass, and so no swapchain extension either
+	headless = true;
+	deviceExtensions.clear();
+
+	CreateInstance();
+	SetupDebugCallback();
+	PickPhysicalDevice();
+	CreateLogicalDevice();
+	CreatePipelineCache();
+	CreateCommandPool();
+	CreateUniformBuffer();
+	CreateParticleSystem();
+
+	// The compute pipelines are built on the compiler thread
+	while (!particle_emit_pipeline.pipeline || !particle_simulate_pipeline.pipeline
+		|| !particle_compact_pipeline.pipeline) {
+		UpdatePipelineSlot(particle_emit_pipeline);
+		UpdatePipelineSlot(particle_simulate_pipeline);
+		UpdatePipelineSlot(particle_compact_pipeline);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	vk::DeviceMemory readback_memory;
+	vk::Buffer readback = CreateBuffer(
+		sizeof(ParticleCounters),
+		vk::BufferUsageFlagBits::eTransferDst,
+		vk::MemoryPropertyFlagBits::eHostVisible |
+		vk::MemoryPropertyFlagBits::eHostCoherent,
+		readback_memory
+	);
+	auto counters = (const ParticleCounters*) device.mapMemory(
+		readback_memory, 0, sizeof(ParticleCounters), {}
+	);
+
+	auto alloc_info = vk::CommandBufferAllocateInfo()
+	.setLevel(vk::CommandBufferLevel::ePrimary)
+	.setCommandPool(command_pool)
+	.setCommandBufferCount(1);
+
+	vk::CommandBuffer command_buffer;
+	device.allocateCommandBuffers(&alloc_info, &command_buffer);
+	vk::Fence fence = device.createFence({}, allocator);
+
+	// A fixed step, so every run (and the model) sees the same emission
+	particle_dt = 1.0f / 60.0f;
+
+	ParticleModel model;
+	uint32_t expected = 0;
+	double step_ms = 0.0;
+	bool ok = true;
+
+	for (uint32_t frame = 0; frame < frames && ok; frame++) {
+		command_buffer.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+
+		RecordParticleUpdate(command_buffer);
+		particle_list = 1 - particle_list;
+
+		auto to_copy = vk::MemoryBarrier()
+		.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite)
+		.setDstAccessMask(vk::AccessFlagBits::eTransferRead);
+
+		command_buffer.pipelineBarrier(
+			vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::DependencyFlags(),
+			{ to_copy }, {}, {}
+		);
+
+		auto region = vk::BufferCopy()
+		.setSrcOffset(0)
+		.setDstOffset(0)
+		.setSize(sizeof(ParticleCounters));
+		command_buffer.copyBuffer(particle_counters, readback, 1, &region);
+
+		auto to_host = vk::MemoryBarrier()
+		.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+		.setDstAccessMask(vk::AccessFlagBits::eHostRead);
+
+		command_buffer.pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eHost,
+			vk::DependencyFlags(),
+			{ to_host }, {}, {}
+		);
+
+		command_buffer.end();
+
+		auto submit_info = vk::SubmitInfo()
+		.setCommandBufferCount(1)
+		.setPCommandBuffers(&command_buffer);
+
+		auto start = std::chrono::steady_clock::now();
+		graphics_queue.submit({ submit_info }, fence);
+		device.waitForFences({ fence }, true, std::numeric_limits<uint64_t>::max());
+		step_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		device.resetFences({ fence });
+		command_buffer.reset({});
+
+		expected = model.Step(particle_params);
+
+		if (counters->alive > particle_capacity) {
+			std::cerr << "Frame " << frame << ": " << counters->alive
+				<< " particles alive, capacity " << particle_capacity << endl;
+			ok = false;
+		} else if (counters->total != model.total || counters->alive != expected) {
+			std::cerr << "Frame " << frame << ": " << counters->total << " after emission and "
+				<< counters->alive << " alive, expected " << model.total << " and " << expected << endl;
+			ok = false;
+		} else if (counters->draw.instanceCount != counters->alive || counters->next != 0) {
+			std::cerr << "Frame " << frame << ": draw count " << counters->draw.instanceCount
+				<< " and append counter " << counters->next << " after " << counters->alive
+				<< " alive" << endl;
+			ok = false;
+		}
+	}
+
+	if (ok) {
+		cout << frames << " steps of up to " << particle_capacity << " particles: "
+			<< expected << " alive at the end, as expected; "
+			<< (frames ? step_ms / frames : 0.0) << " ms per step" << endl;
+	}
+
+	device.freeCommandBuffers(command_pool, { command_buffer });
+	device.destroyFence(fence, allocator);
+	device.unmapMemory(readback_memory);
+	device.destroyBuffer(readback, allocator);
+	FreeDeviceMemory(readback_memory);
+
+	Cleanup();
+	return ok;
+}
+
+void VkApp::SetDeferred(bool enabled) {
+	deferred = enabled;
+}
+
+void VkApp::SetLightCount(uint32_t count) {
+	light_count = std::max(count, 1u);
+}
+
+void VkApp::CreateGBuffer() {
+	DestroyGBuffer();
+
+	if (!deferred) return;
+
+	// Written and read inside the render pass only, so these are transient
+	// like the depth and multisampled color targets
+	vk::ImageUsageFlags usage =
+		vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eInputAttachment;
+
+	gbuffer_albedo = CreateAttachmentImage(
+		gbuffer_albedo_format, usage, vk::SampleCountFlagBits::e1, gbuffer_albedo_memory
+	);
+	gbuffer_albedo_view = CreateImageView(
+		gbuffer_albedo, gbuffer_albedo_format, vk::ImageAspectFlagBits::eColor, 1
+	);
+
+	gbuffer_normal = CreateAttachmentImage(
+		gbuffer_normal_format, usage, vk::SampleCountFlagBits::e1, gbuffer_normal_memory
+	);
+	gbuffer_normal_view = CreateImageView(
+		gbuffer_normal, gbuffer_normal_format, vk::ImageAspectFlagBits::eColor, 1
 	);
+}
+
+void VkApp::DestroyGBuffer() {
+	if (!gbuffer_albedo) return;
+
+	device.destroyImageView(gbuffer_albedo_view, allocator);
+	device.destroyImage(gbuffer_albedo, allocator);
+	FreeDeviceMemory(gbuffer_albedo_memory);
+
+	device.destroyImageView(gbuffer_normal_view, allocator);
+	device.destroyImage(gbuffer_normal, allocator);
+	FreeDeviceMemory(gbuffer_normal_memory);
+
+	gbuffer_albedo = nullptr;
+	gbuffer_albedo_view = nullptr;
+	gbuffer_albedo_memory = nullptr;
+	gbuffer_normal = nullptr;
+	gbuffer_normal_view = nullptr;
+	gbuffer_normal_memory = nullptr;
+}
+
+void VkApp::CreateDeferredLighting() {
+	if (!deferred) return;
+
+	// Lights drift around the stack of quads on orbits about z: mostly
+	// point lights, every fourth a spot shining down at the quads
+	vk::DeviceSize lights_size = (vk::DeviceSize) light_count * sizeof(Light);
+	light_buffer = CreateBuffer(
+		lights_size,
+		vk::BufferUsageFlagBits::eStorageBuffer,
+		vk::MemoryPropertyFlagBits::eHostVisible |
+		vk::MemoryPropertyFlagBits::eHostCoherent,
+		light_buffer_memory
+	);
+
+	// Reach shrinks as lights are added, so roughly the same number
+	// overlaps any one point
+	float reach = glm::clamp(1.6f / std::cbrt((float) light_count), 0.1f, 0.8f);
+
+	Light* lights = (Light*) device.mapMemory(light_buffer_memory, 0, lights_size, {});
+	for (uint32_t l = 0; l < light_count; l++) {
+		float t = (l + 0.5f) / light_count;
+		float angle = l * 2.39996f;		// golden angle
+		float distance = 0.1f + 1.4f * std::sqrt(t);
+		bool spot = l % 4 == 3;
+
+		glm::vec3 hue = glm::clamp(
+			glm::abs(glm::fract(t + glm::vec3(0.0f, 2.0f / 3.0f, 1.0f / 3.0f)) * 6.0f - 3.0f) - 1.0f,
+			0.0f, 1.0f
+		);
+
+		lights[l].position_radius = glm::vec4(
+			distance * std::cos(angle), distance * std::sin(angle),
+			std::fmod(l * 0.618034f, 1.0f) * 1.7f - 0.4f,
+			spot ? 2.0f * reach : reach
+		);
+		lights[l].color = glm::vec4(hue, 1.5f);
+		lights[l].direction_cos = spot
+			? glm::vec4(glm::normalize(glm::vec3(std::cos(angle), std::sin(angle), -4.0f)), 0.9f)
+			: glm::vec4(0.0f, 0.0f, -1.0f, -2.0f);
+		lights[l].motion = glm::vec4(
+			(l % 2 ? 1.0f : -1.0f) * (0.2f + 0.6f * std::fmod(l * 0.381966f, 1.0f)),
+			0.1f, angle, 0.0f
+		);
+	}
+	device.unmapMemory(light_buffer_memory);
+
+	// Only ever touched by the GPU
+	uint32_t cluster_count = cluster_grid.width * cluster_grid.height * cluster_grid.depth;
+
+	frame_light_buffer = CreateBuffer(
+		(vk::DeviceSize) light_count * sizeof(FrameLight),
+		vk::BufferUsageFlagBits::eStorageBuffer,
+		vk::MemoryPropertyFlagBits::eDeviceLocal,
+		frame_light_buffer_memory
+	);
+	cluster_count_buffer = CreateBuffer(
+		(vk::DeviceSize) cluster_count * sizeof(uint32_t),
+		vk::BufferUsageFlagBits::eStorageBuffer,
+		vk::MemoryPropertyFlagBits::eDeviceLocal,
+		cluster_count_buffer_memory
+	);
+	cluster_index_buffer = CreateBuffer(
+		(vk::DeviceSize) cluster_count * cluster_grid.max_lights * sizeof(uint32_t),
+		vk::BufferUsageFlagBits::eStorageBuffer,
+		vk::MemoryPropertyFlagBits::eDeviceLocal,
+		cluster_index_buffer_memory
+	);
+
+	ShaderInterface cluster = ShaderInterface::Reflect(ReadShader("light_update-c.spv"));
+	cluster.Merge(ShaderInterface::Reflect(ReadShader("light_cull-c.spv")));
+
+	ShaderInterface lighting = ShaderInterface::Reflect(ReadShader("lighting-v.spv"));
+	lighting.Merge(ShaderInterface::Reflect(ReadShader("lighting-f.spv")));
+
+	if (cluster.push_constant_size != sizeof(ClusterParams)) {
+		throw std::runtime_error("Light culling shaders do not match ClusterParams");
+	}
+
+	cluster_set_layout = layout_cache.GetSetLayout(cluster, 0);
+	cluster_layout = layout_cache.GetPipelineLayout(cluster);
+	lighting_set_layout = layout_cache.GetSetLayout(lighting, 0);
+	lighting_layout = layout_cache.GetPipelineLayout(lighting);
+
+	// Culling: camera, lights, frame lights, counts, indices. Lighting:
+	// camera, three inputs, frame lights, counts, indices.
+	vk::DescriptorPoolSize pool_sizes[3];
+	pool_sizes[0]
+	.setType(vk::DescriptorType::eUniformBuffer)
+	.setDescriptorCount(2);
+	pool_sizes[1]
+	.setType(vk::DescriptorType::eInputAttachment)
+	.setDescriptorCount(3);
+	pool_sizes[2]
+	.setType(vk::DescriptorType::eStorageBuffer)
+	.setDescriptorCount(4 + 3);
+
+	auto pool_info = vk::DescriptorPoolCreateInfo()
+	.setPoolSizeCount(3)
+	.setPPoolSizes(pool_sizes)
+	.setMaxSets(2);
+	lighting_descriptor_pool = device.createDescriptorPool(pool_info, allocator);
+
+	vk::DescriptorSetLayout layouts[] = { cluster_set_layout, lighting_set_layout };
+	auto alloc_info = vk::DescriptorSetAllocateInfo()
+	.setDescriptorPool(lighting_descriptor_pool)
+	.setDescriptorSetCount(2)
+	.setPSetLayouts(layouts);
+
+	vk::DescriptorSet sets[2];
+	device.allocateDescriptorSets(&alloc_info, sets);
+	cluster_set = sets[0];
+	lighting_set = sets[1];
+
+	auto storage = [](vk::Buffer buffer) {
+		return vk::DescriptorBufferInfo().setBuffer(buffer).setOffset(0).setRange(VK_WHOLE_SIZE);
+	};
+
+	auto camera_info = vk::DescriptorBufferInfo()
+	.setBuffer(uniform_buffer)
+	.setOffset(0)
+	.setRange(sizeof(UniformBufferObject));
+
+	vk::DescriptorBufferInfo cluster_infos[4] = {
+		storage(light_buffer), storage(frame_light_buffer),
+		storage(cluster_count_buffer), storage(cluster_index_buffer)
+	};
+
+	vector<vk::WriteDescriptorSet> writes;
+	writes.push_back(vk::WriteDescriptorSet()
+	.setDstSet(cluster_set)
+	.setDstBinding(0)
+	.setDescriptorType(vk::DescriptorType::eUniformBuffer)
+	.setDescriptorCount(1)
+	.setPBufferInfo(&camera_info));
+
+	for (uint32_t b = 0; b < 4; b++) {
+		writes.push_back(vk::WriteDescriptorSet()
+		.setDstSet(cluster_set)
+		.setDstBinding(1 + b)
+		.setDescriptorType(vk::DescriptorType::eStorageBuffer)
+		.setDescriptorCount(1)
+		.setPBufferInfo(&cluster_infos[b]));
+	}
+
+	device.updateDescriptorSets(writes, {});
+	WriteLightingDescriptors();
+
+	// The grid is baked into the culling and lighting shaders alike
+	ShaderSpecialization grid = ShaderSpecialization::From(cluster_grid);
+
+	CompileComputePipeline(light_update_pipeline, cluster_layout, ReadShader("light_update-c.spv"));
+	CompileComputePipeline(light_cull_pipeline, cluster_layout, ReadShader("light_cull-c.spv"), grid);
+
+	// One triangle over the whole screen; depth is only read, through the
+	// input attachment
+	GraphicsPipelineDesc desc;
+	desc.layout = lighting_layout;
+	desc.render_pass = render_pass;
+	desc.subpass = color_subpass;
+	desc.allocator = allocator;
+	desc.vertex_code = ReadShader("lighting-v.spv");
+	desc.fragment_code = ReadShader("lighting-f.spv");
+	desc.specialization = grid;
+	desc.depth_test = false;
+	desc.depth_write = false;
+	desc.cull_mode = vk::CullModeFlagBits::eNone;
+
+	CompilePipeline(lighting_pipeline, desc);
+}
+
+void VkApp::WriteLightingDescriptors() {
+	// The G-buffer views change with the swapchain; the set is rewritten
+	// while the device is idle
+	if (!lighting_set) return;
+
+	auto camera_info = vk::DescriptorBufferInfo()
+	.setBuffer(uniform_buffer)
+	.setOffset(0)
+	.setRange(sizeof(UniformBufferObject));
+
+	vk::DescriptorImageInfo input_infos[3] = {
+		vk::DescriptorImageInfo(nullptr, gbuffer_albedo_view, vk::ImageLayout::eShaderReadOnlyOptimal),
+		vk::DescriptorImageInfo(nullptr, gbuffer_normal_view, vk::ImageLayout::eShaderReadOnlyOptimal),
+		vk::DescriptorImageInfo(nullptr, depth_image_view, vk::ImageLayout::eDepthStencilReadOnlyOptimal)
+	};
+
+	vk::DescriptorBufferInfo light_infos[3];
+	vk::Buffer light_buffers[3] = { frame_light_buffer, cluster_count_buffer, cluster_index_buffer };
+	for (uint32_t b = 0; b < 3; b++) {
+		light_infos[b].setBuffer(light_buffers[b]).setOffset(0).setRange(VK_WHOLE_SIZE);
+	}
+
+	vector<vk::WriteDescriptorSet> writes;
+	writes.push_back(vk::WriteDescriptorSet()
+	.setDstSet(lighting_set)
+	.setDstBinding(0)
+	.setDescriptorType(vk::DescriptorType::eUniformBuffer)
+	.setDescriptorCount(1)
+	.setPBufferInfo(&camera_info));
+
+	for (uint32_t a = 0; a < 3; a++) {
+		writes.push_back(vk::WriteDescriptorSet()
+		.setDstSet(lighting_set)
+		.setDstBinding(1 + a)
+		.setDescriptorType(vk::DescriptorType::eInputAttachment)
+		.setDescriptorCount(1)
+		.setPImageInfo(&input_infos[a]));
+	}
+
+	for (uint32_t b = 0; b < 3; b++) {
+		writes.push_back(vk::WriteDescriptorSet()
+		.setDstSet(lighting_set)
+		.setDstBinding(4 + b)
+		.setDescriptorType(vk::DescriptorType::eStorageBuffer)
+		.setDescriptorCount(1)
+		.setPBufferInfo(&light_infos[b]));
+	}
+
+	device.updateDescriptorSets(writes, {});
+}
+
+void VkApp::DestroyDeferredLighting() {
+	if (!deferred) return;
+
+	DestroyPipelineSlot(lighting_pipeline);
+	DestroyPipelineSlot(light_update_pipeline);
+	DestroyPipelineSlot(light_cull_pipeline);
+
+	// The layouts belong to the layout cache
+	device.destroyDescriptorPool(lighting_descriptor_pool, allocator);
+
+	for (auto buffer : {
+		std::make_pair(&light_buffer, &light_buffer_memory),
+		std::make_pair(&frame_light_buffer, &frame_light_buffer_memory),
+		std::make_pair(&cluster_count_buffer, &cluster_count_buffer_memory),
+		std::make_pair(&cluster_index_buffer, &cluster_index_buffer_memory)
+	}) {
+		device.destroyBuffer(*buffer.first, allocator);
+		FreeDeviceMemory(*buffer.second);
+		*buffer.first = nullptr;
+		*buffer.second = nullptr;
+	}
+
+	lighting_descriptor_pool = nullptr;
+	lighting_set = nullptr;
+	cluster_set = nullptr;
+}
+
+bool VkApp::LightingReady() {
+	// Lighting reads what culling wrote in the same frame, so all three
+	// have to be there before any of them is used
+	return lighting_pipeline.pipeline
+		&& light_update_pipeline.pipeline && light_cull_pipeline.pipeline;
+}
+
+void VkApp::RecordLightCulling(vk::CommandBuffer command_buffer) {
+	// Depth is stored OpenGL style; solve its two projection terms for the
+	// planes the slices are spread between
+	const glm::mat4& proj = uniforms.proj;
+
+	ClusterParams params;
+	params.inverse_proj = glm::inverse(proj);
+	params.near_plane = proj[3][2] / (proj[2][2] - 1.0f);
+	params.far_plane = proj[3][2] / (proj[2][2] + 1.0f);
+	params.time = animation_time;
+	params.light_count = light_count;
+
+	// The previous frame's lighting may still read what is rewritten here
+	auto reuse = vk::MemoryBarrier()
+	.setSrcAccessMask(vk::AccessFlagBits::eShaderRead)
+	.setDstAccessMask(vk::AccessFlagBits::eShaderWrite);
+
+	command_buffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader,
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::DependencyFlags(),
+		{ reuse }, {}, {}
+	);
+
+	command_buffer.bindDescriptorSets(
+		vk::PipelineBindPoint::eCompute, cluster_layout,
+		0, { cluster_set }, {}
+	);
+	command_buffer.pushConstants(
+		cluster_layout, vk::ShaderStageFlagBits::eCompute,
+		0, sizeof(params), &params
+	);
+
+	command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, light_update_pipeline.pipeline);
+	command_buffer.dispatch((light_count + 63) / 64, 1, 1);
+
+	auto moved = vk::MemoryBarrier()
+	.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+	.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+
+	command_buffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::DependencyFlags(),
+		{ moved }, {}, {}
+	);
+
+	// One invocation per cluster
+	uint32_t cluster_count = cluster_grid.width * cluster_grid.height * cluster_grid.depth;
+	command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, light_cull_pipeline.pipeline);
+	command_buffer.dispatch((cluster_count + 63) / 64, 1, 1);
+
+	auto culled = vk::MemoryBarrier()
+	.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+	.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+
+	command_buffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::PipelineStageFlagBits::eFragmentShader,
+		vk::DependencyFlags(),
+		{ culled }, {}, {}
+	);
+
+	frame_stats.pipeline_binds += 2;
+	frame_stats.dispatches += 2;
+}
+
+void VkApp::RecordLighting(vk::CommandBuffer command_buffer) {
+	command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, lighting_pipeline.pipeline);
+	command_buffer.bindDescriptorSets(
+		vk::PipelineBindPoint::eGraphics, lighting_layout,
+		0, { lighting_set }, {}
+	);
+	command_buffer.draw(3, 1, 0, 0);
+
+	frame_stats.pipeline_binds++;
+	frame_stats.draw_calls++;
+	frame_stats.triangles++;
+}
+
+void VkApp::SetHud(bool enabled) {
+	hud_enabled = enabled;
+}
+
+void VkApp::CreateHud() {
+	if (!hud_enabled) return;
+
+	ImageData atlas;
+	uint32_t atlas_width, atlas_height;
+	vector<uint8_t> pixels = HudBuilder::BuildFontAtlas(atlas_width, atlas_height);
+	memcpy(atlas.AddLevel(atlas_width, atlas_height, pixels.size()), pixels.data(), pixels.size());
+
+	if (!BeginTextureUpload(atlas, hud_font)) {
+		throw std::runtime_error("Failed to upload overlay font");
+	}
+
+	device.waitForFences(
+		{ texture_uploads.back().fence }, true, std::numeric_limits<uint64_t>::max()
+	);
+	UpdateTextureUploads();
+
+	// Glyphs are drawn at whole multiples of their size, so texels are
+	// taken as they are rather than blended with their neighbours
+	auto sampler_info = vk::SamplerCreateInfo()
+	.setMagFilter(vk::Filter::eNearest)
+	.setMinFilter(vk::Filter::eNearest)
+	.setMipmapMode(vk::SamplerMipmapMode::eNearest)
+	.setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+	.setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+	.setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+	.setMaxAnisotropy(1.0f)
+	.setBorderColor(vk::BorderColor::eIntOpaqueBlack);
+	hud_sampler = device.createSampler(sampler_info, allocator);
+
+	auto image_info = vk::DescriptorImageInfo()
+	.setSampler(hud_sampler)
+	.setImageView(hud_font.view)
+	.setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+
+	auto sampler_write = vk::WriteDescriptorSet()
+	.setDstSet(hud_font.descriptor_set)
+	.setDstBinding(1)
+	.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+	.setDescriptorCount(1)
+	.setPImageInfo(&image_info);
+	device.updateDescriptorSets({ sampler_write }, {});
+
+	// Shares the scene's layout; the pixel scale goes into the start of
+	// its vertex push constant range
+	GraphicsPipelineDesc desc;
+	desc.layout = pipeline_layout;
+	desc.render_pass = render_pass;
+	desc.subpass = hud_subpass;
+	desc.allocator = allocator;
+	desc.vertex_code = ReadShader("hud-v.spv");
+	desc.fragment_code = ReadShader("hud-f.spv");
+	desc.depth_test = false;
+	desc.depth_write = false;
+	desc.blend = BlendMode::Alpha;
+	desc.cull_mode = vk::CullModeFlagBits::eNone;
+
+	HudVertexInput::AppendTo(desc.vertex_bindings, desc.vertex_attributes);
+
+	CompilePipeline(hud_pipeline, desc);
+}
+
+void VkApp::CreateHudFrames() {
+	if (!hud_enabled) return;
+
+	DestroyHudFrames();
+
+	uint32_t slot_count = (uint32_t) command_buffers.size();
+
+	// Written by the CPU every frame and read once by the GPU, so it stays
+	// in host memory; each frame slot only ever touches its own region
+	vk::DeviceSize size = (vk::DeviceSize) slot_count * hud_max_vertices * sizeof(HudVertex);
+	hud_vertex_buffer = CreateBuffer(
+		size,
+		vk::BufferUsageFlagBits::eVertexBuffer,
+		vk::MemoryPropertyFlagBits::eHostVisible |
+		vk::MemoryPropertyFlagBits::eHostCoherent,
+		hud_vertex_buffer_memory
+	);
+	hud_vertices = (HudVertex*) device.mapMemory(hud_vertex_buffer_memory, 0, size, {});
+}
+
+void VkApp::DestroyHudFrames() {
+	if (hud_vertex_buffer) {
+		device.unmapMemory(hud_vertex_buffer_memory);
+		device.destroyBuffer(hud_vertex_buffer, allocator);
+		FreeDeviceMemory(hud_vertex_buffer_memory);
+	}
+
+	hud_vertex_buffer = nullptr;
+	hud_vertex_buffer_memory = nullptr;
+	hud_vertices = nullptr;
+}
+
+void VkApp::DestroyHud() {
+	DestroyPipelineSlot(hud_pipeline);
+	DestroyTexture(hud_font);
+	if (hud_sampler) device.destroySampler(hud_sampler, allocator);
+	hud_sampler = nullptr;
+}
+
+void VkApp::CreateTimestamps() {
+	DestroyTimestamps();
+
+	// Kept whether or not the overlay is on, since the frame pacer plans
+	// around the GPU time as well
+	auto family = physical_device.getQueueFamilyProperties()[queue_families.graphics_family];
+	if (family.timestampValidBits == 0) {
+		cout << "Queue has no timestamps; GPU time is not measured" << endl;
+		return;
+	}
+	timestamp_period = physical_device.getProperties().limits.timestampPeriod;
+
+	uint32_t slot_count = (uint32_t) command_buffers.size();
+
+	auto pool_info = vk::QueryPoolCreateInfo()
+	.setQueryType(vk::QueryType::eTimestamp)
+	.setQueryCount(2 * slot_count);
+	timestamp_pool = device.createQueryPool(pool_info, allocator);
+
+	timestamps_written.assign(slot_count, false);
+}
+
+void VkApp::DestroyTimestamps() {
+	if (timestamp_pool) device.destroyQueryPool(timestamp_pool, allocator);
+
+	timestamp_pool = nullptr;
+	timestamps_written.clear();
+}
+
+void VkApp::ReadTimestamps(uint32_t i) {
+	if (!timestamps_written[i]) return;
+	timestamps_written[i] = false;
+
+	// The fence has signaled, so this never waits; a result that is
+	// somehow not there yet is simply left out of the graph
+	std::array<uint64_t, 2> ticks;
+	vk::Result r = device.getQueryPoolResults<uint64_t>(
+		timestamp_pool, 2 * i, 2, ticks, sizeof(uint64_t), vk::QueryResultFlagBits::e64
+	);
+	if (r != vk::Result::eSuccess) return;
+
+	double gpu_ms = (ticks[1] - ticks[0]) * timestamp_period * 1e-6;
+	frame_pacer.AddGpuTime(gpu_ms);
+
+	if (hud_enabled) {
+		hud_gpu_ms[hud_gpu_index] = (float) gpu_ms;
+		hud_gpu_index = (hud_gpu_index + 1) % hud_history;
+	}
+}
+
+void VkApp::AddFrameSample(FramePacer::Clock::time_point frame_start) {
+	using Milliseconds = std::chrono::duration<float, std::milli>;
+
+	auto now = FramePacer::Clock::now();
+	float interval = 0.0f;
+	if (last_frame_start != FramePacer::Clock::time_point()) {
+		interval = Milliseconds(frame_start - last_frame_start).count();
+	}
+
+	hud_interval_ms[hud_cpu_index] = interval;
+	hud_cpu_ms[hud_cpu_index] = Milliseconds(now - frame_start).count();
+	hud_cpu_index = (hud_cpu_index + 1) % hud_history;
+}
+
+void VkApp::RecordHud(vk::CommandBuffer command_buffer, uint32_t i) {
+	// Averages over the most recent part of the history, so the numbers
+	// stay readable while the graph still shows single spikes
+	const size_t average_count = 32;
+	auto average = [](const float* samples, size_t next) {
+		float sum = 0.0f;
+		for (size_t k = 1; k <= average_count; k++) {
+			sum += samples[(next + hud_history - k) % hud_history];
+		}
+		return sum / average_count;
+	};
+
+	float interval = average(hud_interval_ms, hud_cpu_index);
+	float cpu = average(hud_cpu_ms, hud_cpu_index);
+	float gpu = average(hud_gpu_ms, hud_gpu_index);
+
+	HudBuilder hud(hud_vertices + (size_t) i * hud_max_vertices, hud_max_vertices);
+
+	const uint32_t white = HudColor(255, 255, 255);
+	const uint32_t gray = HudColor(110, 110, 110, 200);
+	const uint32_t green = HudColor(90, 220, 90);
+	const uint32_t orange = HudColor(255, 160, 40);
+
+	const float margin = 8.0f;
+	const float graph_width = 2.0f * hud_history;
+	const float graph_height = 64.0f;
+	float line = hud.GetLineHeight();
+	float x = 2.0f * margin;
+	float y = 2.0f * margin;
+
+	size_t line_count = HostAllocator::IsEnabled() ? 6 : 5;
+	hud.Rect(margin, margin, 420.0f, margin * 3 + line * line_count + graph_height, HudColor(0, 0, 0, 160));
+
+	char text[64];
+	snprintf(text, sizeof(text), "%5.0f FPS %6.2f MS", interval > 0.0f ? 1000.0f / interval : 0.0f, interval);
+	hud.Text(x, y, text, white);
+	y += line;
+
+	snprintf(text, sizeof(text), "CPU %6.2f MS", cpu);
+	float end = hud.Text(x, y, text, green);
+	snprintf(text, sizeof(text), "  GPU %6.2f MS", gpu);
+	hud.Text(end, y, text, orange);
+	y += line;
+
+	snprintf(text, sizeof(text), "DRAWS %u  TRIS %u", frame_stats.draw_calls, frame_stats.triangles);
+	hud.Text(x, y, text, white);
+	y += line;
+
+	snprintf(text, sizeof(text), "BINDS %u  DISPATCHES %u", frame_stats.pipeline_binds, frame_stats.dispatches);
+	hud.Text(x, y, text, white);
+	y += line;
+
+	const double megabyte = 1024.0 * 1024.0;
+	snprintf(text, sizeof(text), "GPU MEM %.1f MB (%.1f MB HOST)",
+		device_local_bytes / megabyte, host_visible_bytes / megabyte);
+	hud.Text(x, y, text, white);
+	y += line;
+
+	if (HostAllocator::IsEnabled()) {
+		size_t driver_bytes = 0;
+		for (size_t scope = 0; scope < HostAllocator::scope_count; scope++) {
+			HostAllocationStats stats = host_allocator.GetStats((vk::SystemAllocationScope) scope);
+			driver_bytes += stats.live_bytes + stats.internal_bytes;
+		}
+
+		snprintf(text, sizeof(text), "DRIVER HEAP %.2f MB", driver_bytes / megabyte);
+		hud.Text(x, y, text, white);
+		y += line;
+	}
+
+	// Frame interval behind, CPU and GPU time side by side in front; the
+	// graph spans twice the target interval, which is marked by a line
+	double target = frame_pacer.GetTargetInterval();
+	float graph_ms = target > 0.0 ? (float) (2.0 * target) : 33.3f;
+	float base = y + margin + graph_height;
+
+	for (size_t k = 0; k < hud_history; k++) {
+		float bar_x = x + 2.0f * k;
+		float interval_ms = hud_interval_ms[(hud_cpu_index + k) % hud_history];
+		float cpu_ms = hud_cpu_ms[(hud_cpu_index + k) % hud_history];
+		float gpu_ms = hud_gpu_ms[(hud_gpu_index + k) % hud_history];
+
+		float h = std::min(interval_ms / graph_ms, 1.0f) * graph_height;
+		hud.Rect(bar_x, base - h, 2.0f, h, gray);
+		h = std::min(cpu_ms / graph_ms, 1.0f) * graph_height;
+		hud.Rect(bar_x, base - h, 1.0f, h, green);
+		h = std::min(gpu_ms / graph_ms, 1.0f) * graph_height;
+		hud.Rect(bar_x + 1.0f, base - h, 1.0f, h, orange);
+	}
+
+	if (target > 0.0) {
+		hud.Rect(x, base - graph_height * 0.5f, graph_width, 1.0f, white);
+	}
+
+	if (!hud_pipeline.pipeline || hud.GetCount() == 0) return;
+
+	command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, hud_pipeline.pipeline);
+	command_buffer.bindDescriptorSets(
+		vk::PipelineBindPoint::eGraphics, pipeline_layout,
+		0, { hud_font.descriptor_set }, {}
+	);
+
+	// Only drawn in the primary window
+	const vk::Extent2D& extent = outputs[0]->extent;
+	glm::vec2 pixel_to_ndc(2.0f / extent.width, 2.0f / extent.height);
+	command_buffer.pushConstants(
+		pipeline_layout,
+		vk::ShaderStageFlagBits::eVertex,
+		0, sizeof(pixel_to_ndc), &pixel_to_ndc
+	);
+
+	vk::Buffer vertex_buffers[] = { hud_vertex_buffer };
+	vk::DeviceSize offsets[] = { (vk::DeviceSize) i * hud_max_vertices * sizeof(HudVertex) };
+	command_buffer.bindVertexBuffers(0, 1, vertex_buffers, offsets);
+	command_buffer.draw(hud.GetCount(), 1, 0, 0);
+}
+
+void VkApp::SetCaptureDirectory(const string& directory) {
+	capture_directory = directory;
+}
+
+void VkApp::CreateCaptureResources() {
+	if (!capture_enabled) return;
+
+	// Each frame slot gets its own buffer, so a frame is read back one full
+	// cycle of slots after it was drawn and never waited for
+	const vk::Extent2D& extent = outputs[0]->extent;
+	vk::DeviceSize size = (vk::DeviceSize) extent.width * extent.height * 4;
+
+	capture_slots.resize(command_buffers.size());
+	for (auto& slot : capture_slots) {
+		slot.reset(new CaptureSlot());
+		slot->buffer = CreateBuffer(
+			size,
+			vk::BufferUsageFlagBits::eTransferDst,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+			slot->memory
+		);
+
+		// Stays mapped; the writer reads straight out of it
+		slot->mapped = (uint8_t*) device.mapMemory(slot->memory, 0, size, {});
+	}
+}
+
+void VkApp::DestroyCaptureResources() {
+	if (capture_slots.empty()) return;
+
+	// Only called with the device idle, so every recorded copy has landed
+	for (uint32_t i = 0; i < capture_slots.size(); i++) {
+		FinishCapture(i);
+	}
+	capture_writer.Flush();
+
+	for (auto& slot : capture_slots) {
+		device.unmapMemory(slot->memory);
+		device.destroyBuffer(slot->buffer, allocator);
+		FreeDeviceMemory(slot->memory);
+	}
+	capture_slots.clear();
+}
+
+void VkApp::RecordCapture(vk::CommandBuffer command_buffer, uint32_t i) {
+	CaptureSlot& slot = *capture_slots[i];
+	const Output& output = *outputs[0];
+	vk::Image image = output.images[output.image_index];
+
+	// Rather than wait for the disk, drop the frame
+	if (slot.busy.load(std::memory_order_acquire)) {
+		dropped_captures++;
+		return;
+	}
+
+	vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+
+	auto to_transfer = vk::ImageMemoryBarrier()
+	.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+	.setDstAccessMask(vk::AccessFlagBits::eTransferRead)
+	.setOldLayout(vk::ImageLayout::ePresentSrcKHR)
+	.setNewLayout(vk::ImageLayout::eTransferSrcOptimal)
+	.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+	.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+	.setImage(image)
+	.setSubresourceRange(range);
+
+	command_buffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eColorAttachmentOutput,
+		vk::PipelineStageFlagBits::eTransfer,
+		vk::DependencyFlags(),
+		{}, {}, { to_transfer }
+	);
+
+	auto region = vk::BufferImageCopy()
+	.setBufferOffset(0)
+	.setBufferRowLength(0)		// tightly packed
+	.setBufferImageHeight(0)
+	.setImageSubresource({ vk::ImageAspectFlagBits::eColor, 0, 0, 1 })
+	.setImageOffset({ 0, 0, 0 })
+	.setImageExtent({ output.extent.width, output.extent.height, 1 });
+
+	command_buffer.copyImageToBuffer(
+		image, vk::ImageLayout::eTransferSrcOptimal, slot.buffer, { region }
+	);
+
+	// Back for presentation, and make the copy visible to the host once
+	// the fence signals
+	auto to_present = vk::ImageMemoryBarrier()
+	.setSrcAccessMask(vk::AccessFlagBits::eTransferRead)
+	.setDstAccessMask({})
+	.setOldLayout(vk::ImageLayout::eTransferSrcOptimal)
+	.setNewLayout(vk::ImageLayout::ePresentSrcKHR)
+	.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+	.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+	.setImage(image)
+	.setSubresourceRange(range);
+
+	auto to_host = vk::BufferMemoryBarrier()
+	.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+	.setDstAccessMask(vk::AccessFlagBits::eHostRead)
+	.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+	.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+	.setBuffer(slot.buffer)
+	.setOffset(0)
+	.setSize(VK_WHOLE_SIZE);
+
+	command_buffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eBottomOfPipe | vk::PipelineStageFlagBits::eHost,
+		vk::DependencyFlags(),
+		{}, { to_host }, { to_present }
+	);
+
+	slot.recorded = true;
+	slot.frame = captured_frames++;
+}
+
+void VkApp::FinishCapture(uint32_t i) {
+	CaptureSlot& slot = *capture_slots[i];
+	if (!slot.recorded) return;
+
+	slot.recorded = false;
+	slot.busy.store(true, std::memory_order_relaxed);
+
+	const vk::Extent2D& extent = outputs[0]->extent;
+
+	CaptureFrame frame;
+	frame.pixels = slot.mapped;
+	frame.width = extent.width;
+	frame.height = extent.height;
+	frame.row_pitch = extent.width * 4;
+	frame.bgra = swapchain_format == vk::Format::eB8G8R8A8Unorm
+		|| swapchain_format == vk::Format::eB8G8R8A8Srgb;
+	frame.index = slot.frame;
+	frame.busy = &slot.busy;
+
+	capture_writer.Submit(frame);
+}
+
+void VkApp::CreateCommandPool() {
+	// Command buffers are re-recorded every frame
+	auto command_pool_info = vk::CommandPoolCreateInfo()
+	.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer)
+	.setQueueFamilyIndex(queue_families.graphics_family);
+
+	if (command_pool) device.destroyCommandPool(command_pool, allocator);
+	command_pool = device.createCommandPool(command_pool_info, allocator);
+}
+
+void VkApp::CreateCommandBuffers() {
+	if (command_buffers.size() > 0) {
+		device.freeCommandBuffers(command_pool, command_buffers);
+	}
+
+	// One frame slot per image of the largest swapchain. Allocated into the
+	// existing vector so recreation keeps its storage.
+	size_t slot_count = 0;
+	for (auto& output : outputs) slot_count = std::max(slot_count, output->images.size());
+	command_buffers.resize(slot_count);
+
+	auto allocate_info = vk::CommandBufferAllocateInfo()
+	.setCommandPool(command_pool)
+	.setLevel(vk::CommandBufferLevel::ePrimary)
+	.setCommandBufferCount((uint32_t) command_buffers.size());
+
+	device.allocateCommandBuffers(&allocate_info, command_buffers.data());
+}
+
+void VkApp::RecordCommandBuffer(uint32_t i) {
+	auto begin_info = vk::CommandBufferBeginInfo()
+	.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit)
+	.setPInheritanceInfo(nullptr);
+
+	command_buffers[i].begin(begin_info);
+	frame_stats = FrameStats();
+
+	// Brackets everything the slot's command buffer does on the GPU
+	if (timestamp_pool) {
+		command_buffers[i].resetQueryPool(timestamp_pool, 2 * i, 2);
+		command_buffers[i].writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timestamp_pool, 2 * i);
+	}
+
+	// Ahead of every reader of the UBO, compute included
+	RecordUniformUpload(command_buffers[i], i);
+
+	// Compute work has to happen outside the render pass
+	bool draw_particles = ParticlesReady();
+	if (draw_particles) {
+		RecordParticleUpdate(command_buffers[i]);
+
+		// The compacted list is the current one from here on, for every
+		// window's draw
+		particle_list = 1 - particle_list;
+	}
+
+	bool draw_lighting = deferred && LightingReady();
+	if (draw_lighting) RecordLightCulling(command_buffers[i]);
+
+	// Shared by every window's draws
+	if (scene_variant.instanced) WriteInstances(i);
+
+	// Every window gets the same scene through its own framebuffer; the
+	// shared attachments are reused one pass after the other, ordered by
+	// the render pass's external dependencies. The primary window goes
+	// last so its overlay counts every window's work.
+
+	for (size_t k = outputs.size(); k-- > 0;) {
+		if (outputs[k]->acquired) {
+			RecordRenderPass(command_buffers[i], *outputs[k], i, draw_particles, draw_lighting);
+		}
+	}
+
+	if (capture_enabled && outputs[0]->acquired) RecordCapture(command_buffers[i], i);
+
+	if (timestamp_pool) {
+		command_buffers[i].writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestamp_pool, 2 * i + 1);
+		timestamps_written[i] = true;
+	}
+
+	command_buffers[i].end();
+}
+
+vk::Rect2D VkApp::GetSceneArea(const Output& output) const {
+	// The camera follows the primary window's aspect ratio, so the scene
+	// is fitted into the others and centered, with bars on the sides
+	const vk::Extent2D& primary = outputs[0]->extent;
+	const vk::Extent2D& extent = output.extent;
+	if (output.index == 0) return vk::Rect2D({ 0, 0 }, extent);
+
+	uint64_t wide = (uint64_t) extent.width * primary.height;
+	uint64_t tall = (uint64_t) extent.height * primary.width;
+
+	vk::Extent2D fitted = extent;
+	if (wide > tall) {
+		fitted.width = (uint32_t) (tall / primary.height);
+	} else {
+		fitted.height = (uint32_t) (wide / primary.width);
+	}
+
+	vk::Offset2D offset(
+		(int32_t) (extent.width - fitted.width) / 2,
+		(int32_t) (extent.height - fitted.height) / 2
+	);
+	return vk::Rect2D(offset, fitted);
+}
+
+void VkApp::RecordRenderPass(
+	vk::CommandBuffer command_buffer, const Output& output, uint32_t i,
+	bool draw_particles, bool draw_lighting
+) {
+	// One per attachment, in CreateRenderPass order; the G-buffer entries
+	// are never used since it is not cleared
+	std::array<vk::ClearValue, 4> clear_values;
+	clear_values[0] = vk::ClearValue(std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 1.0f });
+	clear_values[1] = vk::ClearDepthStencilValue(1.0f, 0);
+	clear_values[2] = clear_values[0];
+	clear_values[3] = clear_values[0];
+	uint32_t attachment_count = 2 + (color_image ? 1 : 0) + (gbuffer_albedo ? 2 : 0);
+
+	auto renderpass_info = vk::RenderPassBeginInfo()
+	.setRenderPass(render_pass)
+	.setFramebuffer(output.framebuffers[output.image_index])
+	.setRenderArea({ { 0, 0 }, output.extent })
+	.setClearValueCount(attachment_count)
+	.setPClearValues(clear_values.data());
+
+	command_buffer.beginRenderPass(renderpass_info, vk::SubpassContents::eInline);
+
+	// Skip the draws while a pipeline is still being compiled; the frame
+	// still clears and presents so the loop never waits on the compiler.
+	bool can_draw = graphics_pipeline.pipeline
+		&& (!depth_prepass || depth_pipeline.pipeline);
+
+	vk::Rect2D area = GetSceneArea(output);
+
+	auto viewport = vk::Viewport()
+	.setX((float) area.offset.x)
+	.setY((float) area.offset.y)
+	.setWidth((float) area.extent.width)
+	.setHeight((float) area.extent.height)
+	.setMinDepth(0.0f)
+	.setMaxDepth(1.0f);
+	command_buffer.setViewport(0, { viewport });
+
+	command_buffer.setScissor(0, { area });
+
+	if (can_draw) {
+		// The instance binding is part of every scene pipeline, so it is
+		// bound even when the variant never reads it
+		vk::Buffer vertex_buffers[] = { vertex_buffer, instance_buffer };
+		vk::DeviceSize offsets[] = { 0, (vk::DeviceSize) i * max_instances * sizeof(InstanceData) };
+		command_buffer.bindVertexBuffers(0, 2, vertex_buffers, offsets);
+		command_buffer.bindIndexBuffer(index_buffer, 0, vk::IndexType::eUint16);
+
+		// Both pipelines share the layout, so the set stays bound across subpasses
+		command_buffer.bindDescriptorSets(
+			vk::PipelineBindPoint::eGraphics,
+			pipeline_layout,
+			0,
+			{ texture.ready ? texture.descriptor_set : placeholder_texture.descriptor_set },
+			{}
+		);
+	}
+
+	if (depth_prepass) {
+		if (can_draw) {
+			command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, depth_pipeline.pipeline);
+			frame_stats.pipeline_binds++;
+			RecordDraws(command_buffer);
+		}
+		command_buffer.nextSubpass(vk::SubpassContents::eInline);
+	}
+
+	if (can_draw) {
+		command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, graphics_pipeline.pipeline);
+		frame_stats.pipeline_binds++;
+		RecordDraws(command_buffer);
+	}
+
+	if (deferred) {
+		command_buffer.nextSubpass(vk::SubpassContents::eInline);
+		if (can_draw && draw_lighting) RecordLighting(command_buffer);
+	}
+
+	if (draw_particles) RecordParticleDraw(command_buffer);
+
+	if (hud_enabled) {
+		command_buffer.nextSubpass(vk::SubpassContents::eInline);
+		if (output.index == 0) RecordHud(command_buffer, i);
+	}
+
+	command_buffer.endRenderPass();
+}
+
+void VkApp::RecordDraws(vk::CommandBuffer command_buffer) {
+	if (scene_variant.instanced) {
+		// Draw k is instance k (see WriteInstances); runs of the same mesh
+		// go out as one draw, which keeps them in front-to-back order
+		uint32_t count = std::min((uint32_t) visible_draws.size(), max_instances);
+
+		for (uint32_t first = 0, last; first < count; first = last) {
+			const MeshRef& mesh = scene.GetMesh(visible_draws[first]);
+
+			for (last = first + 1; last < count; last++) {
+				const MeshRef& next = scene.GetMesh(visible_draws[last]);
+				if (next.first_index != mesh.first_index || next.index_count != mesh.index_count) break;
+			}
+			if (mesh.index_count == 0) continue;
+
+			command_buffer.drawIndexed(mesh.index_count, last - first, mesh.first_index, 0, first);
+			frame_stats.draw_calls++;
+			frame_stats.triangles += mesh.index_count / 3 * (last - first);
+		}
+		return;
+	}
+
+	for (uint32_t object : visible_draws) {
+		const MeshRef& mesh = scene.GetMesh(object);
+		if (mesh.index_count == 0) continue;
+
+		PushConstants constants = { scene.GetWorldTransform(object) };
+		command_buffer.pushConstants(
+			pipeline_layout,
+			vk::ShaderStageFlagBits::eVertex,
+			0, sizeof(constants), &constants
+		);
 
-	vk::RenderPassCreateInfo renderpass_info;
-	renderpass_info.setAttachmentCount(1)
-	.setPAttachments(&color_attachment)
-	.setSubpassCount(1)
-	.setPSubpasses(&subpass)
-	.setDependencyCount(1)
-	.setPDependencies(&dependency);
+		// index count, instance count, first index, vertex offset, first instance
+		command_buffer.drawIndexed(mesh.index_count, 1, mesh.first_index, 0, 0);
+		frame_stats.draw_calls++;
+		frame_stats.triangles += mesh.index_count / 3;
+	}
+}
+
+void VkApp::CreateInstanceBuffer() {
+	DestroyInstanceBuffer();
 
-	if (render_pass) device.destroyRenderPass(render_pass);
-	render_pass = device.createRenderPass(renderpass_info);
+	vk::DeviceSize size = (vk::DeviceSize) command_buffers.size() * max_instances * sizeof(InstanceData);
+	instance_buffer = CreateBuffer(
+		size,
+		vk::BufferUsageFlagBits::eVertexBuffer,
+		vk::MemoryPropertyFlagBits::eHostVisible |
+		vk::MemoryPropertyFlagBits::eHostCoherent,
+		instance_buffer_memory
+	);
+	instances = (InstanceData*) device.mapMemory(instance_buffer_memory, 0, size, {});
 }
 
-void VkApp::CreateCommandPool() {
-	QueueFamilyIndices queue_families_indices = FindQueueFamilies(physical_device);
+void VkApp::DestroyInstanceBuffer() {
+	if (!instance_buffer) return;
 
-	auto command_pool_info = vk::CommandPoolCreateInfo()
-	.setQueueFamilyIndex(queue_families_indices.graphics_family);
+	device.unmapMemory(instance_buffer_memory);
+	device.destroyBuffer(instance_buffer, allocator);
+	FreeDeviceMemory(instance_buffer_memory);
 
-	if (command_pool) device.destroyCommandPool(command_pool);
-	command_pool = device.createCommandPool(command_pool_info);
+	instance_buffer = nullptr;
+	instance_buffer_memory = nullptr;
+	instances = nullptr;
 }
 
-void VkApp::CreateCommandBuffers() {
-	if (command_buffers.size() > 0) {
-		device.freeCommandBuffers(command_pool, command_buffers);
+void VkApp::WriteInstances(uint32_t i) {
+	// The image's fence has signaled, so its region is no longer read.
+	// Draws past max_instances are left out.
+	InstanceData* region = instances + (size_t) i * max_instances;
+	uint32_t count = std::min((uint32_t) visible_draws.size(), max_instances);
+
+	for (uint32_t k = 0; k < count; k++) {
+		region[k].model = scene.GetWorldTransform(visible_draws[k]);
 	}
+}
 
-	command_buffers.resize(swapchain_framebuffers.size());
+void VkApp::CreateScene() {
+	Aabb quad_bounds = Aabb::Empty();
+	for (const Vertex& vertex : vertices) {
+		quad_bounds.Expand({ vertex.pos, vertex.pos });
+	}
 
-	auto allocate_info = vk::CommandBufferAllocateInfo()
-	.setCommandPool(command_pool)
-	.setLevel(vk::CommandBufferLevel::ePrimary)
-	.setCommandBufferCount((uint32_t) command_buffers.size());
+	MeshRef quad;
+	quad.first_index = 0;
+	quad.index_count = (uint32_t) indices.size();
 
-	command_buffers = device.allocateCommandBuffers(allocate_info);
+	scene.Clear();
 
-	for (size_t i = 0; i < command_buffers.size(); i++) {
-		auto begin_info = vk::CommandBufferBeginInfo()
-		.setFlags(vk::CommandBufferUsageFlagBits::eSimultaneousUse)
-		.setPInheritanceInfo(nullptr);
+	// The animation spins the root; the other quads are stacked along z
+	// below it so they overlap on screen and turn with it
+	scene_root = scene.Create(glm::mat4(), quad, quad_bounds);
 
-		command_buffers[i].begin(begin_info);
+	const glm::vec3 offsets[] = {
+		{  0.3f, -0.3f,  0.5f },
+		{ -0.3f,  0.3f, -0.5f },
+		{  0.0f,  0.0f,  1.0f }
+	};
+	for (const glm::vec3& offset : offsets) {
+		scene.Create(glm::translate(glm::mat4(), offset), quad, quad_bounds, 0, scene_root);
+	}
 
-		auto clear_color = vk::ClearValue(std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 1.0f });
-		auto renderpass_info = vk::RenderPassBeginInfo()
-		.setRenderPass(render_pass)
-		.setFramebuffer(swapchain_framebuffers[i])
-		.setRenderArea({ { 0, 0 }, swapchain_extent })
-		.setClearValueCount(1)
-		.setPClearValues(&clear_color);
+	scene.UpdateTransforms();
+	draw_bvh.Build(scene.GetWorldBounds());
 
-		command_buffers[i].beginRenderPass(renderpass_info, vk::SubpassContents::eInline);
-		command_buffers[i].bindPipeline(vk::PipelineBindPoint::eGraphics, graphics_pipeline);
+	visible_draws.clear();
+}
 
-		vk::Buffer vertex_buffers[] = { vertex_buffer };
-		vk::DeviceSize offsets[] = { 0 };
-		command_buffers[i].bindVertexBuffers(0, 1, vertex_buffers, offsets);
-		command_buffers[i].bindIndexBuffer(index_buffer, 0, vk::IndexType::eUint16);
+void VkApp::CullDrawList() {
+	// Only objects under a moved transform are touched, in the scene and
+	// in the hierarchy
+	for (uint32_t object : scene.UpdateTransforms()) {
+		draw_bvh.Update(object, scene.GetWorldBounds(object));
+	}
+	draw_bvh.Refit();
 
-		command_buffers[i].bindDescriptorSets(
-			vk::PipelineBindPoint::eGraphics,
-			pipeline_layout,
-			0,
-			{ descriptor_set },
-			{}
-		);
+	Frustum frustum = Frustum::FromMatrix(uniforms.proj * uniforms.view * uniforms.model);
+	draw_bvh.Cull(frustum, visible_draws);
+}
+
+void VkApp::SortDrawList() {
+	// Front to back so early depth testing rejects as many hidden fragments
+	// as possible. The camera looks down -z in view space.
+	glm::mat4 view_model = uniforms.view * uniforms.model;
 
-		// vertex count, instance count, first vertex and first instance
-		//command_buffers[i].draw(vertices.size(), 1, 0, 0);
-		command_buffers[i].drawIndexed(indices.size(), 1, 0, 0, 0);
+	// Sort keys only live for this call, so they come from the frame arena
+	using SortKey = std::pair<float, uint32_t>;
+	ArenaAllocator<SortKey> scratch(*frame_arena);
+	ArenaVector<SortKey> keys(scratch);
+	keys.reserve(visible_draws.size());
+
+	for (uint32_t object : visible_draws) {
+		glm::vec4 center = view_model * glm::vec4(scene.GetWorldBounds(object).Center(), 1.0f);
+		keys.emplace_back(-center.z, object);
+	}
 
-		command_buffers[i].endRenderPass();
+	std::sort(keys.begin(), keys.end(),
+		[](const SortKey& a, const SortKey& b) { return a.first < b.first; });
 
-		command_buffers[i].end();
+	for (size_t i = 0; i < keys.size(); i++) {
+		visible_draws[i] = keys[i].second;
 	}
 }
 
-void VkApp::DrawFrame() {
-	uint32_t image_index;
-	vk::Result r = device.acquireNextImageKHR(
-		swapchain,
-		std::numeric_limits<uint64_t>::max(),
-		semaphore_image_available,
-		nullptr,
-		&image_index
-	);
+bool VkApp::AcquireImages() {
+	bool any = false;
 
-	if (r == vk::Result::eErrorOutOfDateKHR) {
-		RecreateSwapchain();
-		return;
-	} else if (r != vk::Result::eSuccess && r != vk::Result::eSuboptimalKHR) {
-		throw std::runtime_error("Failed to acquire swapchain image");
+	for (auto& output : outputs) {
+		output->acquired = false;
+		if (output->iconified || output->stale) continue;
+
+		auto acquire_start = FramePacer::Clock::now();
+		vk::Result r = device.acquireNextImageKHR(
+			output->swapchain,
+			std::numeric_limits<uint64_t>::max(),
+			output->image_available[frame_slot],
+			nullptr,
+			&output->image_index
+		);
+		auto acquire_time = FramePacer::Clock::now() - acquire_start;
+		acquire_seconds.Observe(std::chrono::duration<double>(acquire_time).count());
+		frame_pacer.AddWaitTime(acquire_time);
+
+		if (r == vk::Result::eErrorOutOfDateKHR) {
+			// Nothing can be drawn to this swapchain any more; the other
+			// windows go ahead and it is recreated before the next frame
+			output->stale = true;
+			RequestRedraw();
+			continue;
+		} else if (r != vk::Result::eSuccess && r != vk::Result::eSuboptimalKHR) {
+			throw std::runtime_error("Failed to acquire swapchain image");
+		}
+
+		output->acquired = true;
+		any = true;
+	}
+
+	return any;
+}
+
+void VkApp::DrawFrame() {
+	// At most one recreation per presented frame, for the latest extents;
+	// until then frames keep going to the old swapchains and get scaled
+	bool stale = false;
+	for (auto& output : outputs) stale = stale || output->stale;
+	if (stale) RecreateSwapchains();
+
+	// Wait until the previous submission using this slot's command buffer is done
+	uint32_t i = frame_slot;
+	vk::Fence fence = command_buffer_fences[i];
+	auto wait_start = FramePacer::Clock::now();
+	device.waitForFences({ fence }, true, std::numeric_limits<uint64_t>::max());
+	auto wait_time = FramePacer::Clock::now() - wait_start;
+	fence_wait_seconds.Observe(std::chrono::duration<double>(wait_time).count());
+	frame_pacer.AddWaitTime(wait_time);
+	DestroyRetiredPipelines(i);
+	DestroyRetiredTextures(i);
+
+	// The fence stays signaled if there is nothing to submit to
+	if (!AcquireImages()) return;
+
+	device.resetFences({ fence });
+
+	frame_arena = &frame_arenas[i];
+	frame_arena->Reset();
+
+	// The copy this slot's last frame made is complete now
+	if (capture_enabled) FinishCapture(i);
+	if (timestamp_pool) ReadTimestamps(i);
+
+	UpdatePipelines();
+	CullDrawList();
+	SortDrawList();
+	RecordCommandBuffer(i);
+
+	// One submission waits for every acquired image, and one present hands
+	// them all back, so the windows flip together
+	frame_wait_semaphores.clear();
+	frame_wait_stages.clear();
+	present_swapchains.clear();
+	present_image_indices.clear();
+
+	for (auto& output : outputs) {
+		if (!output->acquired) continue;
+
+		frame_wait_semaphores.push_back(output->image_available[i]);
+		frame_wait_stages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
+		present_swapchains.push_back(output->swapchain);
+		present_image_indices.push_back(output->image_index);
 	}
+	present_results.resize(present_swapchains.size());
 
-	vk::Semaphore wait_semaphores[]   = { semaphore_image_available };
-	vk::Semaphore signal_semaphores[] = { semaphore_render_finished };
-	vk::PipelineStageFlags wait_stages[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
+	vk::Semaphore signal_semaphores[] = { render_finished_semaphores[i] };
 
 	auto submit_info = vk::SubmitInfo()
-	.setWaitSemaphoreCount(1)
-	.setPWaitSemaphores(wait_semaphores)
-	.setPWaitDstStageMask(wait_stages)
+	.setWaitSemaphoreCount((uint32_t) frame_wait_semaphores.size())
+	.setPWaitSemaphores(frame_wait_semaphores.data())
+	.setPWaitDstStageMask(frame_wait_stages.data())
 	.setCommandBufferCount(1)
-	.setPCommandBuffers(&command_buffers[image_index])
+	.setPCommandBuffers(&command_buffers[i])
 	.setSignalSemaphoreCount(1)
 	.setPSignalSemaphores(signal_semaphores);
 
-	graphics_queue.submit({ submit_info }, nullptr);
+	auto submit_start = FramePacer::Clock::now();
+	graphics_queue.submit({ submit_info }, fence);
+	submit_seconds.ObserveSince(submit_start);
+
+	// Only moves on once the slot's fence is pending again
+	frame_slot = (frame_slot + 1) % (uint32_t) command_buffers.size();
 
-	vk::SwapchainKHR swapchains[] = { swapchain };
 	auto present_info = vk::PresentInfoKHR()
 	.setWaitSemaphoreCount(1)
 	.setPWaitSemaphores(signal_semaphores)
-	.setSwapchainCount(1)
-	.setPSwapchains(swapchains)
-	.setPImageIndices(&image_index);
-
-	r = presentation_queue.presentKHR(present_info);
-	if (r == vk::Result::eErrorOutOfDateKHR || r == vk::Result::eSuboptimalKHR) {
-		RecreateSwapchain();
-	} else if (r != vk::Result::eSuccess) {
+	.setSwapchainCount((uint32_t) present_swapchains.size())
+	.setPSwapchains(present_swapchains.data())
+	.setPImageIndices(present_image_indices.data())
+	.setPResults(present_results.data());
+
+	// The overall result is the worst of the swapchains'; each one's own
+	// says which of them have to be recreated
+	vk::Result r = presentation_queue.presentKHR(present_info);
+	if (r != vk::Result::eSuccess && r != vk::Result::eSuboptimalKHR && r != vk::Result::eErrorOutOfDateKHR) {
 		throw std::runtime_error("Failed to present swapchain image");
 	}
+
+	for (size_t k = 0, p = 0; k < outputs.size(); k++) {
+		if (!outputs[k]->acquired) continue;
+
+		vk::Result result = present_results[p++];
+		if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR) {
+			// Left to the next frame, which may bring a newer extent with it
+			outputs[k]->stale = true;
+			RequestRedraw();
+		} else if (result != vk::Result::eSuccess) {
+			throw std::runtime_error("Failed to present swapchain image");
+		}
+	}
 }
 
 void VkApp::CreateSemaphores() {
-	semaphore_image_available = device.createSemaphore({});
-	semaphore_render_finished = device.createSemaphore({});
+	DestroySemaphores();
+
+	// One set per frame slot: a slot's semaphores are only reused once its
+	// fence shows the submission that waited on them is done
+	size_t slot_count = command_buffers.size();
+
+	render_finished_semaphores.resize(slot_count);
+	for (auto& semaphore : render_finished_semaphores) {
+		semaphore = device.createSemaphore({}, allocator);
+	}
+
+	for (auto& output : outputs) {
+		output->image_available.resize(slot_count);
+		for (auto& semaphore : output->image_available) {
+			semaphore = device.createSemaphore({}, allocator);
+		}
+	}
+}
+
+void VkApp::DestroySemaphores() {
+	for (auto semaphore : render_finished_semaphores) device.destroySemaphore(semaphore, allocator);
+	render_finished_semaphores.clear();
+
+	for (auto& output : outputs) {
+		for (auto semaphore : output->image_available) device.destroySemaphore(semaphore, allocator);
+		output->image_available.clear();
+	}
+}
+
+void VkApp::CreateFences() {
+	// Only called with the device idle, so nothing uses the retired
+	// pipelines or textures any more
+	for (uint32_t i = 0; i < retired_pipelines.size(); i++) DestroyRetiredPipelines(i);
+	retired_pipelines.resize(command_buffers.size());
+	for (uint32_t i = 0; i < retired_textures.size(); i++) DestroyRetiredTextures(i);
+	retired_textures.resize(command_buffers.size());
+
+	for (auto fence : command_buffer_fences) device.destroyFence(fence, allocator);
+	command_buffer_fences.resize(command_buffers.size());
+
+	// Created signaled so the first wait on each image returns immediately
+	auto fence_info = vk::FenceCreateInfo()
+	.setFlags(vk::FenceCreateFlagBits::eSignaled);
+
+	for (auto& fence : command_buffer_fences) {
+		fence = device.createFence(fence_info, allocator);
+	}
+
+	// Arenas are tied to the fences: one is only reset once its fence
+	// shows the frame that used it is done. Existing ones keep their size.
+	frame_slot = 0;
+	frame_arena = nullptr;
+	frame_arenas.resize(command_buffer_fences.size());
 }
 
-vk::VertexInputBindingDescription Vertex::GetBindingDescription() {
-	auto description = vk::VertexInputBindingDescription()
-	.setBinding(0)
-	.setStride(sizeof(Vertex))
-	.setInputRate(vk::VertexInputRate::eVertex);
+vk::DeviceMemory VkApp::AllocateDeviceMemory(const vk::MemoryAllocateInfo& alloc_info) {
+	vk::DeviceMemory memory = device.allocateMemory(alloc_info, allocator);
 
-	return description;
+	// Memory that is both (integrated GPUs) counts as device local
+	auto mem_properties = physical_device.getMemoryProperties();
+	auto flags = mem_properties.memoryTypes[alloc_info.memoryTypeIndex].propertyFlags;
+	bool device_local = (bool) (flags & vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+	device_allocations[(VkDeviceMemory) memory] = { alloc_info.allocationSize, device_local };
+	(device_local ? device_local_bytes : host_visible_bytes) += alloc_info.allocationSize;
+
+	device_allocations_total.Add();
+	device_local_bytes_gauge.Set((double) device_local_bytes);
+	host_visible_bytes_gauge.Set((double) host_visible_bytes);
+
+	return memory;
 }
 
-std::array<vk::VertexInputAttributeDescription, 2>
-Vertex::GetAttributeDescriptions() {
-	std::array<vk::VertexInputAttributeDescription, 2> descriptions = {};
+void VkApp::FreeDeviceMemory(vk::DeviceMemory memory) {
+	if (!memory) return;
 
-	descriptions[0].setBinding(0)
-	.setLocation(0)
-	.setFormat(vk::Format::eR32G32Sfloat)
-	.setOffset(offsetof(Vertex, pos));
+	auto allocation = device_allocations.find((VkDeviceMemory) memory);
+	if (allocation != device_allocations.end()) {
+		(allocation->second.second ? device_local_bytes : host_visible_bytes) -= allocation->second.first;
+		device_allocations.erase(allocation);
 
-	descriptions[1].setBinding(0)
-	.setLocation(1)
-	.setFormat(vk::Format::eR32G32B32Sfloat)
-	.setOffset(offsetof(Vertex, color));
+		device_local_bytes_gauge.Set((double) device_local_bytes);
+		host_visible_bytes_gauge.Set((double) host_visible_bytes);
+	}
 
-	return descriptions;
+	device.freeMemory(memory, allocator);
 }
 
 uint32_t VkApp::FindMemoryType(uint32_t filter, vk::MemoryPropertyFlags properties) {
+	uint32_t type_index;
+	if (!TryFindMemoryType(filter, properties, type_index)) {
+		throw std::runtime_error("Failed to find suitable memory type");
+	}
+	return type_index;
+}
+
+bool VkApp::TryFindMemoryType(uint32_t filter, vk::MemoryPropertyFlags properties, uint32_t& type_index) {
 	vk::PhysicalDeviceMemoryProperties mem_properties;
 	mem_properties = physical_device.getMemoryProperties();
 
 	for (uint32_t i = 0; i < mem_properties.memoryTypeCount; i++) {
 		if (filter & ((uint32_t)(1 << i)) && ((mem_properties.memoryTypes[i].propertyFlags & properties) == properties)) {
-			return i;
+			type_index = i;
+			return true;
 		}
 	}
 
-	throw std::runtime_error("Failed to find suitable memory type");
-	return 0;
+	return false;
 }
 
 vk::Buffer VkApp::CreateBuffer(
@@ -962,7 +3886,7 @@ vk::Buffer VkApp::CreateBuffer(
 	.setSize(size)
 	.setUsage(usage)
 	.setSharingMode(vk::SharingMode::eExclusive);
-	buffer = device.createBuffer(buffer_info);
+	buffer = device.createBuffer(buffer_info, allocator);
 
 	vk::MemoryRequirements mem_requirements;
 	mem_requirements = device.getBufferMemoryRequirements(buffer);
@@ -972,15 +3896,40 @@ vk::Buffer VkApp::CreateBuffer(
 	.setMemoryTypeIndex(
 		FindMemoryType(mem_requirements.memoryTypeBits, properties)
 	);
-	memory = device.allocateMemory(alloc_info);
+	memory = AllocateDeviceMemory(alloc_info);
 
 	device.bindBufferMemory(buffer, memory, 0);
 	return buffer;
 }
 
 void VkApp::CreateVertexBuffer() {
+	const void* source = vertices.data();
 	vk::DeviceSize buffer_size = sizeof(vertices[0]) * vertices.size();
 
+	vector<QuantizedVertex> quantized;
+	if (scene_variant.quantized) {
+		// Positions are brought into [-1, 1] by the scale SetSceneVariant
+		// picked; the shader multiplies it back in
+		auto snorm = [](float v) { return (int16_t) std::round(glm::clamp(v, -1.0f, 1.0f) * 32767.0f); };
+		auto unorm8 = [](float v) { return (uint8_t) std::round(glm::clamp(v, 0.0f, 1.0f) * 255.0f); };
+		auto unorm16 = [](float v) { return (uint16_t) std::round(glm::clamp(v, 0.0f, 1.0f) * 65535.0f); };
+
+		quantized.resize(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++) {
+			const Vertex& vertex = vertices[i];
+			QuantizedVertex& q = quantized[i];
+
+			for (int k = 0; k < 3; k++) q.pos[k] = snorm(vertex.pos[k] / scene_variant.position_scale);
+			q.pos[3] = 32767;
+			for (int k = 0; k < 3; k++) q.color[k] = unorm8(vertex.color[k]);
+			q.color[3] = 255;
+			for (int k = 0; k < 2; k++) q.tex_coord[k] = unorm16(vertex.tex_coord[k]);
+		}
+
+		source = quantized.data();
+		buffer_size = sizeof(quantized[0]) * quantized.size();
+	}
+
 	vk::Buffer staging_buffer;
 	vk::DeviceMemory staging_buffer_memory;
 	staging_buffer = CreateBuffer(
@@ -993,7 +3942,7 @@ void VkApp::CreateVertexBuffer() {
 
 	void* data;
 	data = device.mapMemory(staging_buffer_memory, 0, buffer_size, {});
-	memcpy(data, vertices.data(), (size_t) buffer_size);
+	memcpy(data, source, (size_t) buffer_size);
 	device.unmapMemory(staging_buffer_memory);
 
 	vertex_buffer = CreateBuffer(
@@ -1006,8 +3955,8 @@ void VkApp::CreateVertexBuffer() {
 
 	CopyBuffer(staging_buffer, vertex_buffer, buffer_size);
 
-	device.destroyBuffer(staging_buffer);
-	device.freeMemory(staging_buffer_memory);
+	device.destroyBuffer(staging_buffer, allocator);
+	FreeDeviceMemory(staging_buffer_memory);
 }
 
 void VkApp::CreateIndexBuffer() {
@@ -1038,8 +3987,8 @@ void VkApp::CreateIndexBuffer() {
 
 	CopyBuffer(staging_buffer, index_buffer, buffer_size);
 
-	device.destroyBuffer(staging_buffer);
-	device.freeMemory(staging_buffer_memory);
+	device.destroyBuffer(staging_buffer, allocator);
+	FreeDeviceMemory(staging_buffer_memory);
 }
 
 void VkApp::CopyBuffer(vk::Buffer source, vk::Buffer destination, vk::DeviceSize size) {
@@ -1072,50 +4021,140 @@ void VkApp::CopyBuffer(vk::Buffer source, vk::Buffer destination, vk::DeviceSize
 }
 
 void VkApp::CreateDescriptorSetLayout() {
-	auto ubo_layout_binding = vk::DescriptorSetLayoutBinding()
-	.setDescriptorType(vk::DescriptorType::eUniformBuffer)
-	.setDescriptorCount(1)
-	.setStageFlags(vk::ShaderStageFlagBits::eVertex)
-	.setPImmutableSamplers(nullptr);
+	// The HUD draws with the scene's layout, so its shaders are part of the
+	// same interface; a binding they disagree on is an error here rather
+	// than a validation message later
+	ShaderInterface scene_interface = ShaderInterface::Reflect(ReadShader("vertex-v.spv"));
+	scene_interface.Merge(ShaderInterface::Reflect(ReadShader("fragment-f.spv")));
+	scene_interface.Merge(ShaderInterface::Reflect(ReadShader("gbuffer-f.spv")));
+	scene_interface.Merge(ShaderInterface::Reflect(ReadShader("hud-v.spv")));
+	scene_interface.Merge(ShaderInterface::Reflect(ReadShader("hud-f.spv")));
+
+	if (scene_interface.GetSetCount() != 1 || scene_interface.push_constant_size < sizeof(PushConstants)) {
+		throw std::runtime_error("Scene shaders do not match the scene's descriptors");
+	}
 
-	auto layout_info = vk::DescriptorSetLayoutCreateInfo()
-	.setBindingCount(1)
-	.setPBindings(&ubo_layout_binding);
-	descriptor_set_layout = device.createDescriptorSetLayout(layout_info);
+	descriptor_set_layout = layout_cache.GetSetLayout(scene_interface, 0);
+	pipeline_layout = layout_cache.GetPipelineLayout(scene_interface);
 }
 
 void VkApp::CreateUniformBuffer() {
 	vk::DeviceSize buffer_size = sizeof(UniformBufferObject);
 
-	uniform_staging_buffer = CreateBuffer(
+	uniform_buffer = CreateBuffer(
 		buffer_size,
+		vk::BufferUsageFlagBits::eTransferDst
+		| vk::BufferUsageFlagBits::eUniformBuffer,
+		vk::MemoryPropertyFlagBits::eDeviceLocal,
+		uniform_buffer_memory
+	);
+}
+
+void VkApp::CreateUniformStaging() {
+	DestroyUniformStaging();
+
+	vk::DeviceSize size = (vk::DeviceSize) command_buffers.size() * sizeof(UniformBufferObject);
+	uniform_staging_buffer = CreateBuffer(
+		size,
 		vk::BufferUsageFlagBits::eTransferSrc,
 		vk::MemoryPropertyFlagBits::eHostVisible
 		| vk::MemoryPropertyFlagBits::eHostCoherent,
 		uniform_staging_buffer_memory
 	);
+	uniform_staging = (UniformBufferObject*) device.mapMemory(uniform_staging_buffer_memory, 0, size, {});
+}
 
-	uniform_buffer = CreateBuffer(
-		buffer_size,
-		vk::BufferUsageFlagBits::eTransferDst
-		| vk::BufferUsageFlagBits::eUniformBuffer,
-		vk::MemoryPropertyFlagBits::eDeviceLocal,
-		uniform_buffer_memory
+void VkApp::DestroyUniformStaging() {
+	if (!uniform_staging_buffer) return;
+
+	device.unmapMemory(uniform_staging_buffer_memory);
+	device.destroyBuffer(uniform_staging_buffer, allocator);
+	FreeDeviceMemory(uniform_staging_buffer_memory);
+
+	uniform_staging_buffer = nullptr;
+	uniform_staging_buffer_memory = nullptr;
+	uniform_staging = nullptr;
+}
+
+void VkApp::RecordUniformUpload(vk::CommandBuffer command_buffer, uint32_t i) {
+	// The slot's fence has signaled, so its region is free to overwrite
+	uniform_staging[i] = uniforms;
+
+	// The previous frame may still be reading the UBO; submission order
+	// puts its reads in this barrier's first scope
+	auto before_copy = vk::BufferMemoryBarrier()
+	.setSrcAccessMask(vk::AccessFlagBits::eUniformRead)
+	.setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
+	.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+	.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+	.setBuffer(uniform_buffer)
+	.setOffset(0)
+	.setSize(sizeof(UniformBufferObject));
+
+	vk::PipelineStageFlags readers =
+		vk::PipelineStageFlagBits::eVertexShader
+		| vk::PipelineStageFlagBits::eFragmentShader
+		| vk::PipelineStageFlagBits::eComputeShader;
+
+	command_buffer.pipelineBarrier(
+		readers,
+		vk::PipelineStageFlagBits::eTransfer,
+		vk::DependencyFlags(),
+		{}, { before_copy }, {}
+	);
+
+	auto region = vk::BufferCopy()
+	.setSrcOffset((vk::DeviceSize) i * sizeof(UniformBufferObject))
+	.setDstOffset(0)
+	.setSize(sizeof(UniformBufferObject));
+
+	command_buffer.copyBuffer(uniform_staging_buffer, uniform_buffer, 1, &region);
+
+	auto after_copy = vk::BufferMemoryBarrier()
+	.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+	.setDstAccessMask(vk::AccessFlagBits::eUniformRead)
+	.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+	.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+	.setBuffer(uniform_buffer)
+	.setOffset(0)
+	.setSize(sizeof(UniformBufferObject));
+
+	command_buffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eTransfer,
+		readers,
+		vk::DependencyFlags(),
+		{}, { after_copy }, {}
 	);
 }
 
 void VkApp::UpdateUniformBuffer() {
-	static auto start_time = std::chrono::high_resolution_clock::now();
-
-	auto current_time = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time).count() / 1000.0f;
+	// The animation clock only advances while animating, so pausing
+	// freezes the scene instead of jumping ahead on resume
+	auto current_time = FramePacer::Clock::now();
+	float delta = std::chrono::duration<float>(current_time - last_update).count();
+	if (animate) {
+		animation_time += delta;
+	}
+	last_update = current_time;
+
+	// Particles freeze with the animation, and a long stall (a resize,
+	// say) does not turn into one huge step
+	particle_dt = animate ? std::min(delta, 0.05f) : 0.0f;
+
+	float time = animation_time;
+
+	// The spin lives in the scene now, so only the root's subtree is
+	// recomputed and only while animating
+	if (animate) {
+		scene.SetLocalTransform(scene_root, glm::rotate(
+			glm::mat4(),
+			time * glm::radians(90.0f),
+			glm::vec3(0.0f, 0.0f, 1.0f)
+		));
+	}
 
 	UniformBufferObject ubo = {};
-	ubo.model = glm::rotate(
-		glm::mat4(),
-		time * glm::radians(90.0f),
-		glm::vec3(0.0f, 0.0f, 1.0f)
-	);
+	ubo.model = glm::mat4();
 	ubo.view = glm::lookAt(
 		glm::vec3(2.0f, 2.0f, 2.0f),	// eye
 		glm::vec3(0.0f, 0.0f, 0.0f),	// target
@@ -1123,48 +4162,59 @@ void VkApp::UpdateUniformBuffer() {
 	);
 	ubo.proj = glm::perspective(
 		glm::radians(45.0f),	// vertical field-of-view
-		swapchain_extent.width / (float) swapchain_extent.height,	// aspect ratio
+		outputs[0]->extent.width / (float) outputs[0]->extent.height,	// aspect ratio
 		0.1f,		// near
 		10.0f		// far
 	);
 	ubo.proj[1][1] *= -1.0f;
 
-	void* data;
-	data = device.mapMemory(uniform_staging_buffer_memory, 0, sizeof(ubo), {});
-	memcpy(data, &ubo, sizeof(ubo));
-	device.unmapMemory(uniform_staging_buffer_memory);
-
-	CopyBuffer(uniform_staging_buffer, uniform_buffer, sizeof(ubo));
+	// Uploaded by the frame's command buffer, and kept for sorting draws
+	// against the same camera
+	uniforms = ubo;
 }
 
 void VkApp::CreateDescriptorPool() {
-	auto pool_size = vk::DescriptorPoolSize()
+	// One set per live texture, plus the overlay font, plus room for
+	// replaced textures that keep theirs until the frames using them finish
+	vk::DescriptorPoolSize pool_sizes[2];
+	pool_sizes[0]
 	.setType(vk::DescriptorType::eUniformBuffer)
-	.setDescriptorCount(1);
+	.setDescriptorCount(8);
+	pool_sizes[1]
+	.setType(vk::DescriptorType::eCombinedImageSampler)
+	.setDescriptorCount(8);
 
 	auto pool_info = vk::DescriptorPoolCreateInfo()
-	.setPoolSizeCount(1)
-	.setPPoolSizes(&pool_size)
-	.setMaxSets(1);
-	descriptor_pool = device.createDescriptorPool(pool_info);
+	.setFlags(vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet)
+	.setPoolSizeCount(2)
+	.setPPoolSizes(pool_sizes)
+	.setMaxSets(8);
+	descriptor_pool = device.createDescriptorPool(pool_info, allocator);
 }
 
-void VkApp::CreateDescriptorSet() {
+void VkApp::CreateDescriptorSet(Texture& texture) {
 	vk::DescriptorSetLayout layouts[] = { descriptor_set_layout };
 
 	auto alloc_info = vk::DescriptorSetAllocateInfo()
 	.setDescriptorPool(descriptor_pool)
 	.setDescriptorSetCount(1)
 	.setPSetLayouts(layouts);
-	descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
+	texture.descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
 
 	auto buffer_info = vk::DescriptorBufferInfo()
 	.setBuffer(uniform_buffer)
 	.setOffset(0)
 	.setRange(sizeof(UniformBufferObject));
 
-	auto descriptor_write = vk::WriteDescriptorSet()
-	.setDstSet(descriptor_set)
+	auto image_info = vk::DescriptorImageInfo()
+	.setSampler(texture_sampler)
+	.setImageView(texture.view)
+	.setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+
+	std::array<vk::WriteDescriptorSet, 2> descriptor_writes;
+
+	descriptor_writes[0]
+	.setDstSet(texture.descriptor_set)
 	.setDstBinding(0)
 	.setDstArrayElement(0)
 	.setDescriptorType(vk::DescriptorType::eUniformBuffer)
@@ -1172,5 +4222,452 @@ void VkApp::CreateDescriptorSet() {
 	.setPBufferInfo(&buffer_info)
 	.setPImageInfo(nullptr)
 	.setPTexelBufferView(nullptr);
-	device.updateDescriptorSets({ descriptor_write }, {});
+
+	descriptor_writes[1]
+	.setDstSet(texture.descriptor_set)
+	.setDstBinding(1)
+	.setDstArrayElement(0)
+	.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+	.setDescriptorCount(1)
+	.setPBufferInfo(nullptr)
+	.setPImageInfo(&image_info)
+	.setPTexelBufferView(nullptr);
+
+	device.updateDescriptorSets(descriptor_writes, {});
+}
+
+vk::Image VkApp::CreateImage(
+	uint32_t width, uint32_t height, uint32_t mip_levels,
+	vk::Format format, vk::ImageTiling tiling, vk::ImageUsageFlags usage,
+	vk::MemoryPropertyFlags properties, vk::DeviceMemory& memory,
+	vk::SampleCountFlagBits samples, vk::MemoryPropertyFlags preferred
+) {
+	auto image_info = vk::ImageCreateInfo()
+	.setImageType(vk::ImageType::e2D)
+	.setExtent({ width, height, 1 })
+	.setMipLevels(mip_levels)
+	.setArrayLayers(1)
+	.setFormat(format)
+	.setTiling(tiling)
+	.setInitialLayout(vk::ImageLayout::eUndefined)
+	.setUsage(usage)
+	.setSamples(samples)
+	.setSharingMode(vk::SharingMode::eExclusive);
+
+	vk::Image image = device.createImage(image_info, allocator);
+
+	vk::MemoryRequirements mem_requirements;
+	mem_requirements = device.getImageMemoryRequirements(image);
+
+	// The preferred properties are only a hint, checked against the types
+	// this particular image accepts
+	uint32_t memory_type;
+	if (!preferred || !TryFindMemoryType(mem_requirements.memoryTypeBits, properties | preferred, memory_type)) {
+		memory_type = FindMemoryType(mem_requirements.memoryTypeBits, properties);
+	}
+
+	auto alloc_info = vk::MemoryAllocateInfo()
+	.setAllocationSize(mem_requirements.size)
+	.setMemoryTypeIndex(memory_type);
+	memory = AllocateDeviceMemory(alloc_info);
+
+	device.bindImageMemory(image, memory, 0);
+	return image;
+}
+
+vk::ImageView VkApp::CreateImageView(
+	vk::Image image, vk::Format format,
+	vk::ImageAspectFlags aspect, uint32_t mip_levels
+) {
+	vk::ImageViewCreateInfo view_info = vk::ImageViewCreateInfo()
+	.setImage(image)
+	.setViewType(vk::ImageViewType::e2D)
+	.setFormat(format);
+
+	view_info.subresourceRange
+		.setAspectMask(aspect)
+		.setBaseMipLevel(0)
+		.setLevelCount(mip_levels)
+		.setBaseArrayLayer(0)
+		.setLayerCount(1);
+
+	return device.createImageView(view_info, allocator);
+}
+
+void VkApp::RecordImageTransition(
+	vk::CommandBuffer command_buffer, vk::Image image,
+	vk::ImageLayout old_layout, vk::ImageLayout new_layout,
+	uint32_t base_mip, uint32_t mip_count
+) {
+	// Who last touched the image in its old layout, and who uses it next
+	auto access_for = [](vk::ImageLayout layout,
+		vk::AccessFlags& access, vk::PipelineStageFlags& stage)
+	{
+		switch (layout) {
+		case vk::ImageLayout::eTransferDstOptimal:
+			access = vk::AccessFlagBits::eTransferWrite;
+			stage = vk::PipelineStageFlagBits::eTransfer;
+			break;
+		case vk::ImageLayout::eTransferSrcOptimal:
+			access = vk::AccessFlagBits::eTransferRead;
+			stage = vk::PipelineStageFlagBits::eTransfer;
+			break;
+		case vk::ImageLayout::eShaderReadOnlyOptimal:
+			access = vk::AccessFlagBits::eShaderRead;
+			stage = vk::PipelineStageFlagBits::eFragmentShader;
+			break;
+		default:
+			access = vk::AccessFlags();
+			stage = vk::PipelineStageFlagBits::eTopOfPipe;
+			break;
+		}
+	};
+
+	vk::AccessFlags src_access, dst_access;
+	vk::PipelineStageFlags src_stage, dst_stage;
+	access_for(old_layout, src_access, src_stage);
+	access_for(new_layout, dst_access, dst_stage);
+
+	auto barrier = vk::ImageMemoryBarrier()
+	.setOldLayout(old_layout)
+	.setNewLayout(new_layout)
+	.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+	.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+	.setImage(image)
+	.setSrcAccessMask(src_access)
+	.setDstAccessMask(dst_access);
+
+	barrier.subresourceRange
+		.setAspectMask(vk::ImageAspectFlagBits::eColor)
+		.setBaseMipLevel(base_mip)
+		.setLevelCount(mip_count)
+		.setBaseArrayLayer(0)
+		.setLayerCount(1);
+
+	command_buffer.pipelineBarrier(
+		src_stage, dst_stage, vk::DependencyFlags(),
+		{}, {}, { barrier }
+	);
+}
+
+void VkApp::RecordMipmapGeneration(
+	vk::CommandBuffer command_buffer, vk::Image image,
+	uint32_t width, uint32_t height, uint32_t mip_levels
+) {
+	// Expects every level in TransferDst with level 0 filled; leaves every
+	// level in ShaderReadOnly. Each level is blitted from the one above it.
+	int32_t mip_width = (int32_t) width;
+	int32_t mip_height = (int32_t) height;
+
+	for (uint32_t i = 1; i < mip_levels; i++) {
+		RecordImageTransition(command_buffer, image,
+			vk::ImageLayout::eTransferDstOptimal,
+			vk::ImageLayout::eTransferSrcOptimal, i - 1, 1);
+
+		int32_t next_width = std::max(mip_width / 2, 1);
+		int32_t next_height = std::max(mip_height / 2, 1);
+
+		vk::ImageBlit blit;
+		blit.srcSubresource
+			.setAspectMask(vk::ImageAspectFlagBits::eColor)
+			.setMipLevel(i - 1)
+			.setBaseArrayLayer(0)
+			.setLayerCount(1);
+		blit.srcOffsets[0] = vk::Offset3D(0, 0, 0);
+		blit.srcOffsets[1] = vk::Offset3D(mip_width, mip_height, 1);
+		blit.dstSubresource
+			.setAspectMask(vk::ImageAspectFlagBits::eColor)
+			.setMipLevel(i)
+			.setBaseArrayLayer(0)
+			.setLayerCount(1);
+		blit.dstOffsets[0] = vk::Offset3D(0, 0, 0);
+		blit.dstOffsets[1] = vk::Offset3D(next_width, next_height, 1);
+
+		command_buffer.blitImage(
+			image, vk::ImageLayout::eTransferSrcOptimal,
+			image, vk::ImageLayout::eTransferDstOptimal,
+			{ blit }, vk::Filter::eLinear
+		);
+
+		RecordImageTransition(command_buffer, image,
+			vk::ImageLayout::eTransferSrcOptimal,
+			vk::ImageLayout::eShaderReadOnlyOptimal, i - 1, 1);
+
+		mip_width = next_width;
+		mip_height = next_height;
+	}
+
+	RecordImageTransition(command_buffer, image,
+		vk::ImageLayout::eTransferDstOptimal,
+		vk::ImageLayout::eShaderReadOnlyOptimal, mip_levels - 1, 1);
+}
+
+void VkApp::CreateTextureUploader() {
+	// Large enough for a 2048x2048 RGBA8 image and then some
+	const vk::DeviceSize ring_size = 32 * 1024 * 1024;
+
+	staging_buffer = CreateBuffer(
+		ring_size,
+		vk::BufferUsageFlagBits::eTransferSrc,
+		vk::MemoryPropertyFlagBits::eHostVisible |
+		vk::MemoryPropertyFlagBits::eHostCoherent,
+		staging_buffer_memory
+	);
+	staging_ring.Init(device, staging_buffer, staging_buffer_memory, ring_size);
+
+	// Blits need a graphics-capable queue, so uploads share its family
+	auto command_pool_info = vk::CommandPoolCreateInfo()
+	.setFlags(vk::CommandPoolCreateFlagBits::eTransient)
+	.setQueueFamilyIndex(queue_families.graphics_family);
+	upload_command_pool = device.createCommandPool(command_pool_info, allocator);
+
+	// Uncompressed images are encoded to BC1/BC3 on the loader thread when
+	// the device can sample them
+	bool bc_supported = device_features.textureCompressionBC &&
+		IsFormatSampleable(ToVkFormat(BlockFormat::BC1)) &&
+		IsFormatSampleable(ToVkFormat(BlockFormat::BC3));
+
+	texture_loader.SetCompression(bc_supported);
+	texture_loader.SetCompletionCallback([this] { WakeRenderThread(); });
+	texture_loader.Start(job_system);
+}
+
+void VkApp::CreateTextureSampler() {
+	auto sampler_info = vk::SamplerCreateInfo()
+	.setMagFilter(vk::Filter::eLinear)
+	.setMinFilter(vk::Filter::eLinear)
+	.setMipmapMode(vk::SamplerMipmapMode::eLinear)
+	.setAddressModeU(vk::SamplerAddressMode::eRepeat)
+	.setAddressModeV(vk::SamplerAddressMode::eRepeat)
+	.setAddressModeW(vk::SamplerAddressMode::eRepeat)
+	.setAnisotropyEnable(false)
+	.setMaxAnisotropy(1.0f)
+	.setCompareEnable(false)
+	.setMinLod(0.0f)
+	.setMaxLod(32.0f)	// more levels than any 2D image can have
+	.setMipLodBias(0.0f)
+	.setBorderColor(vk::BorderColor::eIntOpaqueBlack)
+	.setUnnormalizedCoordinates(false);
+
+	texture_sampler = device.createSampler(sampler_info, allocator);
+}
+
+void VkApp::CreatePlaceholderTexture() {
+	ImageData white;
+	memset(white.AddLevel(1, 1, 4), 255, 4);
+
+	if (!BeginTextureUpload(white, placeholder_texture)) {
+		throw std::runtime_error("Failed to upload placeholder texture");
+	}
+
+	// Tiny, and everything else depends on it, so wait for this one
+	device.waitForFences(
+		{ texture_uploads.back().fence }, true, std::numeric_limits<uint64_t>::max()
+	);
+	UpdateTextureUploads();
+}
+
+void VkApp::LoadTexture(const string& path) {
+	texture_path = path;
+
+	// Before InitVulkan the path is just remembered
+	if (device) pending_image = texture_loader.Load(path);
+}
+
+vk::Format VkApp::ToVkFormat(BlockFormat format) {
+	switch (format) {
+	case BlockFormat::RGBA8:		return vk::Format::eR8G8B8A8Unorm;
+	case BlockFormat::BC1:			return vk::Format::eBc1RgbaUnormBlock;
+	case BlockFormat::BC3:			return vk::Format::eBc3UnormBlock;
+	case BlockFormat::BC5:			return vk::Format::eBc5UnormBlock;
+	case BlockFormat::BC7:			return vk::Format::eBc7UnormBlock;
+	case BlockFormat::ETC2_RGB8:	return vk::Format::eEtc2R8G8B8UnormBlock;
+	case BlockFormat::ETC2_RGBA8:	return vk::Format::eEtc2R8G8B8A8UnormBlock;
+	}
+
+	return vk::Format::eUndefined;
+}
+
+bool VkApp::IsFormatSampleable(vk::Format format) {
+	auto properties = physical_device.getFormatProperties(format);
+	return (bool) (properties.optimalTilingFeatures &
+		vk::FormatFeatureFlagBits::eSampledImage);
+}
+
+bool VkApp::BeginTextureUpload(const ImageData& image, Texture& destination) {
+	vk::DeviceSize size = image.pixels.size();
+	vk::DeviceSize offset;
+	void* data;
+
+	// Level offsets are 16-byte aligned, so the whole upload is too
+	if (!staging_ring.Allocate(size, 16, offset, data)) return false;
+	memcpy(data, image.pixels.data(), (size_t) size);
+	upload_bytes_total.Add(size);
+
+	TextureUpload upload;
+	upload.destination = &destination;
+
+	Texture& texture = upload.texture;
+	texture.format = ToVkFormat(image.format);
+
+	// Without a mip chain from the file, mips are blitted on the GPU, which
+	// needs an uncompressed format with linear filtering
+	auto properties = physical_device.getFormatProperties(texture.format);
+	bool generate_mips = image.levels.size() == 1 &&
+		!IsBlockCompressed(image.format) &&
+		(properties.optimalTilingFeatures &
+		vk::FormatFeatureFlagBits::eSampledImageFilterLinear);
+
+	texture.mip_levels = (uint32_t) image.levels.size();
+	if (generate_mips) {
+		uint32_t largest = std::max(image.width, image.height);
+		while (largest >>= 1) texture.mip_levels++;
+	}
+
+	vk::ImageUsageFlags usage =
+		vk::ImageUsageFlagBits::eTransferDst |
+		vk::ImageUsageFlagBits::eSampled;
+	if (generate_mips) usage |= vk::ImageUsageFlagBits::eTransferSrc;
+
+	texture.image = CreateImage(
+		image.width, image.height, texture.mip_levels,
+		texture.format, vk::ImageTiling::eOptimal, usage,
+		vk::MemoryPropertyFlagBits::eDeviceLocal,
+		texture.memory
+	);
+	texture.view = CreateImageView(
+		texture.image, texture.format,
+		vk::ImageAspectFlagBits::eColor, texture.mip_levels
+	);
+
+	auto alloc_info = vk::CommandBufferAllocateInfo()
+	.setLevel(vk::CommandBufferLevel::ePrimary)
+	.setCommandPool(upload_command_pool)
+	.setCommandBufferCount(1);
+	device.allocateCommandBuffers(&alloc_info, &upload.command_buffer);
+
+	vk::CommandBuffer command_buffer = upload.command_buffer;
+	command_buffer.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+
+	RecordImageTransition(command_buffer, texture.image,
+		vk::ImageLayout::eUndefined,
+		vk::ImageLayout::eTransferDstOptimal, 0, texture.mip_levels);
+
+	// The image's level count is bounded by 32, so no heap needed here
+	std::array<vk::BufferImageCopy, 32> regions;
+	uint32_t region_count = 0;
+
+	for (const auto& level : image.levels) {
+		auto& region = regions[region_count];
+		region
+		.setBufferOffset(offset + level.offset)
+		.setBufferRowLength(0)
+		.setBufferImageHeight(0)
+		.setImageOffset({ 0, 0, 0 })
+		.setImageExtent({ level.width, level.height, 1 });
+		region.imageSubresource
+			.setAspectMask(vk::ImageAspectFlagBits::eColor)
+			.setMipLevel(region_count)
+			.setBaseArrayLayer(0)
+			.setLayerCount(1);
+
+		if (++region_count == regions.size()) break;
+	}
+
+	command_buffer.copyBufferToImage(
+		staging_ring.GetBuffer(), texture.image,
+		vk::ImageLayout::eTransferDstOptimal,
+		vk::ArrayProxy<const vk::BufferImageCopy>(region_count, regions.data())
+	);
+
+	if (generate_mips) {
+		RecordMipmapGeneration(command_buffer, texture.image,
+			image.width, image.height, texture.mip_levels);
+	} else {
+		RecordImageTransition(command_buffer, texture.image,
+			vk::ImageLayout::eTransferDstOptimal,
+			vk::ImageLayout::eShaderReadOnlyOptimal, 0, texture.mip_levels);
+	}
+
+	command_buffer.end();
+
+	upload.fence = device.createFence({}, allocator);
+
+	auto submit_info = vk::SubmitInfo()
+	.setCommandBufferCount(1)
+	.setPCommandBuffers(&command_buffer);
+	graphics_queue.submit({ submit_info }, upload.fence);
+
+	upload.marker = staging_ring.Submit();
+	texture_uploads.push_back(upload);
+
+	return true;
+}
+
+void VkApp::UpdateTextureUploads() {
+	// Uploads complete in submission order
+	while (!texture_uploads.empty()) {
+		TextureUpload& upload = texture_uploads.front();
+		if (device.getFenceStatus(upload.fence) != vk::Result::eSuccess) break;
+
+		staging_ring.Retire(upload.marker);
+		device.freeCommandBuffers(upload_command_pool, { upload.command_buffer });
+		device.destroyFence(upload.fence, allocator);
+
+		// Frames in flight may still sample the texture being replaced;
+		// the next frame recorded already uses the new one. Before the
+		// first frame there is nothing in flight.
+		Texture& destination = *upload.destination;
+		if (destination.image) {
+			if (retired_textures.empty()) {
+				DestroyTexture(destination);
+			} else {
+				uint32_t last_slot = (frame_slot + (uint32_t) retired_textures.size() - 1)
+					% (uint32_t) retired_textures.size();
+				retired_textures[last_slot].push_back(destination);
+			}
+		}
+
+		destination = upload.texture;
+		CreateDescriptorSet(destination);
+		destination.ready = true;
+
+		texture_uploads.pop_front();
+		RequestRedraw();
+	}
+
+	if (!pending_image || !pending_image->ready) return;
+
+	if (pending_image->failed) {
+		cout << pending_image->error << endl;
+		pending_image.reset();
+	} else if (!IsFormatSampleable(ToVkFormat(pending_image->image.format))) {
+		cout << "Texture " << pending_image->path
+			<< " uses a format the device cannot sample" << endl;
+		pending_image.reset();
+	} else if (pending_image->image.pixels.size() > staging_ring.GetSize()) {
+		cout << "Texture " << pending_image->path
+			<< " does not fit in the staging ring" << endl;
+		pending_image.reset();
+	} else if (BeginTextureUpload(pending_image->image, texture)) {
+		pending_image.reset();
+	}
+	// Otherwise the ring is full; try again once earlier uploads retire
+}
+
+void VkApp::DestroyTexture(Texture& texture) {
+	if (texture.descriptor_set) {
+		device.freeDescriptorSets(descriptor_pool, { texture.descriptor_set });
+	}
+
+	device.destroyImageView(texture.view, allocator);
+	device.destroyImage(texture.image, allocator);
+	FreeDeviceMemory(texture.memory);
+
+	texture = Texture();
+}
+
+void VkApp::DestroyRetiredTextures(uint32_t i) {
+	for (Texture& texture : retired_textures[i]) DestroyTexture(texture);
+	retired_textures[i].clear();
 }
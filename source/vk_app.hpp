@@ -11,6 +11,32 @@
 #include <vector>
 #include <array>
 #include <string>
+#include <memory>
+#include <deque>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "pipeline_compiler.hpp"
+#include "frame_pacer.hpp"
+#include "staging_ring.hpp"
+#include "texture_loader.hpp"
+#include "bvh.hpp"
+#include "scene.hpp"
+#include "job_system.hpp"
+#include "host_allocator.hpp"
+#include "frame_arena.hpp"
+#include "spsc_queue.hpp"
+#include "capture_writer.hpp"
+#include "hud_builder.hpp"
+#include "metrics.hpp"
+#include "specialization.hpp"
+#include "vertex_layout.hpp"
+#include "shader_reflection.hpp"
+#include "layout_cache.hpp"
 
 struct QueueFamilyIndices {
 	int graphics_family = -1;
@@ -26,12 +52,74 @@ struct SwapChainSupportDetails {
 	std::vector<vk::PresentModeKHR> present_modes;
 };
 
+// How the swapchain trades latency against throughput and power
+enum class PresentPolicy {
+	LowLatency,	// immediate (tearing) or mailbox, fewest queued images
+	Throughput,	// mailbox or fifo with one extra image to absorb spikes
+	PowerSave	// plain vsync with the minimum number of images
+};
+
 struct Vertex {
-	glm::vec2 pos;
+	glm::vec3 pos;
 	glm::vec3 color;
+	glm::vec2 tex_coord;
+};
+
+// Vertex with 16-bit snorm positions (divided by SceneVariant's
+// position_scale), 8-bit colors and 16-bit unorm texture coordinates;
+// half the size of Vertex, decoded by the vertex fetch for free
+struct QuantizedVertex {
+	Snorm16x4 pos;
+	Unorm8x4 color;
+	Unorm16x2 tex_coord;
+};
+
+// Per-instance data of instanced scene draws, at binding 1
+struct InstanceData {
+	glm::mat4 model;
+};
+
+// Vertex inputs of vertex.vert: position, color and texture coordinate at
+// locations 0 to 2 in either vertex format, the instance model at 3 to 6
+using VertexInput = VertexLayout<Vertex, 0, VK_VERTEX_INPUT_RATE_VERTEX, 0,
+	VERTEX_MEMBER(Vertex, pos), VERTEX_MEMBER(Vertex, color), VERTEX_MEMBER(Vertex, tex_coord)>;
+
+using QuantizedVertexInput = VertexLayout<QuantizedVertex, 0, VK_VERTEX_INPUT_RATE_VERTEX, 0,
+	VERTEX_MEMBER(QuantizedVertex, pos), VERTEX_MEMBER(QuantizedVertex, color),
+	VERTEX_MEMBER(QuantizedVertex, tex_coord)>;
+
+using InstanceInput = VertexLayout<InstanceData, 1, VK_VERTEX_INPUT_RATE_INSTANCE, VertexInput::next_location,
+	VERTEX_MEMBER(InstanceData, model)>;
+
+static_assert(QuantizedVertexInput::next_location == VertexInput::next_location,
+	"Both vertex formats have to feed the same shader inputs");
+static_assert(InstanceInput::first_location == 3 && InstanceInput::next_location == 7,
+	"vertex.vert reads the instance model at locations 3 to 6");
+
+// hud.vert: position, texture coordinate and color at locations 0 to 2
+using HudVertexInput = VertexLayout<HudVertex, 0, VK_VERTEX_INPUT_RATE_VERTEX, 0,
+	VERTEX_MEMBER(HudVertex, pos), VERTEX_MEMBER(HudVertex, tex_coord),
+	VERTEX_MEMBER_AS(HudVertex, color, Unorm8x4)>;
+
+// Feature toggles of the scene shaders, baked into the pipelines as
+// specialization constants; member i is constant_id i in vertex.vert
+struct SceneVariant {
+	VkBool32	vertex_color = VK_TRUE;		// tint the texture with the vertex color
+	VkBool32	instanced = VK_FALSE;		// one draw per mesh, models from InstanceData
+	VkBool32	quantized = VK_FALSE;		// vertices are QuantizedVertex
+	float		position_scale = 1.0f;		// set from the mesh when quantized
+};
+
+struct Texture {
+	vk::Image			image;
+	vk::DeviceMemory	memory;
+	vk::ImageView		view;
+	vk::Format			format;
+	uint32_t			mip_levels = 1;
 
-	static vk::VertexInputBindingDescription GetBindingDescription();
-	static std::array<vk::VertexInputAttributeDescription, 2> GetAttributeDescriptions();
+	// Descriptor set binding this texture with the uniform buffer
+	vk::DescriptorSet	descriptor_set;
+	bool				ready = false;
 };
 
 struct UniformBufferObject {
@@ -40,16 +128,140 @@ struct UniformBufferObject {
 	glm::mat4 proj;
 };
 
+// One light of the deferred path as it is set up; matches Light in
+// light_update.comp. Point lights have a cone cosine of -2, so every
+// direction is inside it.
+struct Light {
+	glm::vec4 position_radius;	// world position at time zero, distance the light reaches
+	glm::vec4 color;			// rgb, intensity
+	glm::vec4 direction_cos;	// spot axis, cosine of the cone's half angle
+	glm::vec4 motion;			// orbit speed about z (radians/s), bob height, bob phase, unused
+};
+
+// The same light where it is this frame, written on the GPU; matches
+// FrameLight in the light passes and lighting.frag
+struct FrameLight {
+	glm::vec4 position_radius;	// world position, reach
+	glm::vec4 color;
+	glm::vec4 direction_cos;	// world spot axis, cone cosine
+	glm::vec4 view_position;	// for culling against the view-space clusters
+};
+
+// Froxel grid for clustered light culling: screen tiles, each split into
+// depth slices spaced exponentially between the near and far planes.
+// Specialization constants 0 to 3 of the light culling and lighting shaders.
+struct ClusterGrid {
+	uint32_t width = 16;
+	uint32_t height = 9;
+	uint32_t depth = 24;
+	uint32_t max_lights = 128;		// per cluster; any more are dropped
+};
+
+// Pushed to both light compute passes; matches Params in the shaders
+struct ClusterParams {
+	glm::mat4 inverse_proj;
+	float near_plane;
+	float far_plane;
+	float time;
+	uint32_t light_count;
+};
+
+// A window event, posted by the GLFW callbacks on the main thread and
+// applied by the render thread between frames
+struct WindowMessage {
+	enum class Type { Resize, Iconify, Refresh, ToggleAnimation, PresentPolicyChanged };
+
+	Type type = Type::Refresh;
+	uint32_t output = 0;	// index of the window it came from
+	uint32_t width = 0;		// Resize
+	uint32_t height = 0;
+	bool iconified = false;	// Iconify
+};
+
+// Per-draw data pushed before each draw call
+struct PushConstants {
+	glm::mat4 model;
+};
+
+// Pushed to every particle compute pass; matches Params in the shaders
+struct ParticleParams {
+	glm::vec4 emitter;		// xyz position, w spread of the initial velocity
+	float dt;
+	uint32_t emit_count;
+	uint32_t capacity;
+	uint32_t seed;
+};
+
+// GPU-side particle bookkeeping; matches Counters in the shaders. Only
+// ever written by the GPU after creation.
+struct ParticleCounters {
+	uint32_t alive;		// particles in the current list
+	uint32_t next;		// survivors appended by the compact pass
+	uint32_t total;		// alive plus the ones emitted this frame
+	uint32_t pad0;
+	VkDispatchIndirectCommand dispatch;
+	uint32_t pad1;
+	VkDrawIndirectCommand draw;
+};
+
+// What the last recorded frame asked of the GPU, shown by the overlay
+struct FrameStats {
+	uint32_t draw_calls = 0;
+	uint32_t triangles = 0;		// of CPU-driven draws; indirect ones are unknown
+	uint32_t pipeline_binds = 0;
+	uint32_t dispatches = 0;
+};
+
+enum class BlendMode {
+	Opaque,
+	Additive,
+	Alpha
+};
+
+// Everything needed to build a graphics pipeline off the main thread
+struct GraphicsPipelineDesc {
+	vk::PipelineLayout	layout;
+	vk::RenderPass		render_pass;
+	uint32_t			subpass = 0;
+
+	std::vector<char>	vertex_code;
+	std::vector<char>	fragment_code;	// empty for depth-only pipelines
+
+	uint32_t			color_attachments = 1;	// zero for depth-only pipelines
+	vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+	bool				depth_test = true;
+	bool				depth_write = true;
+	vk::CompareOp		depth_compare = vk::CompareOp::eLess;
+
+	// Both empty when the vertex shader generates its vertices
+	std::vector<vk::VertexInputBindingDescription>	 vertex_bindings;
+	std::vector<vk::VertexInputAttributeDescription> vertex_attributes;
+
+	BlendMode			blend = BlendMode::Opaque;
+	vk::CullModeFlags	cull_mode = vk::CullModeFlagBits::eBack;
+
+	// Applied to every stage; constants a stage does not declare are ignored
+	ShaderSpecialization specialization;
+
+	const vk::AllocationCallbacks* allocator = nullptr;
+};
+
+// A pipeline in use plus its replacement being compiled in the background
+struct PipelineSlot {
+	vk::Pipeline pipeline;
+	std::shared_ptr<PendingPipeline> pending;
+};
+
 class VkApp {
 public:
 	std::vector<const char*> validationLayers;
 	std::vector<const char*> deviceExtensions;
 
 	const std::vector<Vertex> vertices = {
-		{{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
-		{{ 0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
-		{{ 0.5f,  0.5f}, {0.0f, 0.0f, 1.0f}},
-		{{-0.5f,  0.5f}, {1.0f, 1.0f, 1.0f}}
+		{{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
+		{{ 0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f}},
+		{{ 0.5f,  0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}, {1.0f, 1.0f}},
+		{{-0.5f,  0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}}
 	};
 
 	const std::vector<uint16_t> indices = { 0, 1, 2, 2, 3, 0 };
@@ -60,68 +272,538 @@ public:
 		bool enable_validation_layers = false
 	);
 
+	// Opens another window onto the same scene, rendered by the same device
+	// with the same pipelines and presented together with the others. The
+	// camera keeps the first window's aspect ratio, so other windows are
+	// letterboxed. Must be called before Run().
+	void AddWindow(const std::string& title, uint32_t width, uint32_t height);
+
 	void Run();
 	static void OnWindowResized(GLFWwindow*, int width, int height);
+	static void OnWindowIconified(GLFWwindow*, int iconified);
+	static void OnWindowRefresh(GLFWwindow*);
+	static void OnKey(GLFWwindow*, int key, int scancode, int action, int mods);
+
+	// In idle mode frames are only drawn when something changed; otherwise
+	// the loop blocks on window events
+	void SetIdleMode(bool);
+	void RequestRedraw();
+
+	// Lays down depth in a separate subpass before shading, so each pixel
+	// is shaded once. Must be set before Run().
+	void SetDepthPrepass(bool);
+
+	// Requested MSAA sample count, clamped to what the device supports for
+	// both color and depth. Must be set before Run().
+	void SetSampleCount(uint32_t);
+	vk::SampleCountFlagBits GetSampleCount() const;
+
+	// Draws the scene into a G-buffer and lights it in a second subpass of
+	// the same render pass, reading the G-buffer as input attachments. Turns
+	// MSAA off. Must be set before Run().
+	void SetDeferred(bool);
+
+	// Animated point and spot lights in the deferred path, culled into
+	// view-space clusters on the GPU every frame; 32 by default. Must be
+	// set before Run().
+	void SetLightCount(uint32_t);
+
+	// Which scene shader features are compiled in. Must be set before Run().
+	void SetSceneVariant(const SceneVariant&);
+
+	// Decodes and uploads in the background; the quad shows a plain white
+	// placeholder until the texture is ready
+	void LoadTexture(const std::string& path);
+
+	// Draws frame timing, CPU/GPU split, draw counts and memory use over
+	// the frame in a subpass of its own. Must be set before Run().
+	void SetHud(bool);
+
+	// Upper bound on live GPU particles; zero (the default) disables the
+	// particle system. Must be set before Run().
+	void SetParticleCapacity(uint32_t);
+
+	// Instead of Run(): opens no window, steps the particle system `frames`
+	// times at 60 Hz and reads the counters back after each step. Checks
+	// them against a CPU model of the same emission and lifetimes and
+	// returns false on the first difference. Needs a particle capacity.
+	bool RunParticleCheck(uint32_t frames);
+
+	// Writes every presented frame to `directory` as a PPM sequence. Frames
+	// are read back a swapchain cycle later and written on a worker thread,
+	// so capture never stalls the render loop; a frame whose readback buffer
+	// is still being written is skipped instead. Must be set before Run().
+	void SetCaptureDirectory(const std::string& directory);
+
+	// Writes counters, gauges and histograms of frame timing, uploads and
+	// allocations to `path` in the Prometheus text format about once a
+	// second. Must be set before Run().
+	void SetMetricsPath(const std::string& path);
+
+	// Takes effect on the next swapchain (re)creation, which a running
+	// app's render thread starts on its next frame. Safe to call from the
+	// main thread.
+	void SetPresentPolicy(PresentPolicy);
+	PresentPolicy GetPresentPolicy() const;
+
+	// What the driver actually gave us for the first window's swapchain
+	vk::PresentModeKHR GetPresentMode() const;
+	uint32_t GetSwapchainImageCount() const;
+
+	// Frames per second the main loop paces to; zero follows the refresh
+	// rate of the primary monitor
+	void SetTargetFrameRate(double rate);
+	const FramePacer& GetFramePacer() const;
 
 protected:
 	// ##############################
 	// Window handle and variables
 
-	GLFWwindow* window;
-	std::string title;
-	uint32_t width;
-	uint32_t height;
+	// One window and the swapchain presenting to it. Every window shares
+	// the render pass, pipelines and attachments; only what is tied to its
+	// surface is kept here.
+	struct Output {
+		VkApp*			app = nullptr;		// GLFW user pointers point at the output
+		uint32_t		index = 0;			// in outputs
+
+		GLFWwindow*		window = nullptr;
+		std::string		title;
+		uint32_t		width = 0;
+		uint32_t		height = 0;
+		bool			iconified = false;
+
+		vk::SurfaceKHR			surface;
+		vk::SwapchainKHR		swapchain;
+		vk::Extent2D			extent;
+		vk::PresentModeKHR		present_mode;
+		SwapChainSupportDetails	support;		// refilled in place on recreation
+		bool					stale = false;	// recreate before the next frame
+		std::vector<vk::Image>			images;
+		std::vector<vk::ImageView>		imageviews;
+		std::vector<vk::Framebuffer>	framebuffers;
+
+		// This frame's image, if one was acquired; presented with the
+		// other windows' images in a single presentKHR. One acquire
+		// semaphore per frame slot.
+		std::vector<vk::Semaphore>	image_available;
+		uint32_t		image_index = 0;
+		bool			acquired = false;
+	};
+
+	// outputs[0] is the primary window: the camera's aspect ratio, the
+	// overlay and frame capture follow it. Never resized after InitWindow,
+	// since the GLFW callbacks hold pointers to the outputs.
+	std::vector<std::unique_ptr<Output>> outputs;
 
 	bool validation_enabled;
+	bool headless = false;		// no windows, surfaces or swapchains
+
+	FramePacer frame_pacer;
+	double target_frame_rate = 0.0;
 
+	bool idle_mode = false;
+	bool redraw_requested = true;
+
+	bool animate = true;
+	float animation_time = 0.0f;
+	FramePacer::Clock::time_point last_update;
+
+	// Rendering runs on its own thread; the main thread only pumps GLFW
+	// events and forwards them through `window_messages`
+	std::thread						render_thread;
+	std::atomic<bool>				render_quit { false };
+	std::exception_ptr				render_error;
+	SpscQueue<WindowMessage>		window_messages;
+
+	// Lets other threads wake an idle render thread
+	std::mutex				wake_mutex;
+	std::condition_variable	wake_condition;
+	bool					wake_pending = false;
 
 	void InitWindow();
 	void MainLoop();
+	void RenderLoop();
+	void PostWindowMessage(const WindowMessage&);
+	void ProcessMessages();
+	void WakeRenderThread();
+	void WaitForWake(double timeout_ms);	// zero waits indefinitely
+	bool NeedsRedraw();
 	void DrawFrame();
 	void Cleanup();
 
+	// ##############################
+	// Metrics
+	//
+	// Updated from the render thread with relaxed atomics and written out
+	// by the exporter's thread. Durations are in seconds, as Prometheus
+	// expects. Declared before the registry and exporter so both go away
+	// before the metrics they point to.
+
+	MetricCounter	frames_total { "vkapp_frames_total", "Frames submitted" };
+	MetricHistogram	frame_cpu_seconds {
+		"vkapp_frame_cpu_seconds", "CPU time spent building and submitting a frame",
+		MetricHistogram::ExponentialBounds(0.00025, 2.0, 10)
+	};
+	MetricHistogram	frame_interval_seconds {
+		"vkapp_frame_interval_seconds", "Time between the starts of consecutive frames",
+		MetricHistogram::ExponentialBounds(0.001, 2.0, 8)
+	};
+	MetricHistogram	acquire_seconds {
+		"vkapp_acquire_seconds", "Time blocked in vkAcquireNextImageKHR",
+		MetricHistogram::ExponentialBounds(0.0000625, 2.0, 12)
+	};
+	MetricHistogram	fence_wait_seconds {
+		"vkapp_fence_wait_seconds", "Time waiting for the GPU to release a swapchain image's resources",
+		MetricHistogram::ExponentialBounds(0.0000625, 2.0, 12)
+	};
+	MetricHistogram	submit_seconds {
+		"vkapp_submit_seconds", "Time spent in vkQueueSubmit for a frame",
+		MetricHistogram::ExponentialBounds(0.000015625, 2.0, 10)
+	};
+	MetricCounter	upload_bytes_total { "vkapp_upload_bytes_total", "Texture bytes copied through the staging ring" };
+	MetricCounter	device_allocations_total { "vkapp_device_allocations_total", "vkAllocateMemory calls" };
+	MetricGauge		device_local_bytes_gauge { "vkapp_device_local_bytes", "Live device-local memory" };
+	MetricGauge		host_visible_bytes_gauge { "vkapp_host_visible_bytes", "Live host-visible memory that is not device local" };
+	MetricCounter	heap_allocations_total { "vkapp_heap_allocations_total", "operator new calls made by frames" };
+	MetricCounter	swapchain_recreations_total { "vkapp_swapchain_recreations_total", "Swapchain recreations" };
+	MetricGauge		pacing_error_gauge { "vkapp_pacing_error_seconds", "Last frame interval minus the pacer's target" };
+	MetricGauge		mean_pacing_error_gauge { "vkapp_mean_pacing_error_seconds", "Running average of the absolute pacing error" };
+
+	MetricsRegistry		metrics;
+	MetricsExporter		metrics_exporter;
+	std::string			metrics_path;
+
+	// Start of the previous frame, or zero after an idle period
+	FramePacer::Clock::time_point last_frame_start;
+
+	void RegisterMetrics();
+
 	// ##############################
 	// Vulkan stuff
 
+	// Passed to every create and destroy call; null unless the build
+	// tracks host allocations
+	HostAllocator					host_allocator;
+	const vk::AllocationCallbacks*	allocator = host_allocator.GetCallbacks();
+
 	vk::Instance 				instance;
 	VkDebugReportCallbackEXT	callback;
 
 	vk::PhysicalDevice	physical_device;
+	QueueFamilyIndices	queue_families;	// of physical_device, found once
+	vk::PhysicalDeviceFeatures device_features;
 	vk::Device			device;
 	vk::Queue			graphics_queue;
 	vk::Queue			presentation_queue;
 
-	vk::SurfaceKHR			surface;
-	vk::SwapchainKHR		swapchain;
+	// Every swapchain has this format, so they can share the render pass.
+	// The attachments below cover the largest of them; each window's
+	// framebuffer uses the corner it needs.
 	vk::Format				swapchain_format;
-	vk::Extent2D			swapchain_extent;
-	std::vector<vk::Image>			swapchain_images;
-	std::vector<vk::ImageView>		swapchain_imageviews;
-	std::vector<vk::Framebuffer>	swapchain_framebuffers;
+	vk::Extent2D			attachment_extent;
+	std::atomic<PresentPolicy>	present_policy { PresentPolicy::Throughput };
 
-	vk::PipelineLayout	pipeline_layout;
-	vk::RenderPass		render_pass;
-	vk::Pipeline		graphics_pipeline;
+	vk::Image			depth_image;
+	vk::DeviceMemory	depth_image_memory;
+	vk::ImageView		depth_image_view;
+	vk::Format			depth_format;
+
+	// Multisampled color target, resolved into the swapchain image at the
+	// end of the subpass. Only exists when msaa_samples > 1.
+	vk::Image			color_image;
+	vk::DeviceMemory	color_image_memory;
+	vk::ImageView		color_image_view;
+
+	uint32_t				requested_samples = 1;
+	vk::SampleCountFlagBits	msaa_samples = vk::SampleCountFlagBits::e1;
+
+	// Descriptor set and pipeline layouts come from the shaders' reflected
+	// interfaces; the cache owns them
+	LayoutCache			layout_cache;
 
+	vk::PipelineLayout	pipeline_layout;	// scene and HUD
+	vk::RenderPass		render_pass;
+	PipelineSlot		graphics_pipeline;
+	PipelineSlot		depth_pipeline;
+
+	bool				depth_prepass = false;
+	uint32_t			geometry_subpass = 0;	// where the scene is drawn
+	uint32_t			color_subpass = 0;		// where it ends up shaded
+
+	vk::PipelineCache	pipeline_cache;
+	PipelineCompiler	pipeline_compiler;
+
+	// Shared worker pool for CPU work that can be split up; declared before
+	// anything that submits to it so it outlives them
+	JobSystem			job_system;
+
+	UniformBufferObject		uniforms;
+	// Every scene object is a BVH object with the same index
+	Scene					scene;
+	uint32_t				scene_root = 0;
+	Bvh						draw_bvh;
+	std::vector<uint32_t>	visible_draws;
+
+	SceneVariant			scene_variant;
+
+	// World transforms of the visible draws for instanced drawing; one
+	// region of max_instances per frame slot, persistently mapped.
+	// Bound in every variant, since the scene pipelines always declare the
+	// instance binding.
+	static const uint32_t	max_instances = 1024;
+	vk::Buffer				instance_buffer;
+	vk::DeviceMemory		instance_buffer_memory;
+	InstanceData*			instances = nullptr;
+
+	// Frames cycle through as many slots as the largest swapchain has
+	// images. A slot's command buffer draws every window, so its fence
+	// guards everything else kept per slot.
 	vk::CommandPool					command_pool;
 	std::vector<vk::CommandBuffer>	command_buffers;
-
-	vk::Semaphore	semaphore_image_available;
-	vk::Semaphore	semaphore_render_finished;
+	std::vector<vk::Fence>			command_buffer_fences;
+	uint32_t						frame_slot = 0;
+
+	// Pipelines replaced while earlier frames might still use them, per
+	// frame slot; destroyed once that slot's fence has signaled again
+	std::vector<std::vector<vk::Pipeline>>	retired_pipelines;
+
+	// Textures replaced by an upload, the same way: filed under the slot
+	// of the last frame submitted, the newest one that can still sample them
+	std::vector<std::vector<Texture>>		retired_textures;
+
+	// Scratch memory for one frame, per frame slot; `frame_arena` is the
+	// one belonging to the frame being built
+	std::vector<FrameArena>			frame_arenas;
+	FrameArena*						frame_arena = nullptr;
+	uint64_t						frame_number = 0;
+
+	// Per frame slot; signaled once by the frame's submission and waited
+	// on by its one present, whatever the number of windows
+	std::vector<vk::Semaphore>	render_finished_semaphores;
+
+	// Filled per frame from the acquired outputs; members so their storage
+	// is reused instead of allocated every frame
+	std::vector<vk::Semaphore>			frame_wait_semaphores;
+	std::vector<vk::PipelineStageFlags>	frame_wait_stages;
+	std::vector<vk::SwapchainKHR>		present_swapchains;
+	std::vector<uint32_t>				present_image_indices;
+	std::vector<vk::Result>				present_results;
 
 	vk::Buffer			vertex_buffer;
 	vk::DeviceMemory	vertex_buffer_memory;
 	vk::Buffer			index_buffer;
 	vk::DeviceMemory	index_buffer_memory;
 
+	// One UBO-sized region per frame slot, persistently mapped; the slot's
+	// command buffer copies its region into uniform_buffer
 	vk::Buffer			uniform_staging_buffer;
 	vk::DeviceMemory	uniform_staging_buffer_memory;
+	UniformBufferObject*	uniform_staging = nullptr;
 	vk::Buffer			uniform_buffer;
 	vk::DeviceMemory	uniform_buffer_memory;
 
 	vk::DescriptorSetLayout descriptor_set_layout;
 	vk::DescriptorPool		descriptor_pool;
-	vk::DescriptorSet		descriptor_set;
+
+	// ##############################
+	// Performance overlay
+
+	static const size_t		hud_history = 128;		// frames in the graph
+	static const uint32_t	hud_max_vertices = 8192;	// per frame slot
+
+	bool			hud_enabled = false;
+	uint32_t		hud_subpass = 0;
+	PipelineSlot	hud_pipeline;
+	Texture			hud_font;
+	vk::Sampler		hud_sampler;
+
+	// One region of hud_max_vertices per frame slot, persistently mapped
+	vk::Buffer			hud_vertex_buffer;
+	vk::DeviceMemory	hud_vertex_buffer_memory;
+	HudVertex*			hud_vertices = nullptr;
+
+	// Two timestamps per frame slot around all of its GPU work, read back
+	// once the slot's fence has signaled; feeds the frame pacer and the
+	// overlay's graph
+	vk::QueryPool			timestamp_pool;
+	std::vector<bool>		timestamps_written;
+	float					timestamp_period = 0.0f;	// nanoseconds per tick
+
+	FrameStats					frame_stats;
+	float		hud_interval_ms[hud_history] = {};
+	float		hud_cpu_ms[hud_history] = {};
+	float		hud_gpu_ms[hud_history] = {};
+	size_t		hud_cpu_index = 0;
+	size_t		hud_gpu_index = 0;
+
+	// Every live vk::DeviceMemory with its size, for the overlay
+	std::unordered_map<VkDeviceMemory, std::pair<vk::DeviceSize, bool>> device_allocations;
+	vk::DeviceSize	device_local_bytes = 0;
+	vk::DeviceSize	host_visible_bytes = 0;
+
+	vk::DeviceMemory AllocateDeviceMemory(const vk::MemoryAllocateInfo&);
+	void FreeDeviceMemory(vk::DeviceMemory);
+
+	void CreateHud();
+	void CreateHudFrames();
+	void DestroyHudFrames();
+	void CreateTimestamps();
+	void DestroyTimestamps();
+	void DestroyHud();
+	void ReadTimestamps(uint32_t frame_index);
+	void AddFrameSample(FramePacer::Clock::time_point frame_start);
+	void RecordHud(vk::CommandBuffer, uint32_t frame_index);
+
+	// ##############################
+	// Particles
+	//
+	// Emitted, simulated and compacted by compute passes at the start of
+	// each frame and drawn with an indirect draw, so the CPU only ever
+	// sees the emission count. Each attribute lives in its own buffer
+	// (SoA), and every list exists twice: compaction copies survivors
+	// from the current list into the other, which becomes current.
+
+	uint32_t			particle_capacity = 0;
+	uint32_t			particle_list = 0;		// index of the current list
+	uint32_t			particle_seed = 0;
+	float				particle_dt = 0.0f;		// step for the next update
+	float				particle_emit_budget = 0.0f;
+	ParticleParams		particle_params;		// as pushed by the last update
+
+	vk::Buffer			particle_counters;
+	vk::DeviceMemory	particle_counters_memory;
+	vk::Buffer			particle_positions[2];		// xyz, age
+	vk::DeviceMemory	particle_positions_memory[2];
+	vk::Buffer			particle_velocities[2];		// xyz, lifetime
+	vk::DeviceMemory	particle_velocities_memory[2];
+
+	vk::DescriptorSetLayout	particle_compute_set_layout;
+	vk::DescriptorSetLayout	particle_draw_set_layout;
+	vk::DescriptorPool		particle_descriptor_pool;
+	vk::DescriptorSet		particle_compute_sets[2];	// [current list]
+	vk::DescriptorSet		particle_draw_sets[2];		// [list drawn]
+
+	vk::PipelineLayout	particle_compute_layout;
+	vk::PipelineLayout	particle_draw_layout;
+	PipelineSlot		particle_emit_pipeline;
+	PipelineSlot		particle_simulate_pipeline;
+	PipelineSlot		particle_compact_pipeline;
+	PipelineSlot		particle_draw_pipeline;
+
+	void CreateParticleSystem();
+	void CreateParticleDescriptors();
+	void CreateParticlePipelines();
+	void DestroyParticleSystem();
+	bool ParticlesReady();
+	void RecordParticleUpdate(vk::CommandBuffer);
+	void RecordParticleDraw(vk::CommandBuffer);
+
+	// ##############################
+	// Deferred shading
+	//
+	// The scene writes albedo and normals in the geometry subpass, and the
+	// lighting subpass (color_subpass) shades every pixel from them with a
+	// fullscreen triangle. Both are in one render pass with by-region
+	// dependencies and the G-buffer is never stored, so on tiled GPUs it
+	// stays in tile memory and lighting costs no G-buffer round trip.
+	//
+	// Before the render pass, one compute pass moves the lights and a
+	// second bins them into the clusters of cluster_grid; each pixel then
+	// only evaluates the lights listed for its cluster, so shading cost
+	// follows the local light density rather than the light count.
+
+	bool				deferred = false;
+	uint32_t			light_count = 32;
+	ClusterGrid			cluster_grid;
+
+	const vk::Format	gbuffer_albedo_format = vk::Format::eR8G8B8A8Unorm;
+	const vk::Format	gbuffer_normal_format = vk::Format::eA2B10G10R10UnormPack32;
+
+	vk::Image			gbuffer_albedo;
+	vk::DeviceMemory	gbuffer_albedo_memory;
+	vk::ImageView		gbuffer_albedo_view;
+	vk::Image			gbuffer_normal;		// world space, biased to [0, 1]
+	vk::DeviceMemory	gbuffer_normal_memory;
+	vk::ImageView		gbuffer_normal_view;
+
+	vk::Buffer			light_buffer;			// Light, written once
+	vk::DeviceMemory	light_buffer_memory;
+	vk::Buffer			frame_light_buffer;		// FrameLight, every frame
+	vk::DeviceMemory	frame_light_buffer_memory;
+	vk::Buffer			cluster_count_buffer;	// lights in each cluster
+	vk::DeviceMemory	cluster_count_buffer_memory;
+	vk::Buffer			cluster_index_buffer;	// max_lights light indices per cluster
+	vk::DeviceMemory	cluster_index_buffer_memory;
+
+	vk::DescriptorSetLayout	lighting_set_layout;
+	vk::DescriptorPool		lighting_descriptor_pool;
+	vk::DescriptorSet		lighting_set;
+	vk::PipelineLayout		lighting_layout;
+	PipelineSlot			lighting_pipeline;
+
+	vk::DescriptorSetLayout	cluster_set_layout;
+	vk::DescriptorSet		cluster_set;
+	vk::PipelineLayout		cluster_layout;
+	PipelineSlot			light_update_pipeline;
+	PipelineSlot			light_cull_pipeline;
+
+	void CreateGBuffer();
+	void DestroyGBuffer();
+	void CreateDeferredLighting();
+	void WriteLightingDescriptors();
+	void DestroyDeferredLighting();
+	bool LightingReady();
+	void RecordLightCulling(vk::CommandBuffer);
+	void RecordLighting(vk::CommandBuffer);
+
+	// ##############################
+	// Frame capture
+
+	// Readback buffer for one frame slot, filled with the primary window's
+	// image by that slot's command buffer and handed to the writer after
+	// its fence signals
+	struct CaptureSlot {
+		vk::Buffer			buffer;
+		vk::DeviceMemory	memory;
+		uint8_t*			mapped = nullptr;
+
+		bool				recorded = false;	// copy submitted, not yet handed over
+		uint64_t			frame = 0;
+		std::atomic<bool>	busy { false };		// owned by the writer
+	};
+
+	std::string		capture_directory;
+	bool			capture_enabled = false;
+	uint64_t		captured_frames = 0;
+	uint64_t		dropped_captures = 0;
+	CaptureWriter	capture_writer;
+	std::vector<std::unique_ptr<CaptureSlot>> capture_slots;
+
+	// ##############################
+	// Textures
+
+	struct TextureUpload {
+		vk::CommandBuffer	command_buffer;
+		vk::Fence			fence;
+		StagingRing::Marker	marker;
+
+		Texture				texture;
+		Texture*			destination;
+	};
+
+	std::string		texture_path = "textures/texture.jpg";
+	vk::Sampler		texture_sampler;
+	Texture			placeholder_texture;
+	Texture			texture;
+
+	TextureLoader				texture_loader;
+	std::shared_ptr<PendingImage> pending_image;
+
+	vk::Buffer					staging_buffer;
+	vk::DeviceMemory			staging_buffer_memory;
+	StagingRing					staging_ring;
+	vk::CommandPool				upload_command_pool;
+	std::deque<TextureUpload>	texture_uploads;
 
 	void InitVulkan();
 
@@ -140,7 +822,7 @@ protected:
 		const char* msg,
 		void* userData);
 
-	void CreateSurface();
+	void CreateSurfaces();
 
 	void PickPhysicalDevice();
 	bool isDeviceSuitable(vk::PhysicalDevice);
@@ -149,28 +831,87 @@ protected:
 	void CreateLogicalDevice();
 	bool CheckDeviceExtensionSupport(vk::PhysicalDevice);
 
-	void CreateSwapchain();
-	void RecreateSwapchain();
-	SwapChainSupportDetails QuerySwapchainSupport(vk::PhysicalDevice);
+	void CreateSwapchains();
+	void CreateSwapchain(Output&);
+	void RecreateSwapchains();
+	void QuerySwapchainSupport(vk::PhysicalDevice, vk::SurfaceKHR, SwapChainSupportDetails&);
 	vk::SurfaceFormatKHR ChooseSwapSurfaceFormat(
 		const std::vector<vk::SurfaceFormatKHR>& available_formats);
 	vk::PresentModeKHR ChooseSwapPresentMode(
 		const std::vector<vk::PresentModeKHR>& available_modes);
+	uint32_t ChooseSwapImageCount(
+		const vk::SurfaceCapabilitiesKHR& capabilities, vk::PresentModeKHR mode);
 	vk::Extent2D ChooseSwapExtent(
-		const vk::SurfaceCapabilitiesKHR& capabilities);
+		const vk::SurfaceCapabilitiesKHR& capabilities, const Output&);
+	void DestroyOutput(Output&);
 
-	void CreateImageViews();
+	void CreateImageViews(Output&);
 	void CreateRenderPass();
+	void CreatePipelineCache();
+	void SavePipelineCache();
 	void CreateGraphicsPipeline();
-	void CreateFramebuffers();
+	void CompilePipeline(PipelineSlot&, const GraphicsPipelineDesc&);
+	void CompileComputePipeline(
+		PipelineSlot&, vk::PipelineLayout, const std::vector<char>& code,
+		const ShaderSpecialization& = ShaderSpecialization());
+	static vk::Pipeline BuildGraphicsPipeline(
+		vk::Device, vk::PipelineCache, const GraphicsPipelineDesc&);
+	static vk::Pipeline BuildComputePipeline(
+		vk::Device, vk::PipelineCache, vk::PipelineLayout,
+		const std::vector<char>& code, const ShaderSpecialization&,
+		const vk::AllocationCallbacks*);
+	void UpdatePipelines();
+	void UpdatePipelineSlot(PipelineSlot&);
+	bool HasPipelineUpdate();
+	void DestroyRetiredPipelines(uint32_t frame_index);
+	void DestroyPipelineSlot(PipelineSlot&);
+
+	vk::Format FindSupportedFormat(
+		const std::vector<vk::Format>& candidates,
+		vk::ImageTiling, vk::FormatFeatureFlags
+	);
+	vk::Format FindDepthFormat();
+	void CreateDepthResources();
+	void DestroyDepthResources();
+	void CreateColorResources();
+	void DestroyColorResources();
+
+	vk::SampleCountFlagBits ChooseSampleCount(uint32_t requested);
+	vk::Image CreateAttachmentImage(
+		vk::Format, vk::ImageUsageFlags, vk::SampleCountFlagBits, vk::DeviceMemory&);
+
+	void CreateScene();
+	void CullDrawList();
+	void SortDrawList();
+	void RecordDraws(vk::CommandBuffer);
+	void CreateInstanceBuffer();
+	void DestroyInstanceBuffer();
+	void WriteInstances(uint32_t frame_index);
+	void CreateFramebuffers(Output&);
 
 	static std::vector<char> ReadFile(const std::string& filename);
-	void CreateShaderModule(const std::vector<char>& code, vk::ShaderModule&);
+	static std::vector<char> ReadShader(const std::string& name);
+	static void CreateShaderModule(
+		vk::Device, const std::vector<char>& code, vk::ShaderModule&,
+		const vk::AllocationCallbacks* allocator = nullptr);
+
+	void CreateCaptureResources();
+	void DestroyCaptureResources();
+	void RecordCapture(vk::CommandBuffer, uint32_t frame_index);
+	void FinishCapture(uint32_t frame_index);
 
 	void CreateCommandPool();
 	void CreateCommandBuffers();
+	void RecordCommandBuffer(uint32_t frame_index);
+	void RecordRenderPass(
+		vk::CommandBuffer, const Output&, uint32_t frame_index,
+		bool draw_particles, bool draw_lighting);
+	vk::Rect2D GetSceneArea(const Output&) const;
+	bool AcquireImages();
 
 	void CreateSemaphores();
+	void DestroySemaphores();
+	void CreateFences();
 
 	vk::Buffer CreateBuffer(
 		vk::DeviceSize, vk::BufferUsageFlags,
@@ -185,11 +926,50 @@ protected:
 		uint32_t type_filter,
 		vk::MemoryPropertyFlags properties
 	);
+	bool TryFindMemoryType(
+		uint32_t type_filter,
+		vk::MemoryPropertyFlags properties,
+		uint32_t& type_index
+	);
 
 	void CreateUniformBuffer();
+	void CreateUniformStaging();
+	void DestroyUniformStaging();
 	void UpdateUniformBuffer();
+	void RecordUniformUpload(vk::CommandBuffer, uint32_t frame_index);
 
 	void CreateDescriptorSetLayout();
 	void CreateDescriptorPool();
-	void CreateDescriptorSet();
+	void CreateDescriptorSet(Texture&);
+
+	vk::Image CreateImage(
+		uint32_t width, uint32_t height, uint32_t mip_levels,
+		vk::Format, vk::ImageTiling, vk::ImageUsageFlags,
+		vk::MemoryPropertyFlags, vk::DeviceMemory&,
+		vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1,
+		vk::MemoryPropertyFlags preferred = vk::MemoryPropertyFlags()
+	);
+	vk::ImageView CreateImageView(
+		vk::Image, vk::Format, vk::ImageAspectFlags, uint32_t mip_levels
+	);
+	static void RecordImageTransition(
+		vk::CommandBuffer, vk::Image,
+		vk::ImageLayout old_layout, vk::ImageLayout new_layout,
+		uint32_t base_mip, uint32_t mip_count
+	);
+	static void RecordMipmapGeneration(
+		vk::CommandBuffer, vk::Image,
+		uint32_t width, uint32_t height, uint32_t mip_levels
+	);
+
+	static vk::Format ToVkFormat(BlockFormat);
+	bool IsFormatSampleable(vk::Format);
+
+	void CreateTextureUploader();
+	void CreateTextureSampler();
+	void CreatePlaceholderTexture();
+	bool BeginTextureUpload(const ImageData&, Texture&);
+	void UpdateTextureUploads();
+	void DestroyTexture(Texture&);
+	void DestroyRetiredTextures(uint32_t frame_index);
 };